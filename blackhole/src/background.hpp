@@ -0,0 +1,96 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// ---------------- Background writer ----------------
+// A thread that writes what one producer hands it, double-buffered: the
+// producer lays the next item out in the back buffer while the thread
+// writes the front one, and the two swap under the lock. The snapshot,
+// trajectory and checkpoint writers all hand their work over through it.
+template <class Item> struct BackgroundWriter {
+  ~BackgroundWriter() { stop(); }
+
+  // Starts the thread; write(item) runs on it for every item handed over.
+  void start(std::function<void(Item &)> writeItem) {
+    stop();
+    write = std::move(writeItem);
+    full = busy = stopping = false;
+    thread = std::thread([this] { run(); });
+  }
+  bool running() const { return thread.joinable(); }
+
+  // Lets fill(item) lay the next item out in the back buffer, then hands
+  // it over. Only blocks while the thread is a whole item behind.
+  template <class Fill> void capture(Fill &&fill) {
+    std::unique_lock<std::mutex> lock(mutex);
+    wake.wait(lock, [&] { return !full; });
+    lock.unlock();
+
+    // the thread never touches the back buffer while it is not full
+    fill(back);
+
+    lock.lock();
+    full = true;
+    wake.notify_all();
+  }
+
+  // Hands `item` over at once, replacing one still waiting to be written.
+  void replace(Item &&item) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      back = std::move(item);
+      full = true;
+    }
+    wake.notify_all();
+  }
+
+  // Waits until every item handed over is written.
+  void flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    wake.wait(lock, [&] { return !full && !busy; });
+  }
+
+  // Writes the item still waiting, if any, and ends the thread.
+  void stop() {
+    if (!thread.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    thread.join();
+  }
+
+private:
+  std::function<void(Item &)> write;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable wake;
+  Item back, front;
+  bool full = false, busy = false, stopping = false;
+
+  void run() {
+    for (;;) {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return full || stopping; });
+      if (!full)
+        return;
+      std::swap(front, back);
+      full = false;
+      busy = true;
+      wake.notify_all();
+      lock.unlock();
+
+      write(front);
+
+      lock.lock();
+      busy = false;
+      wake.notify_all();
+    }
+  }
+};
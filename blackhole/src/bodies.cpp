@@ -0,0 +1,117 @@
+#include "bodies.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+uint32_t BodySystem::add(const glm::dvec3 &p, const glm::dvec3 &v, double m,
+                         double a, uint32_t id) {
+  if (id == None) {
+    id = (uint32_t)index.size();
+    index.push_back(None);
+  }
+  index[id] = (uint32_t)size();
+  ids.push_back(id);
+  for (int k = 0; k < 3; k++) {
+    pos[k].push_back(p[k]);
+    vel[k].push_back(v[k]);
+  }
+  mass.push_back(m);
+  spin.push_back(a);
+  return id;
+}
+
+void BodySystem::remove(size_t slot) {
+  size_t last = size() - 1;
+  index[ids[slot]] = None;
+  if (slot != last)
+    index[ids[last]] = (uint32_t)slot;
+  auto take = [&](auto &column) {
+    column[slot] = column[last];
+    column.pop_back();
+  };
+  for (int k = 0; k < 3; k++) {
+    take(pos[k]);
+    take(vel[k]);
+  }
+  take(mass);
+  take(spin);
+  take(ids);
+}
+
+BodySystem BodySystem::fromHoles(const std::vector<BlackHole> &holes) {
+  BodySystem bodies;
+  for (const BlackHole &bh : holes)
+    bodies.add(glm::dvec3(bh.position) / metersToScene, glm::dvec3(0.0),
+               bh.mass, bh.spin);
+  return bodies;
+}
+
+void BodySystem::toHoles(std::vector<BlackHole> &holes) const {
+  holes.clear();
+  holes.reserve(size());
+  for (size_t i = 0; i < size(); i++)
+    holes.emplace_back(glm::vec3(position(i) * metersToScene), mass[i],
+                       spin[i]);
+}
+
+// ---------------- Morton order ----------------
+// Spreads the low 21 bits of v three apart.
+static uint64_t spreadBits(uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v << 8) & 0x100f00f00f00f00full;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2) & 0x1249249249249249ull;
+  return v;
+}
+
+uint64_t mortonKey(double x, double y, double z) {
+  const double cells = (double)(1 << 21);
+  auto cell = [&](double t) {
+    return (uint64_t)std::min(std::max(t * cells, 0.0), cells - 1.0);
+  };
+  return spreadBits(cell(x)) << 2 | spreadBits(cell(y)) << 1 |
+         spreadBits(cell(z));
+}
+
+std::vector<uint32_t> BodySystem::sortMorton() {
+  size_t n = size();
+  glm::dvec3 lo(INFINITY), hi(-INFINITY);
+  for (size_t i = 0; i < n; i++) {
+    lo = glm::min(lo, position(i));
+    hi = glm::max(hi, position(i));
+  }
+  // a cube, so the curve keeps the same resolution on every axis
+  glm::dvec3 size = hi - lo;
+  double inv = 1.0 / std::max({size.x, size.y, size.z, 1e-300});
+
+  std::vector<std::pair<uint64_t, uint32_t>> keys(n);
+  parallelFor(n, 4096, [&](size_t i) {
+    glm::dvec3 t = (position(i) - lo) * inv;
+    keys[i] = {mortonKey(t.x, t.y, t.z), (uint32_t)i};
+  });
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<uint32_t> order(n);
+  for (size_t i = 0; i < n; i++)
+    order[i] = keys[i].second;
+
+  // one column per task; each is a streaming gather
+  parallelFor(9, 1, [&](size_t k) {
+    if (k < 3)
+      permute(pos[k], order);
+    else if (k < 6)
+      permute(vel[k - 3], order);
+    else if (k == 6)
+      permute(mass, order);
+    else if (k == 7)
+      permute(spin, order);
+    else
+      permute(ids, order);
+  });
+  for (size_t i = 0; i < n; i++)
+    index[ids[i]] = (uint32_t)i;
+  return order;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "objects.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// ---------------- Bodies ----------------
+// The holes as a self-gravitating system: structure-of-arrays in SI units
+// (meters, m/s, kg) and double precision. Each body keeps the id it was
+// added with while its slot changes: sortMorton() reorders the arrays along
+// a Z-order curve so bodies close in space sit close in memory, and
+// index[id] follows every body to its current slot.
+struct BodySystem {
+  static constexpr uint32_t None = UINT32_MAX;
+
+  std::vector<double> pos[3], vel[3];
+  std::vector<double> mass;
+  std::vector<double> spin; // dimensionless a/M
+  std::vector<uint32_t> ids;   // id of the body in each slot
+  std::vector<uint32_t> index; // slot of each id, None once removed
+
+  size_t size() const { return mass.size(); }
+
+  // Appends a body and returns its id: a new one, or `id` to bring back a
+  // removed body under its old id.
+  uint32_t add(const glm::dvec3 &p, const glm::dvec3 &v, double m,
+               double a = 0.0, uint32_t id = None);
+
+  // Removes the body in `slot`, moving the last body into it.
+  void remove(size_t slot);
+
+  glm::dvec3 position(size_t i) const {
+    return {pos[0][i], pos[1][i], pos[2][i]};
+  }
+  glm::dvec3 velocity(size_t i) const {
+    return {vel[0][i], vel[1][i], vel[2][i]};
+  }
+  double rs(size_t i) const { return 2.0 * G * mass[i] / (c * c); }
+
+  // Holes at rest in scene units, and back.
+  static BodySystem fromHoles(const std::vector<BlackHole> &holes);
+  void toHoles(std::vector<BlackHole> &holes) const;
+
+  // Reorders every column along the Morton curve over the bodies' bounding
+  // box and returns the order used (new slot -> old slot), so callers can
+  // permute columns of their own with permute().
+  std::vector<uint32_t> sortMorton();
+
+  template <class T>
+  static void permute(std::vector<T> &column,
+                      const std::vector<uint32_t> &order) {
+    std::vector<T> moved(order.size());
+    for (size_t i = 0; i < order.size(); i++)
+      moved[i] = column[order[i]];
+    column.swap(moved);
+  }
+};
+
+// 63-bit Z-order key of a point with coordinates in [0, 1].
+uint64_t mortonKey(double x, double y, double z);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+// Pinhole camera shared by the ray tracers. The basis is orthonormal and
+// right-handed; image-plane coordinates run from -1 to 1 on both axes.
+struct Camera {
+  glm::vec3 position;
+  glm::vec3 forward;
+  glm::vec3 right;
+  glm::vec3 up;
+  float tanHalfFov;
+  float aspect;
+
+  static Camera lookAt(glm::vec3 eye, glm::vec3 target, glm::vec3 worldUp,
+                       float fovY, float aspect) {
+    Camera cam;
+    cam.position = eye;
+    cam.forward = glm::normalize(target - eye);
+    cam.right = glm::normalize(glm::cross(cam.forward, worldUp));
+    cam.up = glm::cross(cam.right, cam.forward);
+    cam.tanHalfFov = tanf(fovY * 0.5f);
+    cam.aspect = aspect;
+    return cam;
+  }
+
+  glm::vec3 rayDir(float u, float v) const {
+    return glm::normalize(forward + right * (u * aspect * tanHalfFov) +
+                          up * (v * tanHalfFov));
+  }
+
+  // Derivatives of rayDir(u, v) with respect to u and v.
+  void rayDirDerivatives(float u, float v, glm::vec3 &du,
+                         glm::vec3 &dv) const {
+    glm::vec3 w = forward + right * (u * aspect * tanHalfFov) +
+                  up * (v * tanHalfFov);
+    float len = glm::length(w);
+    glm::vec3 d = w / len;
+    glm::vec3 wu = right * (aspect * tanHalfFov), wv = up * tanHalfFov;
+    du = (wu - d * glm::dot(d, wu)) / len;
+    dv = (wv - d * glm::dot(d, wv)) / len;
+  }
+};
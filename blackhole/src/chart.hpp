@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cmath>
+
+// Coordinate charts for the generated metrics (see metrics/*.metric). A
+// chart maps (r, theta, phi) to Cartesian scene coordinates relative to the
+// hole, with theta measured from the +y axis:
+//
+//   fromCartesian(p, d, x, k)   position and unit direction -> x^i, k^i
+//   toCartesian(x, p)           position
+//   velocity(x, k, d)           Cartesian velocity of k^i
+//   radius(x)                   radial coordinate for horizon/escape tests
+
+// Oblate spheroidal (Boyer-Lindquist) coordinates; spherical when a = 0.
+struct OblateChart {
+  double a = 0.0;
+
+  OblateChart() = default;
+  explicit OblateChart(double spin) : a(spin) {}
+
+  template <class R>
+  void fromCartesian(const R p[3], const R d[3], R x[3], R k[3]) const {
+    using std::acos;
+    using std::atan2;
+    using std::cos;
+    using std::sin;
+    using std::sqrt;
+    R a2 = R(a * a);
+    R w = p[0] * p[0] + p[1] * p[1] + p[2] * p[2] - a2;
+    R r = sqrt(R(0.5) * (w + sqrt(w * w + R(4) * a2 * p[1] * p[1])));
+    R th = acos(p[1] / r);
+    R ph = atan2(p[2], p[0]);
+    x[0] = r;
+    x[1] = th;
+    x[2] = ph;
+
+    R st = sin(th), ct = cos(th), sp = sin(ph), cp = cos(ph);
+    R s = sqrt(r * r + a2);
+    R dh = d[0] * cp + d[2] * sp; // along the meridian, horizontal part
+    R det = -(r * r * st * st + s * s * ct * ct) / s;
+    k[0] = (-dh * r * st - s * ct * d[1]) / det;
+    k[1] = (r / s * st * d[1] - ct * dh) / det;
+    k[2] = (d[2] * cp - d[0] * sp) / (s * st);
+  }
+
+  template <class R> void toCartesian(const R x[3], R p[3]) const {
+    using std::cos;
+    using std::sin;
+    using std::sqrt;
+    R s = sqrt(x[0] * x[0] + R(a * a));
+    p[0] = s * sin(x[1]) * cos(x[2]);
+    p[1] = x[0] * cos(x[1]);
+    p[2] = s * sin(x[1]) * sin(x[2]);
+  }
+
+  template <class R> void velocity(const R x[3], const R k[3], R d[3]) const {
+    using std::cos;
+    using std::sin;
+    using std::sqrt;
+    R r = x[0];
+    R s = sqrt(r * r + R(a * a));
+    R st = sin(x[1]), ct = cos(x[1]), sp = sin(x[2]), cp = cos(x[2]);
+    R h = r / s * st * k[0] + s * ct * k[1]; // horizontal, along the meridian
+    d[0] = h * cp - s * st * sp * k[2];
+    d[1] = ct * k[0] - r * st * k[1];
+    d[2] = h * sp + s * st * cp * k[2];
+  }
+
+  template <class R> R radius(const R x[3]) const { return x[0]; }
+};
+
+// Wormhole chart: the radial coordinate is the proper distance l, and both
+// sides of the throat map onto spheres of radius sqrt(l^2 + b^2).
+struct WormholeChart {
+  double b = 0.0;
+
+  WormholeChart() = default;
+  explicit WormholeChart(double throat) : b(throat) {}
+
+  template <class R>
+  void fromCartesian(const R p[3], const R d[3], R x[3], R k[3]) const {
+    using std::acos;
+    using std::atan2;
+    using std::cos;
+    using std::sin;
+    using std::sqrt;
+    R rho = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+    R l2 = rho * rho - R(b * b);
+    R l = sqrt(l2 > R(0) ? l2 : R(0));
+    R th = acos(p[1] / rho);
+    R ph = atan2(p[2], p[0]);
+    x[0] = l;
+    x[1] = th;
+    x[2] = ph;
+
+    R st = sin(th), ct = cos(th), sp = sin(ph), cp = cos(ph);
+    R dr = d[0] * st * cp + d[1] * ct + d[2] * st * sp;
+    k[0] = dr * rho / l;
+    k[1] = (d[0] * ct * cp - d[1] * st + d[2] * ct * sp) / rho;
+    k[2] = (d[2] * cp - d[0] * sp) / (rho * st);
+  }
+
+  template <class R> void toCartesian(const R x[3], R p[3]) const {
+    using std::cos;
+    using std::sin;
+    R rho = radius(x);
+    p[0] = rho * sin(x[1]) * cos(x[2]);
+    p[1] = rho * cos(x[1]);
+    p[2] = rho * sin(x[1]) * sin(x[2]);
+  }
+
+  template <class R> void velocity(const R x[3], const R k[3], R d[3]) const {
+    using std::cos;
+    using std::sin;
+    R rho = radius(x);
+    R dr = x[0] / rho * k[0];
+    R st = sin(x[1]), ct = cos(x[1]), sp = sin(x[2]), cp = cos(x[2]);
+    d[0] = dr * st * cp + rho * (ct * cp * k[1] - st * sp * k[2]);
+    d[1] = dr * ct - rho * st * k[1];
+    d[2] = dr * st * sp + rho * (ct * sp * k[1] + st * cp * k[2]);
+  }
+
+  template <class R> R radius(const R x[3]) const {
+    using std::sqrt;
+    return sqrt(x[0] * x[0] + R(b * b));
+  }
+};
+
+// Tracer-facing side of a generated metric. Derived supplies metric() and
+// rhs(); the state is y = (t, r, theta, phi, k^t, k^r, k^theta, k^phi).
+template <class Derived, class Chart> struct CoordinateMetric {
+  static constexpr int Dim = 8;
+  Chart chart;
+
+  template <class R> void init(const R pos[3], const R dir[3], R y[]) const {
+    using std::sqrt;
+    R x[3], k[3];
+    chart.fromCartesian(pos, dir, x, k);
+    y[0] = R(0);
+    for (int i = 0; i < 3; i++) {
+      y[1 + i] = x[i];
+      y[5 + i] = k[i];
+    }
+
+    // future-pointing k^t from g_ab k^a k^b = 0
+    R g[4][4];
+    static_cast<const Derived &>(*this).metric(y, g);
+    R A = g[0][0], B = R(0), C = R(0);
+    for (int i = 1; i < 4; i++) {
+      B += g[0][i] * y[4 + i];
+      for (int j = 1; j < 4; j++)
+        C += g[i][j] * y[4 + i] * y[4 + j];
+    }
+    y[4] = (-B - sqrt(B * B - A * C)) / A;
+  }
+
+  template <class R> R radius(const R y[]) const { return chart.radius(y + 1); }
+
+  template <class R> void position(const R y[], R p[3]) const {
+    chart.toCartesian(y + 1, p);
+  }
+
+  template <class R> void direction(const R y[], R d[3]) const {
+    chart.velocity(y + 1, y + 5, d);
+  }
+
+  // Shorter steps near the polar axis, where k^phi blows up, and near the
+  // horizon, where k^t does and an overshooting stage would land inside.
+  template <class R> R stepFactor(const R y[]) const {
+    using std::sin;
+    const Derived &self = static_cast<const Derived &>(*this);
+    R s = sin(y[2]);
+    s = s < R(0) ? -s : s;
+    s = s > R(0.05) ? s : R(0.05);
+    R gap = (radius(y) - R(self.horizon())) / R(self.scale());
+    gap = gap > R(0.02) ? gap : R(0.02);
+    return gap < s ? gap : s;
+  }
+};
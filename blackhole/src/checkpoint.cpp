@@ -0,0 +1,122 @@
+#include "checkpoint.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "checkpoints are stored little-endian as in memory; this host is not"
+#endif
+
+static const char Magic[8] = {'B', 'H', 'C', 'K', 'P', 'T', 0, 0};
+static const uint32_t Version = 1;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t sections;
+};
+
+// followed by the section's bytes, padded to 8
+struct SectionHeader {
+  char name[48];
+  uint64_t bytes;
+};
+
+static size_t padded(size_t bytes) { return (bytes + 7) & ~(size_t)7; }
+
+void Checkpoint::put(const std::string &name, const void *data,
+                     size_t bytes) {
+  Section section{name, std::vector<char>(bytes)};
+  if (bytes)
+    std::memcpy(section.bytes.data(), data, bytes);
+  sections.push_back(std::move(section));
+}
+
+const Checkpoint::Section *Checkpoint::find(const std::string &name) const {
+  for (const Section &s : sections)
+    if (s.name == name)
+      return &s;
+  return nullptr;
+}
+
+bool Checkpoint::save(const std::string &path) const {
+  std::string temp = path + ".tmp";
+  FILE *f = std::fopen(temp.c_str(), "wb");
+  if (!f) {
+    std::cerr << "Cannot write checkpoint '" << temp << "'\n";
+    return false;
+  }
+  FileHeader header{};
+  std::memcpy(header.magic, Magic, 8);
+  header.version = Version;
+  header.sections = (uint32_t)sections.size();
+  bool ok = std::fwrite(&header, sizeof header, 1, f) == 1;
+  static const char zeros[8] = {};
+  for (const Section &s : sections) {
+    SectionHeader sh{};
+    std::strncpy(sh.name, s.name.c_str(), sizeof sh.name - 1);
+    sh.bytes = s.bytes.size();
+    ok = ok && std::fwrite(&sh, sizeof sh, 1, f) == 1 &&
+         std::fwrite(s.bytes.data(), 1, s.bytes.size(), f) == s.bytes.size() &&
+         std::fwrite(zeros, 1, padded(s.bytes.size()) - s.bytes.size(), f) ==
+             padded(s.bytes.size()) - s.bytes.size();
+  }
+  // on disk before it replaces the previous checkpoint
+  ok = std::fflush(f) == 0 && ok && fsync(fileno(f)) == 0;
+  ok = std::fclose(f) == 0 && ok;
+  if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+    std::cerr << "Cannot write checkpoint '" << path << "'\n";
+    std::remove(temp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool Checkpoint::load(const std::string &path) {
+  sections.clear();
+  FILE *f = std::fopen(path.c_str(), "rb");
+  if (!f) {
+    std::cerr << "Cannot open checkpoint '" << path << "'\n";
+    return false;
+  }
+  std::fseek(f, 0, SEEK_END);
+  long size = std::ftell(f);
+  std::rewind(f);
+  FileHeader header;
+  bool ok = std::fread(&header, sizeof header, 1, f) == 1 &&
+            std::memcmp(header.magic, Magic, 8) == 0 &&
+            header.version == Version;
+  for (uint32_t i = 0; ok && i < header.sections; i++) {
+    // a size past the end of the file is damage, not a reason to allocate
+    SectionHeader sh;
+    ok = std::fread(&sh, sizeof sh, 1, f) == 1 &&
+         sh.bytes <= (uint64_t)(size - std::ftell(f));
+    if (!ok)
+      break;
+    sh.name[sizeof sh.name - 1] = 0;
+    Section section{sh.name, std::vector<char>(sh.bytes)};
+    ok = std::fread(section.bytes.data(), 1, sh.bytes, f) == sh.bytes &&
+         std::fseek(f, (long)(padded(sh.bytes) - sh.bytes), SEEK_CUR) == 0;
+    sections.push_back(std::move(section));
+  }
+  std::fclose(f);
+  if (!ok) {
+    std::cerr << "Checkpoint '" << path << "' is damaged\n";
+    sections.clear();
+  }
+  return ok;
+}
+
+// ---------------- Writer ----------------
+void CheckpointWriter::submit(Checkpoint &&checkpoint,
+                              const std::string &path) {
+  if (!writer.running())
+    writer.start([](Pending &p) { p.checkpoint.save(p.path); });
+  writer.replace({std::move(checkpoint), path});
+}
+
+void CheckpointWriter::flush() { writer.flush(); }
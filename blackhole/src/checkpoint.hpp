@@ -0,0 +1,77 @@
+#pragma once
+
+#include "background.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// ---------------- Checkpoints ----------------
+// Everything a run needs to carry on after being stopped, as named
+// sections of raw little-endian memory in one file. save() writes
+// `path`.tmp and renames it over `path` once it is on disk, so a run
+// killed mid-write still has its previous checkpoint.
+struct Checkpoint {
+  struct Section {
+    std::string name;
+    std::vector<char> bytes;
+  };
+  std::vector<Section> sections;
+
+  void put(const std::string &name, const void *data, size_t bytes);
+  template <class T>
+  void put(const std::string &name, const std::vector<T> &column) {
+    put(name, column.data(), column.size() * sizeof(T));
+  }
+  template <class T> void putValue(const std::string &name, const T &value) {
+    put(name, &value, sizeof value);
+  }
+
+  const Section *find(const std::string &name) const;
+
+  // Size in elements of T of a section that exists and holds whole T's,
+  // -1 otherwise; lets a restore check every section before it changes
+  // anything.
+  template <class T> long count(const std::string &name) const {
+    const Section *s = find(name);
+    return s && s->bytes.size() % sizeof(T) == 0
+               ? (long)(s->bytes.size() / sizeof(T))
+               : -1;
+  }
+  template <class T>
+  bool get(const std::string &name, std::vector<T> &column) const {
+    long n = count<T>(name);
+    if (n < 0)
+      return false;
+    column.resize((size_t)n);
+    std::memcpy(column.data(), find(name)->bytes.data(), n * sizeof(T));
+    return true;
+  }
+  template <class T> bool getValue(const std::string &name, T &value) const {
+    if (count<T>(name) != 1)
+      return false;
+    std::memcpy(&value, find(name)->bytes.data(), sizeof value);
+    return true;
+  }
+
+  bool save(const std::string &path) const;
+  bool load(const std::string &path);
+};
+
+// Saves checkpoints off the main loop. The loop only pays for copying its
+// state into a Checkpoint; submit() hands that over and returns at once,
+// and a checkpoint still waiting when a newer one arrives is replaced.
+struct CheckpointWriter {
+  void submit(Checkpoint &&checkpoint, const std::string &path);
+
+  // Waits until the latest submitted checkpoint is saved.
+  void flush();
+
+private:
+  struct Pending {
+    Checkpoint checkpoint;
+    std::string path;
+  };
+  BackgroundWriter<Pending> writer;
+};
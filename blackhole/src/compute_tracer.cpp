@@ -0,0 +1,210 @@
+#include "compute_tracer.hpp"
+#include "shader.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+
+using namespace glm;
+
+// Workgroups poll a shared live-ray counter every 16 steps and leave the
+// loop together once it hits zero, so a tile of sky pixels stops as soon as
+// its last ray escapes instead of running out the full step budget.
+static const char *computeSrc = R"(
+  #version 430 core
+  layout(local_size_x = 8, local_size_y = 8) in;
+
+  layout(rgba8, binding = 0) uniform writeonly image2D uImage;
+
+  // xyz = position, w = Schwarzschild radius (scene units)
+  layout(std430, binding = 1) readonly buffer Holes { vec4 holes[]; };
+
+  uniform int uHoleCount;
+  uniform vec3 uCamPos;
+  uniform vec3 uCamRight;
+  uniform vec3 uCamUp;
+  uniform vec3 uCamForward;
+  uniform float uTanHalfFov;
+  uniform float uAspect;
+  uniform int uMaxSteps;
+  uniform float uEscapeRadius;
+
+  shared uint sAlive;
+
+  const float kDiskInner = 3.0; // r_s
+  const float kDiskOuter = 8.0;
+
+  // photon acceleration in Schwarzschild, written in Cartesian form
+  vec3 accel(vec3 p, vec3 v) {
+    vec3 a = vec3(0.0);
+    for (int i = 0; i < uHoleCount; ++i) {
+      vec3 d = p - holes[i].xyz;
+      float r2 = dot(d, d);
+      vec3 h = cross(d, v);
+      a -= 1.5 * holes[i].w * dot(h, h) * d / (r2 * r2 * sqrt(r2));
+    }
+    return a;
+  }
+
+  float hash(vec3 q) {
+    return fract(sin(dot(q, vec3(12.9898, 78.233, 37.719))) * 43758.5453);
+  }
+
+  vec3 sky(vec3 d) {
+    float theta = acos(clamp(d.y, -1.0, 1.0));
+    float phi = atan(d.z, d.x);
+    vec2 g = abs(fract(vec2(phi * 3.8197186, theta * 3.8197186)) - 0.5);
+    float line = smoothstep(0.46, 0.5, max(g.x, g.y));
+    vec3 col = mix(vec3(0.02, 0.02, 0.05), vec3(0.25, 0.25, 0.35), line);
+    if (hash(floor(d * 200.0)) > 0.998)
+      col = vec3(1.0);
+    return col;
+  }
+
+  vec3 disk(float r) {
+    float t = (r - kDiskInner) / (kDiskOuter - kDiskInner);
+    vec3 col = mix(vec3(1.0, 0.85, 0.6), vec3(0.8, 0.25, 0.05), t);
+    return col * (1.0 - 0.6 * t);
+  }
+
+  void main() {
+    ivec2 pix = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(uImage);
+    bool inside = pix.x < size.x && pix.y < size.y;
+
+    vec2 ndc = (vec2(pix) + 0.5) / vec2(size) * 2.0 - 1.0;
+    vec3 p = uCamPos;
+    vec3 v = normalize(uCamForward + ndc.x * uAspect * uTanHalfFov * uCamRight +
+                       ndc.y * uTanHalfFov * uCamUp);
+    vec3 color = vec3(0.0);
+    bool alive = inside;
+
+    for (int i = 0; i < uMaxSteps; ++i) {
+      if (alive) {
+        float rmin = 1e30;
+        float rs = 0.0;
+        bool outward = true;
+        for (int k = 0; k < uHoleCount; ++k) {
+          vec3 d = p - holes[k].xyz;
+          float r = length(d);
+          outward = outward && dot(d, v) > 0.0;
+          if (r < rmin) {
+            rmin = r;
+            rs = holes[k].w;
+          }
+        }
+
+        if (rmin < rs) {
+          color = vec3(0.0);
+          alive = false;
+        } else if (rmin > uEscapeRadius && outward) {
+          color = sky(normalize(v));
+          alive = false;
+        } else {
+          float h = 0.05 * rmin;
+          vec3 k1v = accel(p, v), k1p = v;
+          vec3 k2v = accel(p + 0.5 * h * k1p, v + 0.5 * h * k1v), k2p = v + 0.5 * h * k1v;
+          vec3 k3v = accel(p + 0.5 * h * k2p, v + 0.5 * h * k2v), k3p = v + 0.5 * h * k2v;
+          vec3 k4v = accel(p + h * k3p, v + h * k3v), k4p = v + h * k3v;
+          vec3 pn = p + h / 6.0 * (k1p + 2.0 * k2p + 2.0 * k3p + k4p);
+          vec3 vn = v + h / 6.0 * (k1v + 2.0 * k2v + 2.0 * k3v + k4v);
+
+          // equatorial disk crossing, linearly interpolated within the step
+          for (int k = 0; k < uHoleCount && alive; ++k) {
+            float y0 = p.y - holes[k].y;
+            float y1 = pn.y - holes[k].y;
+            if (y0 * y1 < 0.0) {
+              vec3 q = mix(p, pn, y0 / (y0 - y1));
+              float r = length(q - holes[k].xyz) / holes[k].w;
+              if (r > kDiskInner && r < kDiskOuter) {
+                color = disk(r);
+                alive = false;
+              }
+            }
+          }
+          p = pn;
+          v = vn;
+        }
+      }
+
+      if ((i & 15) == 15) {
+        if (gl_LocalInvocationIndex == 0u)
+          sAlive = 0u;
+        barrier();
+        if (alive)
+          atomicAdd(sAlive, 1u);
+        barrier();
+        bool done = sAlive == 0u;
+        barrier(); // nobody resets the counter before everyone has read it
+        if (done)
+          break;
+      }
+    }
+
+    if (alive)
+      color = sky(normalize(v));
+    if (inside)
+      imageStore(uImage, pix, vec4(color, 1.0));
+  }
+)";
+
+bool ComputeTracer::init(int w, int h) {
+  program = makeComputeProgram(computeSrc);
+  if (!program)
+    return false;
+  glGenBuffers(1, &holeBuffer);
+  resize(w, h);
+  return true;
+}
+
+void ComputeTracer::resize(int w, int h) {
+  if (image && w == width && h == height)
+    return;
+  width = w;
+  height = h;
+
+  if (image)
+    glDeleteTextures(1, &image);
+  glGenTextures(1, &image);
+  glBindTexture(GL_TEXTURE_2D, image);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, w, h);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void ComputeTracer::trace(const std::vector<BlackHole> &holes,
+                          const Camera &cam) {
+  // never hand the shader a zero-sized buffer
+  std::vector<vec4> params(std::max<size_t>(holes.size(), 1), vec4(0.0f));
+  float maxRs = 0.0f;
+  for (size_t i = 0; i < holes.size(); i++) {
+    params[i] = vec4(holes[i].position, holes[i].sceneRadius());
+    maxRs = std::max(maxRs, holes[i].sceneRadius());
+  }
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, holeBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, params.size() * sizeof(vec4),
+               params.data(), GL_DYNAMIC_DRAW);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, holeBuffer);
+
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "uHoleCount"), (GLint)holes.size());
+  glUniform3fv(glGetUniformLocation(program, "uCamPos"), 1,
+               value_ptr(cam.position));
+  glUniform3fv(glGetUniformLocation(program, "uCamRight"), 1,
+               value_ptr(cam.right));
+  glUniform3fv(glGetUniformLocation(program, "uCamUp"), 1, value_ptr(cam.up));
+  glUniform3fv(glGetUniformLocation(program, "uCamForward"), 1,
+               value_ptr(cam.forward));
+  glUniform1f(glGetUniformLocation(program, "uTanHalfFov"), cam.tanHalfFov);
+  glUniform1f(glGetUniformLocation(program, "uAspect"), cam.aspect);
+  glUniform1i(glGetUniformLocation(program, "uMaxSteps"), maxSteps);
+  glUniform1f(glGetUniformLocation(program, "uEscapeRadius"),
+              escapeRadius * maxRs);
+
+  glBindImageTexture(0, image, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+  glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+  glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
+                  GL_TEXTURE_FETCH_BARRIER_BIT);
+}
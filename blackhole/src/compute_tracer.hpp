@@ -0,0 +1,24 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "camera.hpp"
+#include "objects.hpp"
+
+#include <vector>
+
+// Geodesic tracer for GL 4.3+ contexts. One compute invocation per pixel
+// integrates a photon through the summed Schwarzschild pull of every hole
+// and writes the shaded result into `image` with imageStore.
+struct ComputeTracer {
+  GLuint program = 0;
+  GLuint image = 0;
+  GLuint holeBuffer = 0;
+  int width = 0, height = 0;
+  int maxSteps = 600;
+  float escapeRadius = 50.0f; // in units of the largest r_s
+
+  bool init(int w, int h);
+  void resize(int w, int h);
+  void trace(const std::vector<BlackHole> &holes, const Camera &cam);
+};
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cmath>
+#include <type_traits>
+
+// Forward-mode dual numbers: a value and its derivatives with respect to N
+// seed variables. Plugged into Tracer as the Real type, every step carries
+// the derivatives of the ray along with it, which gives ray differentials
+// without tracing offset rays. Comparisons look at the value only, so
+// branches follow the primal ray.
+template <class T, int N> struct Dual {
+  T v;
+  T d[N];
+
+  Dual() : v(0) {
+    for (int i = 0; i < N; i++)
+      d[i] = T(0);
+  }
+  explicit Dual(T value) : v(value) {
+    for (int i = 0; i < N; i++)
+      d[i] = T(0);
+  }
+
+  template <class U, class = std::enable_if_t<std::is_arithmetic<U>::value>>
+  explicit operator U() const {
+    return U(v);
+  }
+
+  Dual operator-() const {
+    Dual r;
+    r.v = -v;
+    for (int i = 0; i < N; i++)
+      r.d[i] = -d[i];
+    return r;
+  }
+
+  Dual &operator+=(const Dual &b) {
+    v += b.v;
+    for (int i = 0; i < N; i++)
+      d[i] += b.d[i];
+    return *this;
+  }
+  Dual &operator-=(const Dual &b) {
+    v -= b.v;
+    for (int i = 0; i < N; i++)
+      d[i] -= b.d[i];
+    return *this;
+  }
+  Dual &operator*=(const Dual &b) {
+    for (int i = 0; i < N; i++)
+      d[i] = d[i] * b.v + v * b.d[i];
+    v *= b.v;
+    return *this;
+  }
+  Dual &operator/=(const Dual &b) {
+    T inv = T(1) / b.v;
+    v *= inv;
+    for (int i = 0; i < N; i++)
+      d[i] = (d[i] - v * b.d[i]) * inv;
+    return *this;
+  }
+};
+
+// value f(a.v) with derivative df = f'(a.v)
+template <class T, int N>
+inline Dual<T, N> chain(const Dual<T, N> &a, T f, T df) {
+  Dual<T, N> r;
+  r.v = f;
+  for (int i = 0; i < N; i++)
+    r.d[i] = df * a.d[i];
+  return r;
+}
+
+// ---------------- Arithmetic ----------------
+template <class T, int N>
+inline Dual<T, N> operator+(Dual<T, N> a, const Dual<T, N> &b) {
+  return a += b;
+}
+template <class T, int N>
+inline Dual<T, N> operator-(Dual<T, N> a, const Dual<T, N> &b) {
+  return a -= b;
+}
+template <class T, int N>
+inline Dual<T, N> operator*(Dual<T, N> a, const Dual<T, N> &b) {
+  return a *= b;
+}
+template <class T, int N>
+inline Dual<T, N> operator/(Dual<T, N> a, const Dual<T, N> &b) {
+  return a /= b;
+}
+
+#define BLACKHOLE_DUAL_SCALAR_OP(OP)                                           \
+  template <class T, int N>                                                    \
+  inline Dual<T, N> operator OP(const Dual<T, N> &a, T b) {                    \
+    return a OP Dual<T, N>(b);                                                 \
+  }                                                                            \
+  template <class T, int N>                                                    \
+  inline Dual<T, N> operator OP(T a, const Dual<T, N> &b) {                    \
+    return Dual<T, N>(a) OP b;                                                 \
+  }
+BLACKHOLE_DUAL_SCALAR_OP(+)
+BLACKHOLE_DUAL_SCALAR_OP(-)
+BLACKHOLE_DUAL_SCALAR_OP(*)
+BLACKHOLE_DUAL_SCALAR_OP(/)
+#undef BLACKHOLE_DUAL_SCALAR_OP
+
+#define BLACKHOLE_DUAL_COMPARE(OP)                                             \
+  template <class T, int N>                                                    \
+  inline bool operator OP(const Dual<T, N> &a, const Dual<T, N> &b) {          \
+    return a.v OP b.v;                                                         \
+  }                                                                            \
+  template <class T, int N>                                                    \
+  inline bool operator OP(const Dual<T, N> &a, T b) {                          \
+    return a.v OP b;                                                           \
+  }                                                                            \
+  template <class T, int N>                                                    \
+  inline bool operator OP(T a, const Dual<T, N> &b) {                          \
+    return a OP b.v;                                                           \
+  }
+BLACKHOLE_DUAL_COMPARE(<)
+BLACKHOLE_DUAL_COMPARE(>)
+BLACKHOLE_DUAL_COMPARE(<=)
+BLACKHOLE_DUAL_COMPARE(>=)
+BLACKHOLE_DUAL_COMPARE(==)
+BLACKHOLE_DUAL_COMPARE(!=)
+#undef BLACKHOLE_DUAL_COMPARE
+
+// ---------------- Functions ----------------
+// Found by argument-dependent lookup next to `using std::sqrt;` and friends.
+template <class T, int N> inline Dual<T, N> sqrt(const Dual<T, N> &a) {
+  T s = std::sqrt(a.v);
+  return chain(a, s, T(0.5) / s);
+}
+template <class T, int N> inline Dual<T, N> sin(const Dual<T, N> &a) {
+  return chain(a, std::sin(a.v), std::cos(a.v));
+}
+template <class T, int N> inline Dual<T, N> cos(const Dual<T, N> &a) {
+  return chain(a, std::cos(a.v), -std::sin(a.v));
+}
+template <class T, int N> inline Dual<T, N> exp(const Dual<T, N> &a) {
+  T e = std::exp(a.v);
+  return chain(a, e, e);
+}
+template <class T, int N> inline Dual<T, N> log(const Dual<T, N> &a) {
+  return chain(a, std::log(a.v), T(1) / a.v);
+}
+template <class T, int N> inline Dual<T, N> pow(const Dual<T, N> &a, T p) {
+  T q = std::pow(a.v, p - T(1));
+  return chain(a, q * a.v, p * q);
+}
+template <class T, int N> inline Dual<T, N> acos(const Dual<T, N> &a) {
+  return chain(a, std::acos(a.v), T(-1) / std::sqrt(T(1) - a.v * a.v));
+}
+template <class T, int N> inline Dual<T, N> atan(const Dual<T, N> &a) {
+  return chain(a, std::atan(a.v), T(1) / (T(1) + a.v * a.v));
+}
+template <class T, int N>
+inline Dual<T, N> atan2(const Dual<T, N> &y, const Dual<T, N> &x) {
+  Dual<T, N> r;
+  r.v = std::atan2(y.v, x.v);
+  T inv = T(1) / (x.v * x.v + y.v * y.v);
+  for (int i = 0; i < N; i++)
+    r.d[i] = (x.v * y.d[i] - y.v * x.d[i]) * inv;
+  return r;
+}
+
+// ---------------- Tangents ----------------
+// Uniform access to seed derivatives, so generic code can run on plain
+// scalars (no tangents) and duals alike.
+template <class R> struct Tangents {
+  static constexpr int N = 0;
+  static R seed(double v, const double *) { return R(v); }
+  static double get(const R &, int) { return 0.0; }
+};
+
+template <class T, int M> struct Tangents<Dual<T, M>> {
+  static constexpr int N = M;
+  static Dual<T, M> seed(double v, const double *d) {
+    Dual<T, M> r{T(v)};
+    for (int i = 0; i < M; i++)
+      r.d[i] = T(d[i]);
+    return r;
+  }
+  static double get(const Dual<T, M> &a, int i) { return (double)a.d[i]; }
+};
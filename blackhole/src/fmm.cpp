@@ -0,0 +1,467 @@
+#include "fmm.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using glm::dvec3;
+
+// orders above this make M2L cost more than it saves
+static constexpr int MaxOrder = 10;
+static constexpr int MaxTerms = (MaxOrder + 1) * (MaxOrder + 2) *
+                                (MaxOrder + 3) / 6;
+static constexpr int MaxDepth = 40;
+
+static double factorial(int n) {
+  double f = 1.0;
+  for (int i = 2; i <= n; i++)
+    f *= i;
+  return f;
+}
+
+static double binomial(int n, int k) {
+  return factorial(n) / (factorial(k) * factorial(n - k));
+}
+
+// out[op.out] += op.coef * in[op.in] * table[op.power] for ops grouped by
+// out, summing each group in a register.
+static void apply(const std::vector<FmmSolver::Op> &ops, const double *in,
+                  const double *table, double *out) {
+  if (ops.empty())
+    return;
+  int current = ops[0].out;
+  double sum = 0.0;
+  for (const FmmSolver::Op &op : ops) {
+    if (op.out != current) {
+      out[current] += sum;
+      current = op.out;
+      sum = 0.0;
+    }
+    sum += op.coef * in[op.in] * table[op.power];
+  }
+  out[current] += sum;
+}
+
+// ---------------- Operator tables ----------------
+FmmSolver::FmmSolver(const FmmConfig &config) : cfg(config) {
+  int p = std::min(std::max(cfg.order, 0), MaxOrder);
+  cfg.order = p;
+  slot.assign((p + 1) * (p + 1) * (p + 1), -1);
+  for (int n = 0; n <= p; n++)
+    for (int x = n; x >= 0; x--)
+      for (int y = n - x; y >= 0; y--) {
+        slot[(x * (p + 1) + y) * (p + 1) + (n - x - y)] = (int)powers.size();
+        powers.push_back({x, y, n - x - y});
+      }
+
+  auto fact = [](Index k) {
+    return factorial(k.x) * factorial(k.y) * factorial(k.z);
+  };
+  for (int t = 0; t < terms(); t++) {
+    Index k = powers[t];
+    int order = k.x + k.y + k.z;
+    p2m.push_back(1.0 / fact(k));
+
+    Lower low{-1, {-1, -1, -1}, {-1, -1, -1}};
+    int e[3] = {k.x, k.y, k.z};
+    for (int i = 2; i >= 0; i--) {
+      int d[3] = {k.x, k.y, k.z};
+      d[i] -= 1;
+      low.one[i] = index(d[0], d[1], d[2]);
+      d[i] -= 1;
+      low.two[i] = index(d[0], d[1], d[2]);
+      if (e[i])
+        low.axis = i;
+    }
+    lower.push_back(low);
+
+    // M_k(c) = sum_{l <= k} M_l(c') (c' - c)^(k - l) / (k - l)!
+    for (int s = 0; s < terms(); s++) {
+      Index l = powers[s];
+      if (l.x > k.x || l.y > k.y || l.z > k.z)
+        continue;
+      Index d{k.x - l.x, k.y - l.y, k.z - l.z};
+      m2m.push_back({t, s, index(d.x, d.y, d.z), 1.0 / fact(d)});
+    }
+
+    // L_n = sum_k (-1)^|k| M_k a_{k+n} (k+n)! / n!, with |k| + |n| <= p
+    for (int s = 0; s < terms(); s++) {
+      Index m = powers[s];
+      int mOrder = m.x + m.y + m.z;
+      if (mOrder + order > p)
+        continue;
+      Index kn{m.x + k.x, m.y + k.y, m.z + k.z};
+      double sign = mOrder % 2 ? -1.0 : 1.0;
+      m2l.push_back({t, s, index(kn.x, kn.y, kn.z), sign * fact(kn) / fact(k)});
+    }
+
+    // L_m(z') = sum_{n >= m} L_n(z) C(n, m) (z' - z)^(n - m)
+    for (int s = 0; s < terms(); s++) {
+      Index n = powers[s];
+      if (n.x < k.x || n.y < k.y || n.z < k.z)
+        continue;
+      double coef = binomial(n.x, k.x) * binomial(n.y, k.y) *
+                    binomial(n.z, k.z);
+      l2l.push_back({t, s, index(n.x - k.x, n.y - k.y, n.z - k.z), coef});
+    }
+
+    // d/dx_i of L_n (x - z)^n
+    for (int i = 0; i < 3; i++)
+      if (e[i])
+        l2p[i].push_back({0, t, low.one[i], (double)e[i]});
+  }
+}
+
+int FmmSolver::index(int x, int y, int z) const {
+  int p = cfg.order;
+  if (x < 0 || y < 0 || z < 0 || x + y + z > p)
+    return -1;
+  return slot[(x * (p + 1) + y) * (p + 1) + z];
+}
+
+// d^k for every term, each from the term one lower.
+void FmmSolver::monomials(const dvec3 &d, double *out) const {
+  out[0] = 1.0;
+  for (int t = 1; t < terms(); t++) {
+    const Lower &low = lower[t];
+    out[t] = out[low.one[low.axis]] * d[low.axis];
+  }
+}
+
+// Taylor coefficients a_m = D^m (1/|r|) / m!, from
+//   |m| r^2 a_m = -(2|m| - 1) sum_i r_i a_{m-e_i} - (|m| - 1) sum_i a_{m-2e_i}
+void FmmSolver::derivatives(const dvec3 &r, double *out) const {
+  double r2 = glm::dot(r, r);
+  out[0] = 1.0 / std::sqrt(r2);
+  double inv2 = 1.0 / r2;
+  for (int t = 1; t < terms(); t++) {
+    const Lower &low = lower[t];
+    Index m = powers[t];
+    int n = m.x + m.y + m.z;
+    double first = 0.0, second = 0.0;
+    for (int i = 0; i < 3; i++) {
+      if (low.one[i] >= 0)
+        first += r[i] * out[low.one[i]];
+      if (low.two[i] >= 0)
+        second += out[low.two[i]];
+    }
+    out[t] = -((2 * n - 1) * first + (n - 1) * second) * inv2 / n;
+  }
+}
+
+// ---------------- Build ----------------
+void FmmSolver::build(const BodySystem &bodies) {
+  size_t n = bodies.size();
+  order.resize(n);
+  for (size_t i = 0; i < n; i++)
+    order[i] = (uint32_t)i;
+  for (int k = 0; k < 3; k++)
+    pos[k] = bodies.pos[k];
+  mass = bodies.mass;
+  ids = bodies.ids;
+
+  dvec3 lo(INFINITY), hi(-INFINITY);
+  for (size_t i = 0; i < n; i++) {
+    dvec3 p(pos[0][i], pos[1][i], pos[2][i]);
+    lo = glm::min(lo, p);
+    hi = glm::max(hi, p);
+  }
+  dvec3 size = hi - lo;
+  double half = 0.5 * std::max({size.x, size.y, size.z, 1e-9}) * (1.0 + 1e-9);
+
+  nodes.clear();
+  levels.assign(1, {0});
+  leaves.clear();
+  nodes.push_back({(lo + hi) * 0.5, half, lo, hi, dvec3(0.0), 0.0, 0.0, 0,
+                   (int)n, -1, 0, -1});
+  if (n)
+    buildNode(0, 0);
+
+  // bodies in tree order from here on
+  for (int k = 0; k < 3; k++)
+    BodySystem::permute(pos[k], order);
+  BodySystem::permute(mass, order);
+  BodySystem::permute(ids, order);
+  builtRadius = 0.0;
+  rebuilds++;
+}
+
+// Same tree, bodies where they are now. Fails if any body of the tree is
+// gone or new ones came, which the tree's leaves cannot absorb.
+bool FmmSolver::refit(const BodySystem &bodies) {
+  size_t n = bodies.size();
+  if (nodes.empty() || ids.size() != n)
+    return false;
+  for (size_t i = 0; i < n; i++) {
+    uint32_t id = ids[i];
+    if (id >= bodies.index.size() || bodies.index[id] == BodySystem::None)
+      return false;
+    order[i] = bodies.index[id];
+  }
+  parallelFor(n, 4096, [&](size_t i) {
+    for (int k = 0; k < 3; k++)
+      pos[k][i] = bodies.pos[k][order[i]];
+    mass[i] = bodies.mass[order[i]];
+  });
+  refits++;
+  return true;
+}
+
+void FmmSolver::update(const BodySystem &bodies) {
+  if (!(swelling < cfg.refitLimit && refit(bodies)))
+    build(bodies);
+  upward();
+
+  double radius = 0.0;
+  for (const Node &node : nodes)
+    radius += node.radius;
+  if (builtRadius == 0.0)
+    builtRadius = radius;
+  swelling = builtRadius > 0.0 ? radius / builtRadius : 1.0;
+}
+
+// Splits a cube into its non-empty octants with a counting sort of the
+// node's bodies; children go to the node array together.
+void FmmSolver::buildNode(int node, int depth) {
+  int first = nodes[node].first, count = nodes[node].count;
+  if (count <= cfg.leafSize || depth >= MaxDepth) {
+    leaves.push_back(node);
+    return;
+  }
+
+  dvec3 c = nodes[node].center;
+  double half = nodes[node].half * 0.5;
+  auto octant = [&](uint32_t b) {
+    return (pos[0][b] > c.x ? 1 : 0) | (pos[1][b] > c.y ? 2 : 0) |
+           (pos[2][b] > c.z ? 4 : 0);
+  };
+  int counts[8] = {}, starts[8];
+  for (int i = first; i < first + count; i++)
+    counts[octant(order[i])]++;
+  std::vector<uint32_t> sorted(count);
+  for (int o = 0, sum = 0; o < 8; o++) {
+    starts[o] = sum;
+    sum += counts[o];
+  }
+  int cursor[8];
+  std::copy(starts, starts + 8, cursor);
+  for (int i = first; i < first + count; i++)
+    sorted[cursor[octant(order[i])]++] = order[i];
+  std::copy(sorted.begin(), sorted.end(), order.begin() + first);
+
+  int firstChild = (int)nodes.size();
+  if ((int)levels.size() <= depth + 1)
+    levels.emplace_back();
+  for (int o = 0; o < 8; o++) {
+    if (!counts[o])
+      continue;
+    dvec3 offset(o & 1 ? half : -half, o & 2 ? half : -half,
+                 o & 4 ? half : -half);
+    levels[depth + 1].push_back((int)nodes.size());
+    nodes.push_back({c + offset, half, dvec3(0.0), dvec3(0.0), dvec3(0.0),
+                     0.0, 0.0, first + starts[o], counts[o], -1, 0, node});
+  }
+  int end = (int)nodes.size();
+  nodes[node].firstChild = firstChild;
+  nodes[node].childCount = end - firstChild;
+  for (int i = firstChild; i < end; i++)
+    buildNode(i, depth + 1);
+}
+
+// ---------------- Upward pass ----------------
+// Deepest level first, every node of a level in parallel: leaves sum their
+// bodies (P2M), inner nodes shift their children's expansions (M2M). The
+// bounds are recomputed on the way, which is all a refit needs.
+void FmmSolver::upward() {
+  const int T = terms();
+  multipoles.assign(nodes.size() * T, 0.0);
+  for (int level = (int)levels.size() - 1; level >= 0; level--) {
+    const std::vector<int> &list = levels[level];
+    parallelFor(list.size(), 16, [&](size_t li) {
+      Node &node = nodes[list[li]];
+      double *M = &multipoles[(size_t)list[li] * T];
+      double mono[MaxTerms];
+
+      if (node.firstChild < 0) {
+        dvec3 weighted(0.0), lo(INFINITY), hi(-INFINITY);
+        double m = 0.0;
+        for (int i = node.first; i < node.first + node.count; i++) {
+          dvec3 x(pos[0][i], pos[1][i], pos[2][i]);
+          weighted += x * mass[i];
+          m += mass[i];
+          lo = glm::min(lo, x);
+          hi = glm::max(hi, x);
+        }
+        node.lo = lo;
+        node.hi = hi;
+        node.mass = m;
+        node.com = m > 0.0 ? weighted / m : node.center;
+        node.radius = 0.0;
+        for (int i = node.first; i < node.first + node.count; i++) {
+          dvec3 d = dvec3(pos[0][i], pos[1][i], pos[2][i]) - node.com;
+          node.radius = std::max(node.radius, glm::length(d));
+          monomials(d, mono);
+          for (int t = 0; t < T; t++)
+            M[t] += mass[i] * mono[t] * p2m[t];
+        }
+        return;
+      }
+
+      dvec3 weighted(0.0), lo(INFINITY), hi(-INFINITY);
+      double m = 0.0;
+      for (int c = node.firstChild; c < node.firstChild + node.childCount;
+           c++) {
+        weighted += nodes[c].com * nodes[c].mass;
+        m += nodes[c].mass;
+        lo = glm::min(lo, nodes[c].lo);
+        hi = glm::max(hi, nodes[c].hi);
+      }
+      node.lo = lo;
+      node.hi = hi;
+      node.mass = m;
+      node.com = m > 0.0 ? weighted / m : node.center;
+      // no body is farther than the box's far corner either
+      node.radius = glm::length(glm::max(node.com - lo, hi - node.com));
+      double bound = 0.0;
+      for (int c = node.firstChild; c < node.firstChild + node.childCount;
+           c++) {
+        const Node &child = nodes[c];
+        bound = std::max(bound,
+                         child.radius + glm::length(child.com - node.com));
+        monomials(child.com - node.com, mono);
+        const double *Mc = &multipoles[(size_t)c * T];
+        apply(m2m, Mc, mono, M);
+      }
+      node.radius = std::min(node.radius, bound);
+    });
+  }
+}
+
+// ---------------- Traversal ----------------
+// Every body of `target` ends up feeling every body of `source` once:
+// through an expansion if the cells are well separated, directly if both
+// are leaves, otherwise after splitting the larger cell.
+void FmmSolver::traverse(int target, int source) {
+  const Node &t = nodes[target];
+  const Node &s = nodes[source];
+  double d = glm::length(t.com - s.com);
+  if (t.radius + s.radius < cfg.theta * d) {
+    farList[target].push_back(source);
+    return;
+  }
+  bool tLeaf = t.firstChild < 0, sLeaf = s.firstChild < 0;
+  if (tLeaf && sLeaf) {
+    nearList[target].push_back(source);
+    return;
+  }
+  if (sLeaf || (!tLeaf && t.radius >= s.radius)) {
+    for (int c = t.firstChild; c < t.firstChild + t.childCount; c++)
+      traverse(c, source);
+  } else {
+    for (int c = s.firstChild; c < s.firstChild + s.childCount; c++)
+      traverse(target, c);
+  }
+}
+
+// ---------------- Downward pass ----------------
+void FmmSolver::evaluate(std::vector<double> (&acc)[3]) {
+  const int T = terms();
+  size_t n = order.size();
+  for (int k = 0; k < 3; k++)
+    acc[k].assign(n, 0.0);
+  if (nodes.empty() || n == 0)
+    return;
+
+  // Target subtrees are independent, so the traversal runs from a
+  // frontier of them in parallel.
+  farList.resize(nodes.size());
+  nearList.resize(nodes.size());
+  for (size_t i = 0; i < nodes.size(); i++) {
+    farList[i].clear();
+    nearList[i].clear();
+  }
+  std::vector<int> frontier{0};
+  while (frontier.size() < 64) {
+    std::vector<int> next;
+    for (int f : frontier) {
+      const Node &node = nodes[f];
+      if (node.firstChild < 0)
+        next.push_back(f);
+      else
+        for (int c = 0; c < node.childCount; c++)
+          next.push_back(node.firstChild + c);
+    }
+    if (next.size() == frontier.size())
+      break;
+    frontier.swap(next);
+  }
+  parallelFor(frontier.size(), 1, [&](size_t i) { traverse(frontier[i], 0); });
+
+  locals.assign(nodes.size() * T, 0.0);
+  parallelFor(nodes.size(), 64, [&](size_t t) {
+    double a[MaxTerms];
+    double *L = &locals[t * T];
+    for (int s : farList[t]) {
+      derivatives(nodes[t].com - nodes[s].com, a);
+      const double *M = &multipoles[(size_t)s * T];
+      apply(m2l, M, a, L);
+    }
+  });
+
+  for (size_t level = 1; level < levels.size(); level++) {
+    const std::vector<int> &list = levels[level];
+    parallelFor(list.size(), 16, [&](size_t li) {
+      const Node &node = nodes[list[li]];
+      double mono[MaxTerms];
+      monomials(node.com - nodes[node.parent].com, mono);
+      double *L = &locals[(size_t)list[li] * T];
+      const double *Lp = &locals[(size_t)node.parent * T];
+      apply(l2l, Lp, mono, L);
+    });
+  }
+
+  const double eps2 = cfg.softening * cfg.softening;
+  parallelFor(leaves.size(), 4, [&](size_t li) {
+    const Node &node = nodes[leaves[li]];
+    const double *L = &locals[(size_t)leaves[li] * T];
+    double mono[MaxTerms];
+    for (int i = node.first; i < node.first + node.count; i++) {
+      dvec3 x(pos[0][i], pos[1][i], pos[2][i]);
+      dvec3 g(0.0);
+      monomials(x - node.com, mono);
+      for (int k = 0; k < 3; k++)
+        for (const Op &op : l2p[k])
+          g[k] += op.coef * L[op.in] * mono[op.power];
+
+      for (int s : nearList[leaves[li]]) {
+        const Node &src = nodes[s];
+        for (int j = src.first; j < src.first + src.count; j++) {
+          dvec3 d = dvec3(pos[0][j], pos[1][j], pos[2][j]) - x;
+          double r2 = glm::dot(d, d) + eps2;
+          if (r2 > 0.0)
+            g += d * (mass[j] / (r2 * std::sqrt(r2)));
+        }
+      }
+      for (int k = 0; k < 3; k++)
+        acc[k][order[i]] = G * g[k];
+    }
+  });
+}
+
+void FmmSolver::solve(const BodySystem &bodies,
+                      std::vector<double> (&acc)[3]) {
+  update(bodies);
+  evaluate(acc);
+}
+
+dvec3 directAcceleration(const BodySystem &bodies, size_t target,
+                         double softening) {
+  dvec3 x = bodies.position(target), g(0.0);
+  for (size_t j = 0; j < bodies.size(); j++) {
+    dvec3 d = bodies.position(j) - x;
+    double r2 = glm::dot(d, d) + softening * softening;
+    if (j != target && r2 > 0.0)
+      g += d * (bodies.mass[j] / (r2 * std::sqrt(r2)));
+  }
+  return G * g;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "bodies.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+// ---------------- Fast multipole gravity ----------------
+// Newtonian accelerations of all bodies in O(N). An octree over the bodies
+// carries Cartesian Taylor expansions of 1/r to a configurable order: the
+// upward pass forms multipoles (P2M, M2M), a dual-tree traversal pairs
+// every target cell with the source cells it may treat as distant (M2L)
+// or must sum directly (P2P), and the downward pass pushes the local
+// expansions to the leaves (L2L, L2P). Derivatives of 1/r come from the
+// Lindsay-Krasny recurrence. Error falls as theta^(order + 1).
+//
+// Between steps the tree is refit rather than rebuilt: bodies keep their
+// leaves and every node's bounds, radius and multipoles are recomputed
+// bottom-up. Cells swell as bodies wander, which costs interactions, so a
+// full rebuild happens once their summed radii grow by refitLimit.
+struct FmmConfig {
+  int order = 4;         // expansion order p
+  double theta = 0.5;    // cells interact by expansion if (rA + rB) < theta d
+  int leafSize = 16;     // bodies per leaf
+  double softening = 0.0; // Plummer length for direct sums, meters
+  double refitLimit = 1.1; // rebuild once cells have swollen this much
+};
+
+struct FmmSolver {
+  struct Node {
+    glm::dvec3 center;   // octant cube at build time
+    double half;
+    glm::dvec3 lo, hi;   // bounds of the bodies below, kept by refits
+    glm::dvec3 com;      // centre of mass; both expansions sit here
+    double radius;       // bound on body distance from com
+    double mass;
+    int first, count;    // body range in tree order
+    int firstChild;      // children are contiguous, -1 for leaves
+    int childCount;
+    int parent;
+  };
+
+  FmmConfig cfg;
+  std::vector<Node> nodes;
+  std::vector<std::vector<int>> levels; // node indices by depth
+  std::vector<int> leaves;
+
+  // Bodies in tree order, copied in so the direct sums stream through
+  // memory; order[i] is the BodySystem slot of tree slot i, ids[i] the
+  // body's id so refits survive a reordering of the BodySystem.
+  std::vector<uint32_t> order, ids;
+  std::vector<double> pos[3], mass;
+
+  double builtRadius = 0.0; // summed cell radii right after the build
+  double swelling = 1.0;    // summed cell radii now, relative to that
+  size_t rebuilds = 0, refits = 0;
+
+  std::vector<double> multipoles, locals; // terms() per node
+
+  explicit FmmSolver(const FmmConfig &config = FmmConfig());
+
+  // Refits or rebuilds the octree, then accelerations (m/s^2) into acc,
+  // indexed like the bodies.
+  void solve(const BodySystem &bodies, std::vector<double> (&acc)[3]);
+
+  // Refit when the tree still holds the same bodies and has not swollen
+  // past cfg.refitLimit, rebuild otherwise; multipoles are current after.
+  void update(const BodySystem &bodies);
+  void build(const BodySystem &bodies);
+  bool refit(const BodySystem &bodies);
+  void upward();
+  void evaluate(std::vector<double> (&acc)[3]);
+
+  int terms() const { return (int)powers.size(); }
+
+  // out += coef * in * table[power]
+  struct Op {
+    int out, in, power;
+    double coef;
+  };
+
+private:
+  // Multi-index k = (kx, ky, kz) with |k| <= order, graded by |k|.
+  struct Index {
+    int x, y, z;
+  };
+  // Lower terms each term is built from: m - e_i and m - 2 e_i, -1 if
+  // m_i is too small; `axis` is the first i with m - e_i valid.
+  struct Lower {
+    int axis;
+    int one[3], two[3];
+  };
+
+  std::vector<Index> powers;
+  std::vector<Lower> lower;
+  std::vector<int> slot; // (order + 1)^3 lookup into powers, -1 beyond
+  std::vector<double> p2m;
+  std::vector<Op> m2m, m2l, l2l, l2p[3];
+
+  std::vector<std::vector<int>> farList, nearList; // per target node
+
+  int index(int x, int y, int z) const;
+  void buildNode(int node, int depth);
+  void traverse(int target, int source);
+  void monomials(const glm::dvec3 &d, double *out) const;
+  void derivatives(const glm::dvec3 &r, double *out) const;
+};
+
+// Exact O(N) sum over all other bodies at one body, for checking.
+glm::dvec3 directAcceleration(const BodySystem &bodies, size_t target,
+                              double softening = 0.0);
@@ -0,0 +1,635 @@
+#include "hermite.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+using glm::dvec3;
+
+// j-bodies handled together by the force kernel's accumulators
+static constexpr int Lanes = 4;
+
+HermiteIntegrator::HermiteIntegrator(BodySystem &b,
+                                     const HermiteConfig &config)
+    : bodies(b), cfg(config) {}
+
+// ---------------- Force kernel ----------------
+// Acceleration and jerk of each target from all predicted bodies, in one
+// pass. The j loop keeps Lanes independent sums per component so the
+// compiler can run it in SIMD registers without reassociating a single
+// sum; a coincident pair (the body itself) contributes nothing.
+void HermiteIntegrator::forces(const std::vector<uint32_t> &targets,
+                               std::vector<double> &out) {
+  const size_t n = bodies.size();
+  const double eps2 = cfg.softening * cfg.softening;
+  const double *x = pred[0].data(), *y = pred[1].data(), *z = pred[2].data();
+  const double *vx = predVel[0].data(), *vy = predVel[1].data(),
+               *vz = predVel[2].data();
+  const double *m = bodies.mass.data();
+  out.resize(targets.size() * 6);
+
+  parallelFor(targets.size(), 4, [&](size_t t) {
+    size_t i = targets[t];
+    double sum[6][Lanes] = {};
+    auto pair = [&](size_t j, int l) {
+      double dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+      double dvx = vx[j] - vx[i], dvy = vy[j] - vy[i], dvz = vz[j] - vz[i];
+      double r2 = dx * dx + dy * dy + dz * dz + eps2;
+      double rinv = 1.0 / std::sqrt(r2 > 0.0 ? r2 : INFINITY);
+      double mr3 = m[j] * rinv * rinv * rinv;
+      double rv = 3.0 * (dx * dvx + dy * dvy + dz * dvz) * rinv * rinv;
+      sum[0][l] += mr3 * dx;
+      sum[1][l] += mr3 * dy;
+      sum[2][l] += mr3 * dz;
+      sum[3][l] += mr3 * (dvx - rv * dx);
+      sum[4][l] += mr3 * (dvy - rv * dy);
+      sum[5][l] += mr3 * (dvz - rv * dz);
+    };
+    size_t j = 0;
+    for (; j + Lanes <= n; j += Lanes)
+      for (int l = 0; l < Lanes; l++)
+        pair(j + l, l);
+    for (; j < n; j++)
+      pair(j, 0);
+
+    for (int k = 0; k < 6; k++) {
+      double total = 0.0;
+      for (int l = 0; l < Lanes; l++)
+        total += sum[k][l];
+      out[t * 6 + k] = G * total;
+    }
+  });
+  evaluations += targets.size();
+}
+
+// ---------------- Steps ----------------
+double HermiteIntegrator::seconds(Tick t) const {
+  return (double)epoch * cfg.maxStep + std::ldexp((double)t, cfg.minLevel) *
+                                           cfg.maxStep;
+}
+
+// Largest maxStep 2^-k not above `dt`, in ticks.
+HermiteIntegrator::Tick HermiteIntegrator::quantize(double dt) const {
+  Tick step = maxTicks();
+  for (double s = cfg.maxStep; s > dt && step > 1; s *= 0.5)
+    step >>= 1;
+  return step;
+}
+
+// Moves the epoch up by whole maxSteps, which every step divides, so the
+// tick counts stay far from overflow on long runs.
+void HermiteIntegrator::rebase() {
+  const Tick M = maxTicks();
+  if (now < (Tick(1) << 62) - 4 * M)
+    return;
+  // every body was corrected within the last maxStep
+  Tick shift = (now / M - 1) * M;
+  for (Tick &t : last)
+    t -= shift;
+  now -= shift;
+  epoch += shift / M;
+}
+
+void HermiteIntegrator::start() {
+  size_t n = bodies.size();
+  for (int k = 0; k < 3; k++) {
+    acc[k].assign(n, 0.0);
+    jerk[k].assign(n, 0.0);
+    pred[k] = bodies.pos[k];
+    predVel[k] = bodies.vel[k];
+  }
+  last.assign(n, now);
+  step.assign(n, maxTicks());
+  predTime = time;
+  checked = time;
+
+  active.resize(n);
+  for (size_t i = 0; i < n; i++)
+    active[i] = (uint32_t)i;
+  seed(active);
+}
+
+// Forces and a first step for bodies that start, or start again, at
+// `time`; everyone else must be predicted to it.
+void HermiteIntegrator::seed(const std::vector<uint32_t> &slots) {
+  for (uint32_t i : slots) {
+    for (int k = 0; k < 3; k++) {
+      pred[k][i] = bodies.pos[k][i];
+      predVel[k][i] = bodies.vel[k][i];
+    }
+    last[i] = now;
+  }
+  forces(slots, fresh);
+
+  for (size_t a = 0; a < slots.size(); a++) {
+    size_t i = slots[a];
+    for (int k = 0; k < 3; k++) {
+      acc[k][i] = fresh[a * 6 + k];
+      jerk[k][i] = fresh[a * 6 + 3 + k];
+    }
+    double la = glm::length(dvec3(acc[0][i], acc[1][i], acc[2][i]));
+    double lj = glm::length(dvec3(jerk[0][i], jerk[1][i], jerk[2][i]));
+    double dt = lj > 0.0 ? cfg.etaStart * la / lj : cfg.maxStep;
+    // the block times must stay multiples of every step
+    Tick s = quantize(dt);
+    while (now % s != 0)
+      s >>= 1;
+    step[i] = s;
+  }
+}
+
+void HermiteIntegrator::predict(double t) {
+  predTime = t;
+  parallelFor(bodies.size(), 1024, [&](size_t i) {
+    double dt = t - seconds(last[i]);
+    for (int k = 0; k < 3; k++) {
+      double a = acc[k][i], j = jerk[k][i];
+      pred[k][i] = bodies.pos[k][i] +
+                   dt * (bodies.vel[k][i] + dt * (a / 2.0 + dt * j / 6.0));
+      predVel[k][i] = bodies.vel[k][i] + dt * (a + dt * j / 2.0);
+    }
+  });
+}
+
+double HermiteIntegrator::advanceBlock() {
+  size_t n = bodies.size();
+  Tick next = INT64_MAX;
+  for (size_t i = 0; i < n; i++)
+    next = std::min(next, last[i] + step[i]);
+  active.clear();
+  for (size_t i = 0; i < n; i++)
+    if (last[i] + step[i] == next)
+      active.push_back((uint32_t)i);
+
+  const double nextTime = seconds(next);
+  predict(nextTime);
+  forces(active, fresh);
+
+  // Correct with the Hermite interpolant through both ends, then pick the
+  // next step from its derivatives at the new time.
+  parallelFor(active.size(), 16, [&](size_t a) {
+    size_t i = active[a];
+    double dt = std::ldexp((double)step[i], cfg.minLevel) * cfg.maxStep;
+    dvec3 a0, j0, a1, j1;
+    for (int k = 0; k < 3; k++) {
+      a0[k] = acc[k][i];
+      j0[k] = jerk[k][i];
+      a1[k] = fresh[a * 6 + k];
+      j1[k] = fresh[a * 6 + 3 + k];
+    }
+    dvec3 snap = (-6.0 * (a0 - a1) - dt * (4.0 * j0 + 2.0 * j1)) / (dt * dt);
+    dvec3 crackle = (12.0 * (a0 - a1) + 6.0 * dt * (j0 + j1)) /
+                    (dt * dt * dt);
+    double dt2 = dt * dt;
+    for (int k = 0; k < 3; k++) {
+      bodies.pos[k][i] = pred[k][i] + dt2 * dt2 *
+                                          (snap[k] / 24.0 +
+                                           dt * crackle[k] / 120.0);
+      bodies.vel[k][i] = predVel[k][i] + dt2 * dt *
+                                             (snap[k] / 6.0 +
+                                              dt * crackle[k] / 24.0);
+      acc[k][i] = a1[k];
+      jerk[k][i] = j1[k];
+    }
+    last[i] = next;
+
+    dvec3 snap1 = snap + dt * crackle;
+    double la = glm::length(a1), lj = glm::length(j1);
+    double ls = glm::length(snap1), lc = glm::length(crackle);
+    double want = std::sqrt(cfg.eta * (la * ls + lj * lj) /
+                            (lj * lc + ls * ls));
+    // halve freely, double only onto a block boundary of the longer step
+    Tick s = step[i];
+    if (!(want >= dt))
+      s = quantize(want);
+    else if (want >= 2.0 * dt && 2 * s <= maxTicks() && next % (2 * s) == 0)
+      s *= 2;
+    step[i] = s;
+  });
+
+  now = next;
+  time = nextTime;
+  blocks++;
+  regularize();
+  merge();
+  if (cfg.sortInterval > 0 && blocks % cfg.sortInterval == 0)
+    resort();
+  rebase();
+  return time;
+}
+
+// ---------------- Regularization ----------------
+// Relative tidal force on a pair of total `mass` and size `reach` at x,
+// from all bodies but two: sum of 2 m_k reach^3 / (mass d_k^3).
+double HermiteIntegrator::tides(const dvec3 &x, double mass, double reach,
+                                size_t skipA, size_t skipB) const {
+  double sum = 0.0;
+  for (size_t k = 0; k < bodies.size(); k++) {
+    if (k == skipA || k == skipB)
+      continue;
+    dvec3 d = dvec3(pred[0][k], pred[1][k], pred[2][k]) - x;
+    double d2 = glm::dot(d, d);
+    sum += 2.0 * bodies.mass[k] / (d2 * std::sqrt(d2));
+  }
+  return sum * reach * reach * reach / mass;
+}
+
+size_t HermiteIntegrator::addBody(const dvec3 &x, const dvec3 &v, double m,
+                                  double spin, uint32_t id) {
+  bodies.add(x, v, m, spin, id);
+  for (int k = 0; k < 3; k++) {
+    acc[k].push_back(0.0);
+    jerk[k].push_back(0.0);
+    pred[k].push_back(x[k]);
+    predVel[k].push_back(v[k]);
+  }
+  last.push_back(now);
+  step.push_back(maxTicks());
+  return bodies.size() - 1;
+}
+
+void HermiteIntegrator::removeBody(size_t slot) {
+  size_t end = bodies.size() - 1;
+  auto take = [&](auto &column) {
+    column[slot] = column[end];
+    column.pop_back();
+  };
+  for (int k = 0; k < 3; k++) {
+    take(acc[k]);
+    take(jerk[k]);
+    take(pred[k]);
+    take(predVel[k]);
+  }
+  take(last);
+  take(step);
+  bodies.remove(slot);
+}
+
+// After each block: pairs whose centre of mass was just corrected and
+// that feel too much tide split back into two bodies; bodies of the block
+// whose steps collapsed join their nearest neighbour in a new pair if it
+// was corrected too, is bound to them and is quiet enough.
+void HermiteIntegrator::regularize() {
+  std::vector<uint32_t> restarted; // ids
+  for (size_t p = pairs.size(); p-- > 0;) {
+    KsPair &pair = pairs[p];
+    size_t slot = bodies.index[pair.idA];
+    if (last[slot] != now)
+      continue;
+    double m = pair.massA + pair.massB;
+    if (tides(bodies.position(slot), m, 2.0 * pair.semiMajor(), slot,
+              slot) < cfg.ksGamma)
+      continue;
+
+    dvec3 x = bodies.position(slot), v = bodies.velocity(slot), R, V;
+    pair.relative(time, R, V);
+    for (int k = 0; k < 3; k++) {
+      bodies.pos[k][slot] = x[k] - pair.massB / m * R[k];
+      bodies.vel[k][slot] = v[k] - pair.massB / m * V[k];
+    }
+    bodies.mass[slot] = pair.massA;
+    bodies.spin[slot] = pair.spinA;
+    size_t b = addBody(x + pair.massA / m * R, v + pair.massA / m * V,
+                       pair.massB, pair.spinB, pair.idB);
+    restarted.push_back(pair.idA);
+    restarted.push_back(bodies.ids[b]);
+    pairs.erase(pairs.begin() + p);
+  }
+
+  std::vector<uint32_t> paired(bodies.index.size(), 0);
+  for (const KsPair &pair : pairs)
+    paired[pair.idA] = 1;
+  for (uint32_t id : restarted)
+    paired[id] = 1;
+
+  const Tick collapsed = Tick(1) << (cfg.ksLevel - cfg.minLevel);
+  std::vector<std::pair<uint32_t, uint32_t>> found; // ids
+  for (uint32_t i : active) {
+    if (step[i] > collapsed || paired[bodies.ids[i]])
+      continue;
+    dvec3 x = bodies.position(i);
+    size_t nearest = i;
+    double best = INFINITY;
+    for (size_t j = 0; j < bodies.size(); j++) {
+      dvec3 d = dvec3(pred[0][j], pred[1][j], pred[2][j]) - x;
+      double d2 = glm::dot(d, d);
+      if (j != i && d2 < best) {
+        best = d2;
+        nearest = j;
+      }
+    }
+    size_t j = nearest;
+    if (j == i || last[j] != now || paired[bodies.ids[j]])
+      continue;
+    dvec3 R = bodies.position(j) - x, V = bodies.velocity(j) -
+                                          bodies.velocity(i);
+    double m = bodies.mass[i] + bodies.mass[j];
+    double h = 0.5 * glm::dot(V, V) - G * m / glm::length(R);
+    if (!(h < 0.0))
+      continue;
+    dvec3 com = (x * bodies.mass[i] + bodies.position(j) * bodies.mass[j]) /
+                m;
+    if (tides(com, m, -G * m / h, i, j) >= cfg.ksGamma)
+      continue;
+    paired[bodies.ids[i]] = paired[bodies.ids[j]] = 1;
+    found.push_back({bodies.ids[i], bodies.ids[j]});
+  }
+
+  for (auto [idA, idB] : found) {
+    size_t a = bodies.index[idA], b = bodies.index[idB];
+    double mA = bodies.mass[a], mB = bodies.mass[b], m = mA + mB;
+    dvec3 xA = bodies.position(a), xB = bodies.position(b);
+    dvec3 vA = bodies.velocity(a), vB = bodies.velocity(b);
+    KsPair pair = KsPair::make(xB - xA, vB - vA, mA, mB, time);
+    pair.idA = idA;
+    pair.idB = idB;
+    pair.spinA = bodies.spin[a];
+    pair.spinB = bodies.spin[b];
+    pairs.push_back(pair);
+
+    for (int k = 0; k < 3; k++) {
+      bodies.pos[k][a] = (xA[k] * mA + xB[k] * mB) / m;
+      bodies.vel[k][a] = (vA[k] * mA + vB[k] * mB) / m;
+    }
+    bodies.mass[a] = m;
+    removeBody(b);
+  }
+
+  for (auto [idA, idB] : found)
+    restarted.push_back(idA);
+  for (uint32_t &id : restarted)
+    id = bodies.index[id];
+  if (!restarted.empty())
+    seed(restarted);
+}
+
+// ---------------- Mergers ----------------
+// After each block: KS pairs whose pericentre lies inside their horizons
+// coalesce, and bodies whose horizons touched since the last check merge,
+// conserving mass and momentum. A group of touching bodies merges into
+// its member with the lowest id, absorbing the others in id order, so the
+// outcome depends neither on slots nor on thread timing. The remnant's
+// r_s follows from its mass.
+void HermiteIntegrator::merge() {
+  double interval = time - checked;
+  checked = time;
+  std::vector<uint32_t> restarted; // ids
+
+  // bodies off the block are only predicted to it
+  auto settle = [&](size_t i) {
+    if (last[i] == now)
+      return;
+    for (int k = 0; k < 3; k++) {
+      bodies.pos[k][i] = pred[k][i];
+      bodies.vel[k][i] = predVel[k][i];
+    }
+    last[i] = now;
+  };
+  auto coalesce = [&](size_t p) {
+    const KsPair &pair = pairs[p];
+    size_t slot = bodies.index[pair.idA];
+    settle(slot);
+    bodies.spin[slot] =
+        mergedSpin(pair.massA, pair.spinA, pair.massB, pair.spinB);
+    restarted.push_back(pair.idA);
+    pairs.erase(pairs.begin() + p);
+    mergers++;
+  };
+  for (size_t p = pairs.size(); p-- > 0;)
+    if (pairs[p].pericentre() <
+        2.0 * G * (pairs[p].massA + pairs[p].massB) / (c * c))
+      coalesce(p);
+
+  auto contacts = findContacts(hash, pred, predVel, bodies.mass, interval);
+  if (!contacts.empty()) {
+    std::vector<uint32_t> root(bodies.index.size()), members;
+    for (uint32_t id = 0; id < root.size(); id++)
+      root[id] = id;
+    auto find = [&](uint32_t id) {
+      while (root[id] != id)
+        id = root[id] = root[root[id]];
+      return id;
+    };
+    for (auto [i, j] : contacts) {
+      uint32_t a = find(bodies.ids[i]), b = find(bodies.ids[j]);
+      root[std::max(a, b)] = std::min(a, b);
+      members.push_back(bodies.ids[i]);
+      members.push_back(bodies.ids[j]);
+    }
+    std::sort(members.begin(), members.end());
+    members.erase(std::unique(members.begin(), members.end()), members.end());
+
+    // a pair caught up in a merger coalesces first
+    for (size_t p = pairs.size(); p-- > 0;)
+      if (std::binary_search(members.begin(), members.end(), pairs[p].idA))
+        coalesce(p);
+
+    for (uint32_t id : members) {
+      uint32_t into = find(id);
+      if (into == id)
+        continue;
+      size_t a = bodies.index[into], b = bodies.index[id];
+      settle(a);
+      settle(b);
+      double mA = bodies.mass[a], mB = bodies.mass[b], m = mA + mB;
+      for (int k = 0; k < 3; k++) {
+        bodies.pos[k][a] = (bodies.pos[k][a] * mA + bodies.pos[k][b] * mB) / m;
+        bodies.vel[k][a] = (bodies.vel[k][a] * mA + bodies.vel[k][b] * mB) / m;
+      }
+      bodies.spin[a] = mergedSpin(mA, bodies.spin[a], mB, bodies.spin[b]);
+      bodies.mass[a] = m;
+      removeBody(b);
+      restarted.push_back(into);
+      mergers++;
+    }
+  }
+  if (restarted.empty())
+    return;
+
+  std::sort(restarted.begin(), restarted.end());
+  restarted.erase(std::unique(restarted.begin(), restarted.end()),
+                  restarted.end());
+  std::vector<uint32_t> slots;
+  for (uint32_t id : restarted)
+    if (bodies.index[id] != BodySystem::None)
+      slots.push_back(bodies.index[id]);
+  seed(slots);
+}
+
+void HermiteIntegrator::evolve(double until) {
+  while (size_t n = bodies.size()) {
+    Tick next = INT64_MAX;
+    for (size_t i = 0; i < n; i++)
+      next = std::min(next, last[i] + step[i]);
+    if (seconds(next) > until)
+      break;
+    advanceBlock();
+  }
+  predict(until);
+}
+
+// Keeps the force kernel's j loop walking space in order as bodies mix.
+void HermiteIntegrator::resort() {
+  std::vector<uint32_t> order = bodies.sortMorton();
+  for (int k = 0; k < 3; k++) {
+    BodySystem::permute(acc[k], order);
+    BodySystem::permute(jerk[k], order);
+    BodySystem::permute(pred[k], order);
+    BodySystem::permute(predVel[k], order);
+  }
+  BodySystem::permute(last, order);
+  BodySystem::permute(step, order);
+}
+
+void HermiteIntegrator::predictedBodies(BodySystem &out) const {
+  std::vector<int> pairOf(bodies.index.size(), -1);
+  for (size_t p = 0; p < pairs.size(); p++)
+    pairOf[pairs[p].idA] = (int)p;
+
+  out = BodySystem();
+  out.index.assign(bodies.index.size(), BodySystem::None);
+  for (size_t i = 0; i < bodies.size(); i++) {
+    dvec3 x(pred[0][i], pred[1][i], pred[2][i]);
+    dvec3 v(predVel[0][i], predVel[1][i], predVel[2][i]);
+    int p = pairOf[bodies.ids[i]];
+    if (p < 0) {
+      out.add(x, v, bodies.mass[i], bodies.spin[i], bodies.ids[i]);
+      continue;
+    }
+    const KsPair &pair = pairs[p];
+    double m = pair.massA + pair.massB;
+    dvec3 R, V;
+    pair.relative(predTime, R, V);
+    out.add(x - pair.massB / m * R, v - pair.massB / m * V, pair.massA,
+            pair.spinA, pair.idA);
+    out.add(x + pair.massA / m * R, v + pair.massA / m * V, pair.massB,
+            pair.spinB, pair.idB);
+  }
+}
+
+void HermiteIntegrator::predictedHoles(std::vector<BlackHole> &holes) const {
+  BodySystem state;
+  predictedBodies(state);
+  state.toHoles(holes);
+}
+
+// ---------------- Checkpoints ----------------
+namespace {
+struct Counters {
+  double time, predTime, checked;
+  uint64_t blocks, evaluations, mergers;
+  int64_t now, epoch;
+};
+} // namespace
+
+static const char *const Axis[3] = {"x", "y", "z"};
+
+void HermiteIntegrator::save(Checkpoint &out) const {
+  for (int k = 0; k < 3; k++) {
+    out.put(std::string("bodies.pos.") + Axis[k], bodies.pos[k]);
+    out.put(std::string("bodies.vel.") + Axis[k], bodies.vel[k]);
+    out.put(std::string("hermite.acc.") + Axis[k], acc[k]);
+    out.put(std::string("hermite.jerk.") + Axis[k], jerk[k]);
+    out.put(std::string("hermite.pred.") + Axis[k], pred[k]);
+    out.put(std::string("hermite.predVel.") + Axis[k], predVel[k]);
+  }
+  out.put("bodies.mass", bodies.mass);
+  out.put("bodies.spin", bodies.spin);
+  out.put("bodies.ids", bodies.ids);
+  out.put("bodies.index", bodies.index);
+  out.put("hermite.last", last);
+  out.put("hermite.step", step);
+  out.put("hermite.pairs", pairs);
+  out.putValue("hermite.counters",
+               Counters{time, predTime, checked, blocks, evaluations,
+                        mergers, now, epoch});
+}
+
+bool HermiteIntegrator::restore(const Checkpoint &in) {
+  long n = in.count<double>("bodies.mass");
+  bool ok = n >= 0 && in.count<uint32_t>("bodies.ids") == n &&
+            in.count<uint32_t>("bodies.index") >= n &&
+            in.count<KsPair>("hermite.pairs") >= 0 &&
+            in.count<Counters>("hermite.counters") == 1;
+  ok = ok && in.count<double>("bodies.spin") == n &&
+       in.count<Tick>("hermite.last") == n &&
+       in.count<Tick>("hermite.step") == n;
+  const char *axes[] = {"bodies.pos.",   "bodies.vel.",    "hermite.acc.",
+                        "hermite.jerk.", "hermite.pred.", "hermite.predVel."};
+  for (const char *name : axes)
+    for (int k = 0; k < 3; k++)
+      ok = ok && in.count<double>(std::string(name) + Axis[k]) == n;
+  if (!ok)
+    return false;
+
+  // slots and ids must agree, every pair must hang off a live body with
+  // its partner absent, and block steps must be whole ticks, before
+  // anything is replaced
+  std::vector<uint32_t> ids, index;
+  std::vector<KsPair> loaded;
+  std::vector<Tick> lastTicks, stepTicks;
+  in.get("bodies.ids", ids);
+  in.get("bodies.index", index);
+  in.get("hermite.pairs", loaded);
+  in.get("hermite.last", lastTicks);
+  in.get("hermite.step", stepTicks);
+  for (Tick s : stepTicks)
+    ok = ok && s > 0;
+  for (size_t id = 0; ok && id < index.size(); id++)
+    ok = index[id] == BodySystem::None ||
+         (index[id] < (size_t)n && ids[index[id]] == id);
+  for (size_t i = 0; ok && i < (size_t)n; i++)
+    ok = ids[i] < index.size() && index[ids[i]] == i;
+  for (const KsPair &pair : loaded)
+    ok = ok && pair.idA < index.size() && pair.idB < index.size() &&
+         index[pair.idA] != BodySystem::None &&
+         index[pair.idB] == BodySystem::None;
+  if (!ok)
+    return false;
+
+  for (int k = 0; k < 3; k++) {
+    in.get(std::string("bodies.pos.") + Axis[k], bodies.pos[k]);
+    in.get(std::string("bodies.vel.") + Axis[k], bodies.vel[k]);
+    in.get(std::string("hermite.acc.") + Axis[k], acc[k]);
+    in.get(std::string("hermite.jerk.") + Axis[k], jerk[k]);
+    in.get(std::string("hermite.pred.") + Axis[k], pred[k]);
+    in.get(std::string("hermite.predVel.") + Axis[k], predVel[k]);
+  }
+  in.get("bodies.mass", bodies.mass);
+  in.get("bodies.spin", bodies.spin);
+  bodies.ids.swap(ids);
+  bodies.index.swap(index);
+  last.swap(lastTicks);
+  step.swap(stepTicks);
+  pairs.swap(loaded);
+  Counters counters;
+  in.getValue("hermite.counters", counters);
+  time = counters.time;
+  predTime = counters.predTime;
+  checked = counters.checked;
+  blocks = counters.blocks;
+  evaluations = counters.evaluations;
+  mergers = counters.mergers;
+  now = counters.now;
+  epoch = counters.epoch;
+  return true;
+}
+
+double HermiteIntegrator::energy() const {
+  size_t n = bodies.size();
+  double kinetic = 0.0, potential = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    dvec3 v(predVel[0][i], predVel[1][i], predVel[2][i]);
+    kinetic += 0.5 * bodies.mass[i] * glm::dot(v, v);
+    dvec3 x(pred[0][i], pred[1][i], pred[2][i]);
+    for (size_t j = i + 1; j < n; j++) {
+      dvec3 d = dvec3(pred[0][j], pred[1][j], pred[2][j]) - x;
+      double r = std::sqrt(glm::dot(d, d) + cfg.softening * cfg.softening);
+      potential -= G * bodies.mass[i] * bodies.mass[j] / r;
+    }
+  }
+  for (const KsPair &pair : pairs)
+    potential += pair.internalEnergy();
+  return kinetic + potential;
+}
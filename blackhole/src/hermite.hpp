@@ -0,0 +1,109 @@
+#pragma once
+
+#include "bodies.hpp"
+#include "checkpoint.hpp"
+#include "ks.hpp"
+#include "mergers.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// ---------------- Hermite integrator ----------------
+// Fourth-order Hermite predictor-corrector (Makino & Aarseth 1992) for the
+// bodies as a collisional system, with direct summation. Every body has
+// its own step, a power-of-two fraction of maxStep chosen by the Aarseth
+// criterion, and the bodies due at the same time form a block: all bodies
+// are predicted to the block time, but only the block gets accelerations
+// and jerks, so a close pair steps finely while the rest of the cluster
+// takes long steps. A bound pair whose steps collapse anyway is handed to
+// KS regularization (ks.hpp) and moves on as one centre-of-mass body until
+// the tides of the others grow too strong for it. Holes whose horizons
+// touch merge (mergers.hpp). Block times and steps are counted in integer
+// ticks of the smallest step, so blocks line up exactly however long the
+// run; seconds are only for the dynamics.
+struct HermiteConfig {
+  double eta = 0.02;        // accuracy parameter of the step criterion
+  double etaStart = 0.01;   // same for the first step, from a / j alone
+  double maxStep = 1.0e-6;  // seconds; every step is this over 2^n
+  int minLevel = -40;       // smallest step is maxStep 2^minLevel
+  double softening = 0.0;   // Plummer length, meters
+  int sortInterval = 64;    // blocks between Morton re-sorts, 0 for never
+  int ksLevel = -8;         // pair bodies whose step is maxStep 2^ksLevel
+  double ksGamma = 1.0e-3;  // largest relative tidal force on a KS pair
+};
+
+struct HermiteIntegrator {
+  using Tick = int64_t; // maxStep 2^minLevel
+
+  BodySystem &bodies;
+  HermiteConfig cfg;
+  double time = 0.0; // of the latest block, seconds
+
+  // Per-body columns alongside the BodySystem's, permuted with it.
+  std::vector<double> acc[3], jerk[3];
+  std::vector<Tick> last, step; // tick of the last correction, its step
+  // positions and velocities predicted to the block time
+  std::vector<double> pred[3], predVel[3];
+  double predTime = 0.0;
+
+  std::vector<KsPair> pairs;
+
+  size_t blocks = 0, evaluations = 0, mergers = 0;
+
+  HermiteIntegrator(BodySystem &b, const HermiteConfig &config =
+                                       HermiteConfig());
+
+  // Accelerations, jerks and first steps of every body at `time`. Call
+  // again after bodies were added or removed.
+  void start();
+
+  // Runs blocks up to `until`, then predicts every body to it.
+  void evolve(double until);
+
+  // Advances the next block; returns its time.
+  double advanceBlock();
+
+  void predict(double t);
+  // Every hole at the predicted time, pairs split back into their members
+  // under their own ids.
+  void predictedBodies(BodySystem &out) const;
+  void predictedHoles(std::vector<BlackHole> &holes) const;
+
+  // Bodies and integrator state as "bodies.*" and "hermite.*" sections;
+  // restore() leaves everything untouched unless all of them are sound:
+  // sizes, ids against slots, pair members and step ticks.
+  void save(Checkpoint &out) const;
+  bool restore(const Checkpoint &in);
+
+  // Total kinetic plus potential energy at the predicted state, with the
+  // binding energy of the pairs.
+  double energy() const;
+
+  double seconds(Tick t) const;
+
+private:
+  Tick now = 0;   // tick of the latest block, counted from the epoch
+  Tick epoch = 0; // in maxSteps; moved up by rebase()
+
+  std::vector<uint32_t> active;
+
+  std::vector<double> fresh; // 6 per active body: acceleration, jerk
+
+  SpatialHash hash;
+  double checked = 0.0; // time of the last merger check
+
+  void forces(const std::vector<uint32_t> &targets, std::vector<double> &out);
+  void seed(const std::vector<uint32_t> &slots);
+  void regularize();
+  void merge();
+  double tides(const glm::dvec3 &x, double mass, double reach, size_t skipA,
+               size_t skipB) const;
+  size_t addBody(const glm::dvec3 &x, const glm::dvec3 &v, double m,
+                 double spin, uint32_t id);
+  void removeBody(size_t slot);
+  void resort();
+  Tick maxTicks() const { return Tick(1) << -cfg.minLevel; }
+  Tick quantize(double dt) const;
+  void rebase();
+};
@@ -0,0 +1,331 @@
+#include "image_writer.hpp"
+#include "parallel.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "EXR headers are written from memory and must be little-endian"
+#endif
+
+using glm::vec3;
+
+// ---------------- Encoding helpers ----------------
+// IEEE half with round to nearest even; overflow becomes infinity.
+static uint16_t toHalf(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, 4);
+  uint32_t sign = (x >> 16) & 0x8000, mag = x & 0x7fffffff;
+  if (mag >= 0x7f800000) // inf, nan
+    return (uint16_t)(sign | 0x7c00 | (mag > 0x7f800000 ? 0x200 : 0));
+  if (mag >= 0x47800000)
+    return (uint16_t)(sign | 0x7c00);
+  if (mag < 0x33000000) // below half the smallest denormal
+    return (uint16_t)sign;
+  uint32_t h, rest, halfway;
+  if (mag < 0x38800000) { // denormal
+    uint32_t m = (mag & 0x7fffff) | 0x800000;
+    int shift = 126 - (int)(mag >> 23);
+    h = m >> shift;
+    rest = m & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+  } else {
+    h = (mag - 0x38000000) >> 13;
+    rest = mag & 0x1fff;
+    halfway = 0x1000;
+  }
+  if (rest > halfway || (rest == halfway && (h & 1)))
+    h++; // may carry into the exponent, which is still right
+  return (uint16_t)(sign | h);
+}
+
+template <class T> static void append(std::vector<uint8_t> &out, T value) {
+  size_t at = out.size();
+  out.resize(at + sizeof value);
+  std::memcpy(out.data() + at, &value, sizeof value);
+}
+
+static void appendString(std::vector<uint8_t> &out, const char *s) {
+  out.insert(out.end(), s, s + std::strlen(s) + 1);
+}
+
+// An EXR header attribute: name, type name, size, value.
+static void attribute(std::vector<uint8_t> &out, const char *name,
+                      const char *type, const std::vector<uint8_t> &value) {
+  appendString(out, name);
+  appendString(out, type);
+  append(out, (int32_t)value.size());
+  out.insert(out.end(), value.begin(), value.end());
+}
+
+// ---------------- Open / close ----------------
+static bool hasExtension(const std::string &path, const char *ext) {
+  size_t n = std::strlen(ext);
+  if (path.size() < n)
+    return false;
+  for (size_t i = 0; i < n; i++)
+    if (std::tolower((unsigned char)path[path.size() - n + i]) != ext[i])
+      return false;
+  return true;
+}
+
+ImageWriter::~ImageWriter() {
+  if (file)
+    std::fclose(file);
+}
+
+bool ImageWriter::open(const std::string &path, int w, int h,
+                       bool halfFloat) {
+  if (file)
+    std::fclose(file);
+  file = nullptr;
+  if (hasExtension(path, ".exr"))
+    exr = true;
+  else if (hasExtension(path, ".hdr"))
+    exr = false;
+  else {
+    std::cerr << "Cannot tell the format of '" << path
+              << "'; use .exr or .hdr\n";
+    return false;
+  }
+  file = std::fopen(path.c_str(), "wb");
+  if (!file) {
+    std::cerr << "Cannot write image '" << path << "'\n";
+    return false;
+  }
+  width = w;
+  height = h;
+  half = halfFloat;
+  nextRow = 0;
+  failed = false;
+  offsets.clear();
+
+  std::vector<uint8_t> header;
+  if (!exr) {
+    std::string text = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " +
+                       std::to_string(h) + " +X " + std::to_string(w) + "\n";
+    header.assign(text.begin(), text.end());
+  } else {
+    append(header, (uint32_t)20000630); // magic
+    append(header, (uint32_t)(2 | 0x200)); // version 2, tiled
+
+    std::vector<uint8_t> value;
+    for (const char *channel : {"B", "G", "R"}) {
+      appendString(value, channel);
+      append(value, (int32_t)(half ? 1 : 2)); // HALF or FLOAT
+      append(value, (uint32_t)0);            // pLinear, reserved
+      append(value, (int32_t)1);             // x and y sampling
+      append(value, (int32_t)1);
+    }
+    value.push_back(0);
+    attribute(header, "channels", "chlist", value);
+    attribute(header, "compression", "compression", {3}); // ZIP
+    value.clear();
+    for (int32_t v : {0, 0, w - 1, h - 1})
+      append(value, v);
+    attribute(header, "dataWindow", "box2i", value);
+    attribute(header, "displayWindow", "box2i", value);
+    attribute(header, "lineOrder", "lineOrder", {0}); // increasing y
+    value.clear();
+    append(value, 1.0f);
+    attribute(header, "pixelAspectRatio", "float", value);
+    attribute(header, "screenWindowWidth", "float", value);
+    value.clear();
+    append(value, 0.0f);
+    append(value, 0.0f);
+    attribute(header, "screenWindowCenter", "v2f", value);
+    value.clear();
+    append(value, (uint32_t)tile);
+    append(value, (uint32_t)tile);
+    value.push_back(0); // one level
+    attribute(header, "tiles", "tiledesc", value);
+    header.push_back(0);
+
+    // the offset table is filled in by close()
+    size_t tiles = (size_t)((w + tile - 1) / tile) * ((h + tile - 1) / tile);
+    tableAt = (long)header.size();
+    header.resize(header.size() + tiles * sizeof(uint64_t), 0);
+  }
+  end = header.size();
+  if (std::fwrite(header.data(), 1, header.size(), file) != header.size()) {
+    std::cerr << "Cannot write image '" << path << "'\n";
+    failed = true;
+  }
+  return !failed;
+}
+
+bool ImageWriter::close() {
+  if (!file)
+    return false;
+  if (nextRow != height) {
+    std::cerr << "Image closed with " << height - nextRow
+              << " rows missing\n";
+    failed = true;
+  }
+  if (exr && !failed)
+    failed = std::fseek(file, tableAt, SEEK_SET) != 0 ||
+             std::fwrite(offsets.data(), sizeof(uint64_t), offsets.size(),
+                         file) != offsets.size();
+  failed = std::fclose(file) != 0 || failed;
+  file = nullptr;
+  if (failed)
+    std::cerr << "Image write failed\n";
+  return !failed;
+}
+
+// ---------------- EXR tiles ----------------
+// Tile (tx, nextRow / tile): for each line from the top, the B, G and R
+// values of its pixels, ZIP-compressed as OpenEXR does it: bytes split into
+// even and odd halves, delta coded, then deflated. A tile that would grow
+// is stored raw, which readers recognise by its size.
+void ImageWriter::encodeTile(const std::vector<vec3> &pixels, int rows,
+                             int tx, std::vector<uint8_t> &out) const {
+  int x0 = tx * tile, tw = std::min(tile, width - x0);
+  size_t size = half ? 2 : 4;
+  std::vector<uint8_t> raw((size_t)tw * rows * 3 * size);
+  uint8_t *p = raw.data();
+  for (int line = 0; line < rows; line++) {
+    const vec3 *src = &pixels[(size_t)(rows - 1 - line) * width + x0];
+    for (int channel = 2; channel >= 0; channel--)
+      for (int x = 0; x < tw; x++, p += size) {
+        if (half) {
+          uint16_t v = toHalf(src[x][channel]);
+          std::memcpy(p, &v, 2);
+        } else {
+          std::memcpy(p, &src[x][channel], 4);
+        }
+      }
+  }
+
+  size_t n = raw.size();
+  std::vector<uint8_t> shuffled(n);
+  for (size_t i = 0, a = 0, b = (n + 1) / 2; i < n; i++)
+    shuffled[i & 1 ? b++ : a++] = raw[i];
+  for (size_t i = n; i-- > 1;)
+    shuffled[i] = (uint8_t)(shuffled[i] - shuffled[i - 1] + 128);
+
+  uLongf packed = compressBound((uLong)n);
+  out.resize(20 + packed);
+  if (compress2(out.data() + 20, &packed, shuffled.data(), (uLong)n, 4) !=
+          Z_OK ||
+      packed >= n) {
+    packed = (uLongf)n;
+    out.resize(20 + n);
+    std::memcpy(out.data() + 20, raw.data(), n);
+  }
+  out.resize(20 + packed);
+  int32_t head[5] = {tx, nextRow / tile, 0, 0, (int32_t)packed};
+  std::memcpy(out.data(), head, sizeof head);
+}
+
+// ---------------- Radiance scanlines ----------------
+static void toRgbe(vec3 c, uint8_t *out) {
+  c = glm::max(c, vec3(0.0f));
+  float v = std::max(c.x, std::max(c.y, c.z));
+  if (!(v > 1e-32f)) {
+    out[0] = out[1] = out[2] = out[3] = 0;
+    return;
+  }
+  int e;
+  float scale = std::frexp(v, &e) * 256.0f / v;
+  out[0] = (uint8_t)(c.x * scale);
+  out[1] = (uint8_t)(c.y * scale);
+  out[2] = (uint8_t)(c.z * scale);
+  out[3] = (uint8_t)(e + 128);
+}
+
+// One channel of a scanline as runs (128 + length, byte) of at least four
+// equal bytes and literal dumps (length, bytes...), as in Greg Ward's
+// writer.
+static void appendRuns(const uint8_t *data, int n, std::vector<uint8_t> &out) {
+  int cur = 0;
+  while (cur < n) {
+    int begin = cur, run = 0, oldRun = 0;
+    while (run < 4 && begin < n) {
+      begin += run;
+      oldRun = run;
+      run = 1;
+      while (begin + run < n && run < 127 && data[begin + run] == data[begin])
+        run++;
+    }
+    // a short run just before a long one goes out as a run too
+    if (oldRun > 1 && oldRun == begin - cur) {
+      out.push_back((uint8_t)(128 + oldRun));
+      out.push_back(data[cur]);
+      cur = begin;
+    }
+    while (cur < begin) {
+      int dump = std::min(128, begin - cur);
+      out.push_back((uint8_t)dump);
+      out.insert(out.end(), data + cur, data + cur + dump);
+      cur += dump;
+    }
+    if (run >= 4) {
+      out.push_back((uint8_t)(128 + run));
+      out.push_back(data[begin]);
+      cur += run;
+    }
+  }
+}
+
+void ImageWriter::encodeScanline(const vec3 *row,
+                                 std::vector<uint8_t> &out) const {
+  out.clear();
+  std::vector<uint8_t> rgbe((size_t)width * 4);
+  for (int x = 0; x < width; x++)
+    toRgbe(row[x], &rgbe[(size_t)x * 4]);
+  // run-length coding only exists for these widths
+  if (width < 8 || width > 0x7fff) {
+    out.swap(rgbe);
+    return;
+  }
+  out.insert(out.end(), {2, 2, (uint8_t)(width >> 8), (uint8_t)width});
+  std::vector<uint8_t> plane(width);
+  for (int channel = 0; channel < 4; channel++) {
+    for (int x = 0; x < width; x++)
+      plane[x] = rgbe[(size_t)x * 4 + channel];
+    appendRuns(plane.data(), width, out);
+  }
+}
+
+// ---------------- Bands ----------------
+bool ImageWriter::writeBand(const std::vector<vec3> &pixels, int rows) {
+  if (!file || failed)
+    return false;
+  if (rows != std::min(tile, height - nextRow) ||
+      pixels.size() < (size_t)rows * width) {
+    std::cerr << "Image band of " << rows << " rows does not fit at row "
+              << nextRow << "\n";
+    failed = true;
+    return false;
+  }
+
+  if (exr) {
+    chunks.resize((width + tile - 1) / tile);
+    parallelFor(chunks.size(), 1, [&](size_t tx) {
+      encodeTile(pixels, rows, (int)tx, chunks[tx]);
+    });
+  } else {
+    // scanlines go out top first
+    chunks.resize(rows);
+    parallelFor(chunks.size(), 1, [&](size_t r) {
+      encodeScanline(&pixels[(size_t)(rows - 1 - r) * width], chunks[r]);
+    });
+  }
+  for (const std::vector<uint8_t> &chunk : chunks) {
+    if (exr)
+      offsets.push_back(end);
+    if (std::fwrite(chunk.data(), 1, chunk.size(), file) != chunk.size())
+      failed = true;
+    end += chunk.size();
+  }
+  nextRow += rows;
+  if (failed)
+    std::cerr << "Image write failed at row " << nextRow - rows << "\n";
+  return !failed;
+}
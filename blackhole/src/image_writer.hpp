@@ -0,0 +1,52 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// ---------------- HDR images ----------------
+// Writes linear radiance as OpenEXR (tiled, one level, ZIP-compressed
+// half or float RGB) or Radiance HDR (RLE RGBE scanlines), picked by the
+// file extension. The image arrives in bands of bandRows() rows from the
+// top down and only one band is ever held: its tiles (EXR) or scanlines
+// (HDR) are compressed on every core, then appended in order, so a poster
+// far larger than memory streams straight to disk.
+struct ImageWriter {
+  ~ImageWriter();
+
+  // Prints the reason and returns false when the file cannot be created
+  // or the extension is neither .exr nor .hdr.
+  bool open(const std::string &path, int width, int height,
+            bool halfFloat = true);
+  bool isOpen() const { return file != nullptr; }
+
+  // Rows per band; the last band holds whatever is left.
+  int bandRows() const { return tile; }
+
+  // The next band, `rows` rows of width pixels with the bottom row first,
+  // as renderRects() leaves them.
+  bool writeBand(const std::vector<glm::vec3> &pixels, int rows);
+
+  // Completes the file once every row is written; false on any error.
+  bool close();
+
+private:
+  FILE *file = nullptr;
+  bool exr = true, half = true;
+  int width = 0, height = 0;
+  int tile = 64;
+  int nextRow = 0; // from the top
+  bool failed = false;
+
+  uint64_t end = 0;              // bytes written so far
+  long tableAt = 0;              // EXR tile offset table
+  std::vector<uint64_t> offsets; // tiles in row-major order
+  std::vector<std::vector<uint8_t>> chunks;
+
+  void encodeTile(const std::vector<glm::vec3> &pixels, int rows, int tx,
+                  std::vector<uint8_t> &out) const;
+  void encodeScanline(const glm::vec3 *row, std::vector<uint8_t> &out) const;
+};
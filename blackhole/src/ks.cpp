@@ -0,0 +1,112 @@
+#include "ks.hpp"
+#include "objects.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using glm::dvec3;
+
+// L(u)^T (F, 0)
+static void transposeL(const double u[4], const dvec3 &F, double out[4]) {
+  out[0] = u[0] * F.x + u[1] * F.y + u[2] * F.z;
+  out[1] = -u[1] * F.x + u[0] * F.y + u[3] * F.z;
+  out[2] = -u[2] * F.x - u[3] * F.y + u[0] * F.z;
+  out[3] = u[3] * F.x - u[2] * F.y + u[1] * F.z;
+}
+
+// first three components of L(u) v
+static dvec3 applyL(const double u[4], const double v[4]) {
+  return {u[0] * v[0] - u[1] * v[1] - u[2] * v[2] + u[3] * v[3],
+          u[1] * v[0] + u[0] * v[1] - u[3] * v[2] - u[2] * v[3],
+          u[2] * v[0] + u[3] * v[1] + u[0] * v[2] + u[1] * v[3]};
+}
+
+KsPair KsPair::make(const dvec3 &R, const dvec3 &V, double mA, double mB,
+                    double t) {
+  KsPair p{};
+  p.massA = mA;
+  p.massB = mB;
+  p.start = t;
+  p.mu = G * (mA + mB);
+  double r = glm::length(R);
+  p.h = 0.5 * glm::dot(V, V) - p.mu / r;
+
+  // one of the circle of u with L(u) u = R; pick the better conditioned
+  double *u = p.u0;
+  if (R.x >= 0.0) {
+    u[0] = std::sqrt(0.5 * (r + R.x));
+    u[1] = R.y / (2.0 * u[0]);
+    u[2] = R.z / (2.0 * u[0]);
+    u[3] = 0.0;
+  } else {
+    u[1] = std::sqrt(0.5 * (r - R.x));
+    u[0] = R.y / (2.0 * u[1]);
+    u[3] = R.z / (2.0 * u[1]);
+    u[2] = 0.0;
+  }
+  transposeL(u, 0.5 * V, p.du0);
+  return p;
+}
+
+// u(tau) = u0 cos(w tau) + du0 / w sin(w tau), w^2 = -h / 2, and
+// t(tau) = integral of |u|^2, solved for tau by safeguarded Newton.
+void KsPair::relative(double t, dvec3 &R, dvec3 &V) const {
+  double w = std::sqrt(-0.5 * h);
+  double a = 0.0, b = 0.0, c = 0.0;
+  for (int k = 0; k < 4; k++) {
+    a += u0[k] * u0[k];
+    b += du0[k] * du0[k];
+    c += u0[k] * du0[k];
+  }
+  b /= w * w;
+  c *= 2.0 / w;
+  auto elapsed = [&](double tau) {
+    double s = std::sin(w * tau);
+    double s2 = std::sin(2.0 * w * tau);
+    return 0.5 * (a + b) * tau + (a - b) * s2 / (4.0 * w) +
+           c * s * s / (2.0 * w);
+  };
+  auto radius = [&](double tau) {
+    double s = std::sin(w * tau), co = std::cos(w * tau);
+    return a * co * co + b * s * s + c * s * co;
+  };
+
+  // the oscillating part is bounded, which brackets tau
+  double dt = t - start;
+  double mean = 0.5 * (a + b);
+  double swing = (std::fabs(a - b) / 4.0 + std::fabs(c) / 2.0) / w;
+  double lo = (dt - swing) / mean, hi = (dt + swing) / mean;
+  double tau = dt / mean;
+  for (int i = 0; i < 100; i++) {
+    double f = elapsed(tau) - dt;
+    if (f > 0.0)
+      hi = tau;
+    else
+      lo = tau;
+    double next = tau - f / radius(tau);
+    if (!(next > lo && next < hi))
+      next = 0.5 * (lo + hi);
+    if (std::fabs(next - tau) <= 1e-15 * std::max(std::fabs(tau), 1e-300))
+      break;
+    tau = next;
+  }
+
+  double s = std::sin(w * tau), co = std::cos(w * tau);
+  double u[4], du[4];
+  for (int k = 0; k < 4; k++) {
+    u[k] = u0[k] * co + du0[k] / w * s;
+    du[k] = -u0[k] * w * s + du0[k] * co;
+  }
+  double r = u[0] * u[0] + u[1] * u[1] + u[2] * u[2] + u[3] * u[3];
+  R = applyL(u, u);
+  V = applyL(u, du) * (2.0 / r);
+}
+
+double KsPair::pericentre() const {
+  double r = u0[0] * u0[0] + u0[1] * u0[1] + u0[2] * u0[2] + u0[3] * u0[3];
+  dvec3 R = applyL(u0, u0), V = applyL(u0, du0) * (2.0 / r);
+  dvec3 L = glm::cross(R, V);
+  double e = std::sqrt(std::max(0.0, 1.0 + 2.0 * h * glm::dot(L, L) /
+                                               (mu * mu)));
+  return semiMajor() * (1.0 - e);
+}
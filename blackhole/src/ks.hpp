@@ -0,0 +1,35 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+// ---------------- KS regularization ----------------
+// A tight bound pair as a sub-system: its centre of mass stays in the main
+// integrator while the relative orbit lives in Kustaanheimo-Stiefel
+// coordinates. With R = L(u) u for u in R^4 and the fictitious time
+// dt = r dtau, Kepler motion becomes the harmonic oscillator
+// u'' = (h / 2) u, regular at r = 0, so the pair has a closed form at any
+// time and its pericentre passages cost no steps at all. Tidal forces on
+// the pair are left out; HermiteIntegrator only keeps pairs whose
+// perturbation stays below HermiteConfig::ksGamma.
+struct KsPair {
+  uint32_t idA, idB; // idA carries the centre of mass while paired
+  double massA, massB;
+  double spinA, spinB;
+  double start;       // time of u0 and du0
+  double u0[4], du0[4]; // du / dtau
+  double h;           // energy per unit reduced mass, < 0
+  double mu;          // G (mA + mB)
+
+  // Pair with B at R and velocity V relative to A at time t.
+  static KsPair make(const glm::dvec3 &R, const glm::dvec3 &V, double mA,
+                     double mB, double t);
+
+  // Relative position and velocity of B at time t.
+  void relative(double t, glm::dvec3 &R, glm::dvec3 &V) const;
+
+  double semiMajor() const { return -mu / (2.0 * h); }
+  double pericentre() const;
+  double internalEnergy() const { return massA * massB / (massA + massB) * h; }
+};
@@ -0,0 +1,284 @@
+#include "lensing.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using glm::dvec3;
+
+// ---------------- Build ----------------
+void HoleBVH::build(const std::vector<BlackHole> &bhs,
+                    const TraceConfig &cfg) {
+  influence = cfg.influence;
+  opening = cfg.opening;
+  holes.clear();
+  for (const BlackHole &bh : bhs)
+    holes.push_back({dvec3(bh.position), (double)bh.sceneRadius()});
+  nodes.clear();
+  nodes.reserve(2 * holes.size());
+  if (!holes.empty())
+    buildNode(0, (int)holes.size());
+}
+
+// Median split along the widest axis of the hole centres, so the tree stays
+// balanced however the holes cluster.
+int HoleBVH::buildNode(int first, int count) {
+  int index = (int)nodes.size();
+  nodes.emplace_back();
+
+  dvec3 lo(INFINITY), hi(-INFINITY), clo(INFINITY), chi(-INFINITY);
+  dvec3 weighted(0.0);
+  double rs = 0.0;
+  for (int i = first; i < first + count; i++) {
+    const Hole &h = holes[i];
+    dvec3 reach(influence * h.rs);
+    lo = glm::min(lo, h.position - reach);
+    hi = glm::max(hi, h.position + reach);
+    clo = glm::min(clo, h.position);
+    chi = glm::max(chi, h.position);
+    weighted += h.position * h.rs;
+    rs += h.rs;
+  }
+  dvec3 centroid = rs > 0.0 ? weighted / rs : (clo + chi) * 0.5;
+  double extent = 0.0;
+  for (int i = first; i < first + count; i++)
+    extent = std::max(extent, glm::length(holes[i].position - centroid));
+
+  Node node{lo, hi, centroid, rs, extent, first, 0, -1};
+  if (count <= 2) {
+    node.count = count;
+  } else {
+    dvec3 size = chi - clo;
+    int axis = size.x > size.y ? (size.x > size.z ? 0 : 2)
+                               : (size.y > size.z ? 1 : 2);
+    int mid = first + count / 2;
+    std::nth_element(holes.begin() + first, holes.begin() + mid,
+                     holes.begin() + first + count,
+                     [axis](const Hole &a, const Hole &b) {
+                       return a.position[axis] < b.position[axis];
+                     });
+    buildNode(first, mid - first);
+    node.right = buildNode(mid, first + count - mid);
+  }
+  nodes[index] = node;
+  return index;
+}
+
+// ---------------- Forces ----------------
+// Weak field: the transverse pull r_s (x_perp) / r^3 that integrates to the
+// 2 r_s / b deflection of a passing ray. Near field: the Schwarzschild
+// photon force of metric.hpp, -3/2 r_s h^2 x / r^5. A weak pull bends the
+// ray by r_s h / r^2 per step, so its step scale grows as r^2 once past
+// the influence radius, where it matches the near field.
+dvec3 HoleBVH::acceleration(const dvec3 &p, const dvec3 &v,
+                            Probe &probe) const {
+  dvec3 acc;
+  acceleration(&p, &v, 1, &acc, probe);
+  return acc;
+}
+
+void HoleBVH::acceleration(const dvec3 *p, const dvec3 *v, int count,
+                           dvec3 *acc, Probe &probe) const {
+  probe.gap = INFINITY;
+  probe.gapRs = 0.0;
+  probe.nearest = -1;
+  probe.inside = false;
+  for (int j = 0; j < count; j++)
+    acc[j] = dvec3(0.0);
+  if (nodes.empty())
+    return;
+
+  auto weak = [&](const dvec3 &c, double rs) {
+    for (int j = 0; j < count; j++) {
+      dvec3 u = glm::normalize(v[j]);
+      dvec3 d = c - p[j];
+      double r = glm::length(d);
+      dvec3 perp = d - u * glm::dot(d, u);
+      acc[j] += perp * (rs / (r * r * r));
+    }
+    double r = glm::length(c - p[0]);
+    double scale = std::max(r, r * r / (influence * rs));
+    if (scale < probe.gap) {
+      probe.gap = scale;
+      probe.gapRs = 0.0;
+    }
+  };
+
+  int stack[64];
+  int top = 0;
+  stack[top++] = 0;
+  while (top) {
+    const Node &node = nodes[stack[--top]];
+    const dvec3 &q = p[0];
+    bool inBounds = q.x > node.lo.x && q.y > node.lo.y && q.z > node.lo.z &&
+                    q.x < node.hi.x && q.y < node.hi.y && q.z < node.hi.z;
+    double dist = glm::length(node.centroid - q);
+    if (!inBounds && node.extent < opening * dist) {
+      weak(node.centroid, node.rs);
+      continue;
+    }
+    if (node.count == 0) {
+      stack[top++] = node.right;
+      stack[top++] = (int)(&node - nodes.data()) + 1;
+      continue;
+    }
+    for (int i = node.first; i < node.first + node.count; i++) {
+      const Hole &h = holes[i];
+      double r = glm::length(p[0] - h.position);
+      if (r > influence * h.rs) {
+        weak(h.position, h.rs);
+        continue;
+      }
+      for (int j = 0; j < count; j++) {
+        dvec3 x = p[j] - h.position;
+        double rj = glm::length(x);
+        dvec3 hv = glm::cross(x, v[j]);
+        double h2 = glm::dot(hv, hv);
+        acc[j] += x * (-1.5 * h.rs * h2 / (rj * rj * rj * rj * rj));
+      }
+      probe.inside |= r < h.rs * 1.01;
+      if (r - h.rs < probe.gap) {
+        probe.gap = r - h.rs;
+        probe.gapRs = h.rs;
+        probe.nearest = i;
+      }
+    }
+  }
+}
+
+// ---------------- Tracing ----------------
+// Neighbours of a ray with differentials start Offset pixels away along
+// dDir: far enough above rounding, close enough that the difference is the
+// derivative.
+static const double Offset = 1.0e-4;
+
+void traceHoles(const HoleBVH &bvh, const TraceConfig &cfg, const Ray *rays,
+                RayHit *out, size_t count, TraceStats *stats) {
+  const dvec3 center = bvh.centroid();
+  double reach = 0.0;
+  for (const HoleBVH::Hole &h : bvh.holes)
+    reach = std::max(reach, glm::length(h.position - center));
+  const double escape = reach + cfg.escapeRadius * bvh.totalRs();
+
+  uint64_t steps = 0;
+  for (size_t i = 0; i < count; i++) {
+    // the ray, then its neighbours along dDir[0] and dDir[1] if it has any
+    const Ray &ray = rays[i];
+    const int m = ray.dDir[0] == glm::vec3(0.0f) &&
+                          ray.dDir[1] == glm::vec3(0.0f)
+                      ? 1
+                      : 3;
+    dvec3 p[3], v[3], a[3];
+    for (int j = 0; j < m; j++) {
+      p[j] = dvec3(ray.origin);
+      v[j] = dvec3(ray.dir);
+      if (j)
+        v[j] = glm::normalize(v[j] + dvec3(ray.dDir[j - 1]) * Offset);
+    }
+    RayHit &hit = out[i];
+    hit.dDir[0] = hit.dDir[1] = glm::vec3(0.0f);
+    hit.diskRadius = 0.0f;
+    hit.status = RayStatus::Unfinished;
+
+    HoleBVH::Probe probe;
+    bvh.acceleration(p, v, m, a, probe);
+    int n = 0;
+    while (n < cfg.maxSteps) {
+      n++;
+      double h = cfg.stepScale * (probe.gap + 2.0 * probe.gapRs);
+      if (!(h < escape))
+        h = escape;
+      int near = probe.nearest;
+
+      HoleBVH::Probe scratch;
+      dvec3 k1p[3], k2p[3], k3p[3], k4p[3], k2v[3], k3v[3], k4v[3], q[3];
+      for (int j = 0; j < m; j++) {
+        k1p[j] = v[j];
+        k2p[j] = v[j] + a[j] * (0.5 * h);
+        q[j] = p[j] + k1p[j] * (0.5 * h);
+      }
+      bvh.acceleration(q, k2p, m, k2v, scratch);
+      for (int j = 0; j < m; j++) {
+        k3p[j] = v[j] + k2v[j] * (0.5 * h);
+        q[j] = p[j] + k2p[j] * (0.5 * h);
+      }
+      bvh.acceleration(q, k3p, m, k3v, scratch);
+      for (int j = 0; j < m; j++) {
+        k4p[j] = v[j] + k3v[j] * h;
+        q[j] = p[j] + k3p[j] * h;
+      }
+      bvh.acceleration(q, k4p, m, k4v, scratch);
+      dvec3 p0 = p[0];
+      for (int j = 0; j < m; j++) {
+        p[j] += (k1p[j] + (k2p[j] + k3p[j]) * 2.0 + k4p[j]) * (h / 6.0);
+        v[j] += (a[j] + (k2v[j] + k3v[j]) * 2.0 + k4v[j]) * (h / 6.0);
+      }
+      bvh.acceleration(p, v, m, a, probe);
+
+      if (probe.inside) {
+        hit.status = RayStatus::Captured;
+        break;
+      }
+
+      // earliest event along the step's chord wins: the disk of the hole
+      // the step started next to, in its own y plane, or a scene object
+      double theta = 2.0, diskR = 0.0;
+      RayStatus event = RayStatus::Unfinished;
+      if (near >= 0) {
+        const HoleBVH::Hole &hole = bvh.holes[near];
+        double z0 = p0.y - hole.position.y, z1 = p[0].y - hole.position.y;
+        if (z0 * z1 < 0.0) {
+          double t = z0 / (z0 - z1);
+          dvec3 c = p0 + (p[0] - p0) * t - hole.position;
+          double rq = std::sqrt(c.x * c.x + c.z * c.z) / hole.rs;
+          if (rq > cfg.diskInner && rq < cfg.diskOuter) {
+            theta = t;
+            event = RayStatus::Disk;
+            diskR = rq;
+          }
+        }
+      }
+
+      SurfaceHit surface;
+      if (cfg.scene &&
+          cfg.scene->intersect(glm::vec3(p0), glm::vec3(p[0]), surface) &&
+          surface.t < theta) {
+        event = RayStatus::Surface;
+        hit.point = surface.point;
+        hit.normal = surface.normal;
+        hit.material = surface.material;
+      }
+      if (event != RayStatus::Unfinished) {
+        hit.status = event;
+        hit.diskRadius = (float)diskR;
+        break;
+      }
+
+      dvec3 rel = p[0] - center;
+      if (glm::dot(rel, rel) > escape * escape && glm::dot(rel, v[0]) > 0.0) {
+        hit.status = RayStatus::Escaped;
+        break;
+      }
+    }
+    hit.steps = n;
+    dvec3 dir = glm::normalize(v[0]);
+    hit.dir = glm::vec3(dir);
+    if (m == 3 && hit.status == RayStatus::Escaped)
+      for (int k = 0; k < 2; k++)
+        hit.dDir[k] = glm::vec3((glm::normalize(v[k + 1]) - dir) / Offset);
+    SurfaceHit beyond;
+    if (hit.status == RayStatus::Escaped && cfg.scene &&
+        cfg.scene->intersectRay(glm::vec3(p[0]), hit.dir, beyond)) {
+      hit.status = RayStatus::Surface;
+      hit.point = beyond.point;
+      hit.normal = beyond.normal;
+      hit.material = beyond.material;
+    }
+    steps += hit.steps;
+  }
+
+  // one ray at a time, so every step is a full one
+  if (stats) {
+    stats->laneSteps += steps;
+    stats->slotSteps += steps;
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "objects.hpp"
+#include "tracer.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+// ---------------- Hole BVH ----------------
+// Bounding-volume hierarchy over the holes' influence spheres, radius
+// TraceConfig::influence in r_s. Inside its sphere a hole bends light with
+// the exact Schwarzschild photon force; outside, only its weak-field pull
+// is left, and a subtree that looks small from the ray (extent over
+// distance below TraceConfig::opening) acts as one mass at its centre of
+// mass. A step therefore visits O(log n) nodes instead of every hole.
+struct HoleBVH {
+  struct Hole {
+    glm::dvec3 position; // scene space
+    double rs;
+  };
+
+  struct Node {
+    glm::dvec3 lo, hi;     // bounds of the influence spheres below
+    glm::dvec3 centroid;   // r_s-weighted centre of the holes below
+    double rs;             // total r_s below
+    double extent;         // largest distance of a hole from the centroid
+    int first, count;      // hole range for leaves, count = 0 for inner nodes
+    int right;             // inner nodes: left child is the next node
+  };
+
+  // What the ray saw while the forces were summed.
+  struct Probe {
+    double gap;   // length scale of the closest force: distance to the
+                  // horizon near a hole, at least r^2 / (influence r_s) far
+    double gapRs; // r_s of the nearest exact hole, 0 for the weak field
+    int nearest;  // nearest hole evaluated exactly, -1 if none
+    bool inside;  // within some hole's capture radius
+  };
+
+  std::vector<Hole> holes;
+  std::vector<Node> nodes;
+  double influence = 20.0;
+  double opening = 0.5;
+
+  void build(const std::vector<BlackHole> &bhs, const TraceConfig &cfg);
+
+  // Bending acceleration of a photon at p moving along v.
+  glm::dvec3 acceleration(const glm::dvec3 &p, const glm::dvec3 &v,
+                          Probe &probe) const;
+
+  // Same for `count` photons at once, through the nodes and holes chosen
+  // for the first; the probe is the first's. Photons close to the first
+  // see one smooth field, so differences between them are derivatives.
+  void acceleration(const glm::dvec3 *p, const glm::dvec3 *v, int count,
+                    glm::dvec3 *acc, Probe &probe) const;
+
+  // Total r_s and its centre, for escape tests and ray binning.
+  double totalRs() const { return nodes.empty() ? 0.0 : nodes[0].rs; }
+  glm::dvec3 centroid() const {
+    return nodes.empty() ? glm::dvec3(0.0) : nodes[0].centroid;
+  }
+
+private:
+  int buildNode(int first, int count);
+};
+
+// Traces rays through all holes of the BVH with RK4 in double precision.
+// Holes capture at their horizon and each carries a disk in its own y
+// plane; objects of cfg.scene are hit by each step's chord, and rays escape
+// once they leave the cluster outward, then run straight on to any scene
+// object further out. Rays with differentials carry two neighbours, offset
+// along dDir, through the same steps and forces, and escape with d(dir)
+// from the difference of the three exit directions.
+void traceHoles(const HoleBVH &bvh, const TraceConfig &cfg, const Ray *rays,
+                RayHit *out, size_t count, TraceStats *stats);
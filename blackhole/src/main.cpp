@@ -3,50 +3,50 @@
 #include <GLFW/glfw3.h>
 #include <glad/glad.h>
 
+#include "bodies.hpp"
+#include "camera.hpp"
+#include "checkpoint.hpp"
+#include "compute_tracer.hpp"
+#include "fmm.hpp"
+#include "hermite.hpp"
 #include "objects.hpp"
+#include "particle_renderer.hpp"
+#include "parallel.hpp"
+#include "particles.hpp"
+#include "playback.hpp"
+#include "poster.hpp"
+#include "random.hpp"
+#include "render.hpp"
+#include "sampling.hpp"
+#include "scene.hpp"
+#include "shader.hpp"
+#include "snapshot.hpp"
+#include "trajectory.hpp"
+#include "video.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <string>
 #include <vector>
 
 using namespace glm;
 
-// ---------------- Shader helpers ----------------
-static GLuint compileShader(GLenum type, const char *src) {
-  GLuint s = glCreateShader(type);
-  glShaderSource(s, 1, &src, nullptr);
-  glCompileShader(s);
-  GLint ok;
-  glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
-  if (!ok) {
-    char log[1024];
-    glGetShaderInfoLog(s, 1024, nullptr, log);
-    std::cerr << "Shader error:\n" << log << "\n";
-  }
-  return s;
-}
-
-static GLuint makeProgram(const char *vs, const char *fs) {
-  GLuint v = compileShader(GL_VERTEX_SHADER, vs);
-  GLuint f = compileShader(GL_FRAGMENT_SHADER, fs);
-  GLuint p = glCreateProgram();
-  glAttachShader(p, v);
-  glAttachShader(p, f);
-  glLinkProgram(p);
-  glDeleteShader(v);
-  glDeleteShader(f);
-  return p;
-}
-
 // ---------------- Sphere mesh ----------------
-static GLuint sphereVAO = 0, sphereVBO = 0, sphereEBO = 0;
+static GLuint sphereVAO = 0;
 static GLsizei indexCount = 0;
 
-static void buildSphere(int stacks, int slices) {
+static void buildSphere(int stacks, int slices, GLuint &vao, GLsizei &count) {
   std::vector<float> verts;
   std::vector<unsigned int> indices;
 
@@ -88,19 +88,20 @@ static void buildSphere(int stacks, int slices) {
     }
   }
 
-  indexCount = (GLsizei)indices.size();
+  count = (GLsizei)indices.size();
 
-  glGenVertexArrays(1, &sphereVAO);
-  glGenBuffers(1, &sphereVBO);
-  glGenBuffers(1, &sphereEBO);
+  GLuint vbo, ebo;
+  glGenVertexArrays(1, &vao);
+  glGenBuffers(1, &vbo);
+  glGenBuffers(1, &ebo);
 
-  glBindVertexArray(sphereVAO);
+  glBindVertexArray(vao);
 
-  glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
   glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(float), verts.data(),
                GL_STATIC_DRAW);
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
                indices.data(), GL_STATIC_DRAW);
 
@@ -190,7 +191,7 @@ static void cursor_position_callback(GLFWwindow *window, double xpos,
     pitchDeg = -89.0f;
 }
 
-static glm::mat4 computeOrbitView() {
+static glm::vec3 computeOrbitEye() {
   float yaw = glm::radians(yawDeg);
   float pitch = glm::radians(pitchDeg);
 
@@ -200,13 +201,16 @@ static glm::mat4 computeOrbitView() {
   dir.z = sinf(yaw) * cosf(pitch);
   dir = glm::normalize(dir);
 
-  glm::vec3 cameraPos = target - dir * distanceToTarget;
-  return glm::lookAt(cameraPos, target, glm::vec3(0.0f, 1.0f, 0.0f));
+  return target - dir * distanceToTarget;
+}
+
+static glm::mat4 computeOrbitView() {
+  return glm::lookAt(computeOrbitEye(), target, glm::vec3(0.0f, 1.0f, 0.0f));
 }
 
 void BlackHole::draw() {
   mat4 model = translate(mat4(1.0f), vec3(position.x, position.y, position.z));
-  model = scale(model, vec3((float)r_s * 1e-4f)); // scale to visible size
+  model = scale(model, vec3(sceneRadius())); // scale to visible size
 
   mat4 MVP = projection * view * model;
 
@@ -222,18 +226,398 @@ void BlackHole::draw() {
   glBindVertexArray(0);
 }
 
-// ---------------- Main ----------------
-int main() {
-  glfwInit();
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+// Played-back runs hold far more holes than one draw call each can keep up
+// with: draw them as instances of a coarser sphere, streaming each hole's
+// centre and radius (scene units) straight into a mapped buffer.
+static GLuint instanceProgram = 0, instanceVAO = 0, instanceVBO = 0;
+static GLsizei instanceIndexCount = 0;
+static size_t instanceCapacity = 0;
+
+static void buildInstances(GLuint prog) {
+  instanceProgram = prog;
+  buildSphere(16, 16, instanceVAO, instanceIndexCount);
+  glGenBuffers(1, &instanceVBO);
+  glBindVertexArray(instanceVAO);
+  glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+  glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float),
+                        (void *)0);
+  glVertexAttribDivisor(2, 1);
+  glEnableVertexAttribArray(2);
+  glBindVertexArray(0);
+}
+
+static void drawInstances(const BodySystem &bodies) {
+  size_t n = bodies.size();
+  if (!n)
+    return;
+  glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+  if (n > instanceCapacity) {
+    instanceCapacity = n + n / 2;
+    glBufferData(GL_ARRAY_BUFFER, instanceCapacity * 4 * sizeof(float),
+                 nullptr, GL_STREAM_DRAW);
+  }
+  // invalidating lets the driver hand out fresh memory instead of waiting
+  // for the previous frame's draw
+  float *out = (float *)glMapBufferRange(
+      GL_ARRAY_BUFFER, 0, n * 4 * sizeof(float),
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (!out)
+    return;
+  parallelFor(n, 4096, [&](size_t i) {
+    out[4 * i + 0] = (float)(bodies.pos[0][i] * metersToScene);
+    out[4 * i + 1] = (float)(bodies.pos[1][i] * metersToScene);
+    out[4 * i + 2] = (float)(bodies.pos[2][i] * metersToScene);
+    out[4 * i + 3] = (float)(bodies.rs(i) * metersToScene);
+  });
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+
+  mat4 viewProjection = projection * view;
+  glUseProgram(instanceProgram);
+  glUniformMatrix4fv(glGetUniformLocation(instanceProgram, "uViewProjection"),
+                     1, GL_FALSE, value_ptr(viewProjection));
+  glUniform3f(glGetUniformLocation(instanceProgram, "uLightDir"), -0.5f, -1.0f,
+              -0.3f);
+  glBindVertexArray(instanceVAO);
+  glDrawElementsInstanced(GL_TRIANGLES, instanceIndexCount, GL_UNSIGNED_INT, 0,
+                          (GLsizei)n);
+  glBindVertexArray(0);
+}
+
+static MetricType parseMetricType(const char *name) {
+  static const struct {
+    const char *name;
+    MetricType type;
+  } names[] = {
+      {"flat", MetricType::Flat},
+      {"schwarzschild", MetricType::Schwarzschild},
+      {"kerr", MetricType::Kerr},
+#define BLACKHOLE_METRIC_NAME(N, name) {name, MetricType::N},
+      BLACKHOLE_GENERATED_METRIC_TYPES(BLACKHOLE_METRIC_NAME)
+#undef BLACKHOLE_METRIC_NAME
+  };
+  for (const auto &n : names) {
+    if (std::strcmp(n.name, name) == 0)
+      return n.type;
+  }
+  std::cerr << "Unknown metric '" << name << "', using auto\n";
+  return MetricType::Auto;
+}
+
+static GLFWwindow *createWindow(int major, int minor) {
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, major);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, minor);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+  return glfwCreateWindow(800, 600, "Black Hole (Sphere)", nullptr, nullptr);
+}
+
+// ---------------- Scene ----------------
+// `count` holes sharing `mass`: one at the origin, a binary on the x axis,
+// or a cluster scattered through a ball around the origin.
+static std::vector<BlackHole> makeHoles(int count, double mass, double spin) {
+  if (count == 1)
+    return {BlackHole({0.0, 0.0, 0.0}, mass, spin)};
+  if (count == 2)
+    return {BlackHole({-1.0, 0.0, 0.0}, 0.5 * mass, spin),
+            BlackHole({1.0, 0.0, 0.0}, 0.5 * mass, spin)};
+
+  std::vector<BlackHole> holes;
+  CounterRng rng(1, RandomStream::Holes);
+  for (uint32_t attempt = 0; (int)holes.size() < count; attempt++) {
+    std::array<float, 4> u = rng.uniform(attempt);
+    vec3 p = 2.0f * vec3(u[0], u[1], u[2]) - 1.0f;
+    if (dot(p, p) <= 1.0f)
+      holes.emplace_back(p * 1.5f, mass / count, spin);
+  }
+  return holes;
+}
+
+// Starting velocities for --simulate: a circular orbit for a binary, and
+// random velocities near virial equilibrium for a cluster.
+static void setOrbits(BodySystem &bodies) {
+  size_t n = bodies.size();
+  if (n < 2)
+    return;
+  double total = 0.0, radius = 0.0;
+  dvec3 com(0.0);
+  for (size_t i = 0; i < n; i++) {
+    total += bodies.mass[i];
+    com += bodies.position(i) * bodies.mass[i];
+  }
+  com /= total;
+  for (size_t i = 0; i < n; i++)
+    radius = std::max(radius, length(bodies.position(i) - com));
+
+  std::vector<dvec3> v(n);
+  if (n == 2) {
+    dvec3 d = bodies.position(1) - bodies.position(0);
+    dvec3 dir = normalize(cross(d, dvec3(0.0, 1.0, 0.0)));
+    double speed = std::sqrt(G * total / length(d));
+    v[0] = -dir * speed * bodies.mass[1] / total;
+    v[1] = dir * speed * bodies.mass[0] / total;
+  } else {
+    // uniform ball: 2K = -W = 3/5 G M^2 / R, so sigma^2 = G M / (5 R)
+    double sigma = std::sqrt(G * total / (5.0 * radius));
+    CounterRng rng(1, RandomStream::Orbits);
+    dvec3 momentum(0.0);
+    for (size_t i = 0; i < n; i++) {
+      philox::Block a = rng.bits((uint32_t)i, 0), b = rng.bits((uint32_t)i, 1);
+      double z[4];
+      philox::normal(philox::unit(a[0], a[1]), philox::unit(a[2], a[3]), z[0],
+                     z[1]);
+      philox::normal(philox::unit(b[0], b[1]), philox::unit(b[2], b[3]), z[2],
+                     z[3]);
+      v[i] = dvec3(z[0], z[1], z[2]) * sigma;
+      momentum += v[i] * bodies.mass[i];
+    }
+    for (dvec3 &vi : v)
+      vi -= momentum / total;
+  }
+  for (size_t i = 0; i < n; i++)
+    for (int k = 0; k < 3; k++)
+      bodies.vel[k][i] = v[i][k];
+}
+
+// A companion star above and behind the hole, and a box-shaped probe
+// between the hole and the default camera.
+static void buildCompanions(SceneBVH &scene) {
+  int star = scene.addMaterial({vec3(1.0f, 0.9f, 0.6f), true});
+  int hull = scene.addMaterial({vec3(0.7f, 0.72f, 0.75f), false});
+  scene.addSphere(vec3(-1.5f, 4.5f, -5.0f), 0.6f, star);
+
+  std::vector<vec3> corners;
+  for (int i = 0; i < 8; i++)
+    corners.push_back(vec3(-1.2f, 0.6f, 2.0f) +
+                      0.15f * vec3(i & 1 ? 1 : -1, i & 2 ? 1 : -1,
+                                   i & 4 ? 2 : -2));
+  std::vector<uint32_t> faces = {0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5,
+                                 0, 4, 5, 0, 5, 1, 2, 3, 7, 2, 7, 6,
+                                 0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3};
+  scene.addMesh(corners, faces, hull);
+  scene.build();
+}
+
+// ---------------- FMM report ----------------
+// Equal-mass holes filling a 15 km ball uniformly, or a Plummer sphere of
+// the same scale whose dense core is the hard case for the tree.
+static BodySystem sampleBodies(bool plummer, size_t n) {
+  BodySystem bodies;
+  CounterRng rng(2, RandomStream::Bodies);
+  for (uint32_t attempt = 0; bodies.size() < n; attempt++) {
+    philox::Block a = rng.bits(attempt, 0), b = rng.bits(attempt, 1);
+    dvec3 p = 2.0 * dvec3(philox::unit(a[0], a[1]), philox::unit(a[2], a[3]),
+                          philox::unit(b[0], b[1])) -
+              1.0;
+    double r2 = dot(p, p);
+    if (r2 > 1.0 || r2 == 0.0)
+      continue;
+    if (plummer) {
+      // invert the Plummer mass profile along a random direction
+      double m = 0.99 * philox::unit(b[2], b[3]);
+      p *= 0.2 / std::sqrt(std::pow(m, -2.0 / 3.0) - 1.0) / std::sqrt(r2);
+    }
+    bodies.add(p * 15000.0, dvec3(0.0), 1.0e33 / (double)n);
+  }
+  bodies.sortMorton();
+  return bodies;
+}
+
+// FMM time and error against exact summation at a sample of bodies.
+static void printFmmReport() {
+  using clock = std::chrono::steady_clock;
+  auto since = [](clock::time_point t) {
+    return std::chrono::duration<double, std::milli>(clock::now() - t)
+        .count();
+  };
+  std::cout << "config    bodies  order  theta   fmm ms  direct ms"
+               "   rms err   max err\n";
+  for (bool plummer : {false, true})
+    for (size_t n : {10000, 100000}) {
+      BodySystem bodies = sampleBodies(plummer, n);
+      const size_t samples = 256;
+      std::vector<dvec3> exact(samples);
+      auto start = clock::now();
+      for (size_t s = 0; s < samples; s++)
+        exact[s] = directAcceleration(bodies, s * n / samples);
+      double directMs = since(start) * (double)n / samples;
+
+      for (int order : {2, 4, 6})
+        for (double theta : {0.5, 0.7}) {
+          FmmConfig cfg;
+          cfg.order = order;
+          cfg.theta = theta;
+          FmmSolver fmm(cfg);
+          std::vector<double> acc[3];
+          start = clock::now();
+          fmm.solve(bodies, acc);
+          double fmmMs = since(start);
+
+          double err2 = 0.0, ref2 = 0.0, worst = 0.0;
+          for (size_t s = 0; s < samples; s++) {
+            size_t i = s * n / samples;
+            dvec3 e = dvec3(acc[0][i], acc[1][i], acc[2][i]) - exact[s];
+            err2 += dot(e, e);
+            ref2 += dot(exact[s], exact[s]);
+            worst = std::max(worst, length(e) / length(exact[s]));
+          }
+          std::cout << std::left << std::setw(8)
+                    << (plummer ? "plummer" : "uniform") << std::right
+                    << std::setw(8) << n << std::setw(7) << order
+                    << std::setw(7) << theta << std::fixed
+                    << std::setprecision(1) << std::setw(9) << fmmMs
+                    << std::setw(11) << directMs << std::scientific
+                    << std::setprecision(2) << std::setw(10)
+                    << std::sqrt(err2 / ref2) << std::setw(10) << worst
+                    << std::defaultfloat << "\n";
+        }
+    }
+}
+
+// ---------------- Main ----------------
+int main(int argc, char **argv) {
+  // --compute: trace geodesics in a GL 4.3 compute shader instead of
+  // rasterizing the horizon sphere
+  // --cpu: trace on the CPU with the templated tracer (--double, --spin a,
+  // --charge q, --metric name, --stats, --differentials to filter the sky
+  // by each pixel's lensed footprint, --samples n per pixel placed by
+  // --sampler random|sobol|r2|blue, sobol by default)
+  // --binary, --cluster n: split the hole's mass over two or n holes
+  // --companion: add a star and a probe for the CPU tracer to lens
+  // --particles n: orbit n test particles around the first hole
+  // --simulate: let the holes orbit each other (Hermite, block steps)
+  // --record path: append every simulated frame to a snapshot run
+  // --trajectory path: write the simulated positions compressed
+  // --play path: play a recorded run or a trajectory back in a loop;
+  // Left/Right scrub, Up/Down double or halve the speed
+  // --video out.mp4: pipe every frame to ffmpeg, stepping time by 1 / --fps
+  // (default 30) instead of the wall clock
+  // --checkpoint path: save the simulation and particles every minute and
+  // on exit; --resume continues from that checkpoint, given the same flags
+  // --output poster.exr|.hdr: render the starting scene at --size WxH on
+  // the CPU and exit (--float for 32-bit EXR channels instead of half,
+  // --memory MB to bound the renderer, --resume to finish an interrupted
+  // poster)
+  // --fmm-report: time the FMM gravity solver against exact sums and exit
+  bool useCompute = false;
+  bool useCpu = false;
+  bool printStats = false;
+  int holeCount = 1;
+  bool companion = false;
+  bool simulate = false;
+  std::string recordPath, trajectoryPath, checkpointPath, playPath;
+  std::string videoPath, outputPath;
+  PosterConfig poster;
+  int videoFps = 30;
+  bool resume = false;
+  size_t particleCount = 0;
+  double spin = 0.0;
+  double charge = 0.0;
+  MetricType metric = MetricType::Auto;
+  RenderSettings cpuSettings;
+  PixelSampler sampler;
+  int samples = 1;
+  SamplerType samplerType = SamplerType::Sobol;
+  bool pickSampler = false;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--fmm-report") == 0) {
+      printFmmReport();
+      return 0;
+    }
+    if (std::strcmp(argv[i], "--compute") == 0)
+      useCompute = true;
+    else if (std::strcmp(argv[i], "--cpu") == 0)
+      useCpu = true;
+    else if (std::strcmp(argv[i], "--binary") == 0)
+      holeCount = 2;
+    else if (std::strcmp(argv[i], "--cluster") == 0 && i + 1 < argc)
+      holeCount = std::max(1, std::atoi(argv[++i]));
+    else if (std::strcmp(argv[i], "--companion") == 0)
+      companion = true;
+    else if (std::strcmp(argv[i], "--simulate") == 0)
+      simulate = true;
+    else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+      recordPath = argv[++i];
+    else if (std::strcmp(argv[i], "--trajectory") == 0 && i + 1 < argc)
+      trajectoryPath = argv[++i];
+    else if (std::strcmp(argv[i], "--play") == 0 && i + 1 < argc)
+      playPath = argv[++i];
+    else if (std::strcmp(argv[i], "--video") == 0 && i + 1 < argc)
+      videoPath = argv[++i];
+    else if (std::strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+      videoFps = std::max(1, std::atoi(argv[++i]));
+    else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+      outputPath = argv[++i];
+    else if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+      std::sscanf(argv[++i], "%dx%d", &cpuSettings.width,
+                  &cpuSettings.height);
+    else if (std::strcmp(argv[i], "--float") == 0)
+      poster.fullFloat = true;
+    else if (std::strcmp(argv[i], "--memory") == 0 && i + 1 < argc)
+      poster.memoryBudget = (size_t)std::max(1L, std::atol(argv[++i])) << 20;
+    else if (std::strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+      checkpointPath = argv[++i];
+    else if (std::strcmp(argv[i], "--resume") == 0)
+      resume = true;
+    else if (std::strcmp(argv[i], "--particles") == 0 && i + 1 < argc)
+      particleCount = (size_t)std::max(0L, std::atol(argv[++i]));
+    else if (std::strcmp(argv[i], "--stats") == 0)
+      printStats = true;
+    else if (std::strcmp(argv[i], "--double") == 0)
+      cpuSettings.precision = Precision::Double;
+    else if (std::strcmp(argv[i], "--differentials") == 0)
+      cpuSettings.precision = Precision::Differential;
+    else if (std::strcmp(argv[i], "--spin") == 0 && i + 1 < argc)
+      spin = std::atof(argv[++i]);
+    else if (std::strcmp(argv[i], "--charge") == 0 && i + 1 < argc)
+      charge = std::atof(argv[++i]);
+    else if (std::strcmp(argv[i], "--metric") == 0 && i + 1 < argc)
+      metric = parseMetricType(argv[++i]);
+    else if (std::strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+      samples = std::max(1, std::atoi(argv[++i]));
+    else if (std::strcmp(argv[i], "--sampler") == 0 && i + 1 < argc)
+      pickSampler = parseSamplerType(argv[++i], samplerType) || pickSampler;
+  }
+  // the sample tables are built once here and shared by every render
+  if (samples > 1 || pickSampler) {
+    sampler.build(samplerType, samples);
+    cpuSettings.sampler = &sampler;
+  }
+
+  if (!outputPath.empty()) {
+    std::vector<BlackHole> holes = makeHoles(holeCount, 5.0e30, spin);
+    for (BlackHole &bh : holes) {
+      bh.charge = charge;
+      bh.metric = metric;
+    }
+    SceneBVH scene;
+    if (companion) {
+      buildCompanions(scene);
+      cpuSettings.trace.scene = &scene;
+    }
+    Camera cam = Camera::lookAt(
+        computeOrbitEye(), target, vec3(0, 1, 0), radians(60.0f),
+        (float)cpuSettings.width / (float)cpuSettings.height);
+    poster.resume = resume;
+    return renderPoster(outputPath, holes, cam, cpuSettings, poster) ? 0 : 1;
+  }
 
-  GLFWwindow *window =
-      glfwCreateWindow(800, 600, "Black Hole (Sphere)", nullptr, nullptr);
+  glfwInit();
+  // particles stream through persistently mapped buffers from GL 4.4 on
+  GLFWwindow *window = particleCount ? createWindow(4, 4) : nullptr;
+  if (!window && useCompute)
+    window = createWindow(4, 3);
+  if (useCompute && !window) {
+    std::cerr << "No GL 4.3 context, falling back to the raster path\n";
+    useCompute = false;
+  }
+  if (!window)
+    window = createWindow(3, 3);
   glfwMakeContextCurrent(window);
   gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+  if (useCompute && !GLAD_GL_VERSION_4_3) {
+    std::cerr << "Driver lacks GL 4.3 entry points, using the raster path\n";
+    useCompute = false;
+  }
   glfwSetMouseButtonCallback(window, mouse_button_callback);
   glfwSetCursorPosCallback(window, cursor_position_callback);
   glEnable(GL_DEPTH_TEST);
@@ -272,18 +656,159 @@ int main() {
     }
   )";
 
+  // the same shading, placed per instance
+  const char *instancedVs = R"(
+    #version 330 core
+    layout (location = 0) in vec3 aPos;
+    layout (location = 1) in vec3 aNormal;
+    layout (location = 2) in vec4 aHole; // centre, radius
+
+    uniform mat4 uViewProjection;
+
+    out vec3 Normal;
+    out vec3 FragPos;
+
+    void main() {
+      FragPos = aHole.xyz + aPos * aHole.w;
+      Normal = aNormal;
+      gl_Position = uViewProjection * vec4(FragPos, 1.0);
+    }
+  )";
+
   program = makeProgram(vs, fs);
-  buildSphere(64, 64);
+  buildSphere(64, 64, sphereVAO, indexCount);
+  if (!playPath.empty())
+    buildInstances(makeProgram(instancedVs, fs));
 
   projection = perspective(radians(60.0f), 800.0f / 600.0f, 0.1f, 100.0f);
   view = lookAt(vec3(0, 0, 5), vec3(0), vec3(0, 1, 0));
 
-  BlackHole bh({0.0, 0.0, 0.0}, 5.0e30);
+  std::vector<BlackHole> holes = makeHoles(holeCount, 5.0e30, spin);
+  // Morton order, so the BVH build and the draw loop walk memory in step
+  // with space
+  BodySystem bodies = BodySystem::fromHoles(holes);
+  bodies.sortMorton();
+  HermiteIntegrator integrator(bodies);
+  SnapshotPlayer player;
+  BodySystem played;
+  double playTime = 0.0, playRate = 0.0;
+  if (!playPath.empty()) {
+    if (!player.open(playPath)) {
+      glfwTerminate();
+      return 1;
+    }
+    simulate = false;
+    playTime = player.startTime();
+    playRate = (player.endTime() - player.startTime()) / 60.0;
+    player.sample(playTime, playRate, played);
+  }
+  if (simulate) {
+    setOrbits(bodies);
+    integrator.start();
+  }
+  const double simRate = 1.0e-4; // simulated seconds per second
+  double simTime = 0.0;
+  auto refreshHoles = [&] {
+    if (simulate)
+      integrator.predictedHoles(holes);
+    else if (player.isOpen())
+      played.toHoles(holes);
+    else
+      bodies.toHoles(holes);
+    for (BlackHole &bh : holes) {
+      bh.charge = charge;
+      bh.metric = metric;
+    }
+  };
+  refreshHoles();
+
+  ComputeTracer tracer;
+  ScreenQuad screen;
+  if (useCompute) {
+    int fbw, fbh;
+    glfwGetFramebufferSize(window, &fbw, &fbh);
+    useCompute = tracer.init(fbw, fbh);
+  }
+  if (useCompute || useCpu)
+    screen.init();
+
+  SceneBVH scene;
+  if (companion) {
+    buildCompanions(scene);
+    cpuSettings.trace.scene = &scene;
+  }
+
+  ParticleSystem particles(holes[0]);
+  ParticleRenderer particleRenderer;
+  if (particleCount) {
+    particles.seedDisk(particleCount, 3.5f, 15.0f, 1);
+    particleRenderer.init(particleCount);
+  }
+  const float particleTimescale = 30.0f; // scene time per second
+
+  // the loop only copies its state out; the file is written on a thread
+  CheckpointWriter checkpointer;
+  const double checkpointInterval = 60.0; // wall-clock seconds
+  double lastCheckpoint = glfwGetTime();
+  auto checkpoint = [&] {
+    Checkpoint state;
+    state.putValue("main.simTime", simTime);
+    if (simulate)
+      integrator.save(state);
+    if (particleCount)
+      particles.save(state);
+    checkpointer.submit(std::move(state), checkpointPath);
+  };
+  if (resume && !checkpointPath.empty()) {
+    Checkpoint state;
+    if (!state.load(checkpointPath) ||
+        !state.getValue("main.simTime", simTime) ||
+        (simulate && !integrator.restore(state)) ||
+        (particleCount && !particles.restore(state, particleCount))) {
+      std::cerr << "Cannot resume from '" << checkpointPath
+                << "'; was it written with the same flags?\n";
+      glfwTerminate();
+      return 1;
+    }
+    refreshHoles();
+  }
+  // a pre-empted job gets SIGTERM first: leave the loop and checkpoint
+  static volatile std::sig_atomic_t stopRequested = 0;
+  if (!checkpointPath.empty())
+    std::signal(SIGTERM, [](int) { stopRequested = 1; });
+
+  SnapshotWriter recorder;
+  BodySystem recorded;
+  if (simulate && !recordPath.empty())
+    recorder.open(recordPath, simTime);
+  TrajectoryWriter trajectory;
+  if (simulate && !trajectoryPath.empty())
+    trajectory.open(trajectoryPath, TrajectoryConfig(), simTime);
+
+  // yuv420p wants even sizes; a frame smaller than this is not sent
+  VideoWriter video;
+  if (!videoPath.empty()) {
+    int fbw, fbh;
+    glfwGetFramebufferSize(window, &fbw, &fbh);
+    if (!video.open(videoPath, fbw & ~1, fbh & ~1, videoFps)) {
+      glfwTerminate();
+      return 1;
+    }
+  }
+
+  // the CPU path re-traces only when the orbit camera or the holes move
+  GLuint cpuImage = 0;
+  std::vector<vec3> cpuPixels;
+  vec3 cpuEye(NAN);
+  if (useCpu)
+    glGenTextures(1, &cpuImage);
 
-  while (!glfwWindowShouldClose(window)) {
+  while (!glfwWindowShouldClose(window) && !stopRequested) {
     float now = (float)glfwGetTime();
     float dt = now - lastTime;
     lastTime = now;
+    if (video.isOpen())
+      dt = 1.0f / (float)videoFps;
 
     processMovement(window, dt);
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -293,11 +818,109 @@ int main() {
     glClearColor(0.08f, 0.08f, 0.12f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    bh.draw();
+    if (simulate) {
+      simTime += std::min(dt, 0.05f) * simRate;
+      integrator.evolve(simTime);
+      refreshHoles();
+      if (recorder.isOpen() || trajectory.isOpen()) {
+        integrator.predictedBodies(recorded);
+        recorder.capture(recorded, simTime);
+        trajectory.capture(recorded, simTime);
+      }
+    }
+    if (player.isOpen()) {
+      double span = player.endTime() - player.startTime();
+      if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
+        playRate *= std::exp2(dt);
+      if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
+        playRate *= std::exp2(-dt);
+      double scrub = 0.0; // the whole run in five seconds
+      if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+        scrub += span / 5.0;
+      if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
+        scrub -= span / 5.0;
+      playTime += (scrub ? scrub : playRate) * dt;
+      if (playTime > player.endTime())
+        playTime = player.startTime();
+      playTime = std::max(playTime, player.startTime());
+      player.sample(playTime, scrub ? scrub : playRate, played);
+      refreshHoles();
+    }
+
+    if (useCompute) {
+      int fbw, fbh;
+      glfwGetFramebufferSize(window, &fbw, &fbh);
+      tracer.resize(fbw, fbh);
+      Camera cam = Camera::lookAt(computeOrbitEye(), target, vec3(0, 1, 0),
+                                  radians(60.0f), (float)fbw / (float)fbh);
+      tracer.trace(holes, cam);
+      screen.draw(tracer.image);
+    } else if (useCpu) {
+      vec3 eye = computeOrbitEye();
+      if (!(eye == cpuEye) || simulate) {
+        cpuEye = eye;
+        Camera cam = Camera::lookAt(eye, target, vec3(0, 1, 0), radians(60.0f),
+                                    (float)cpuSettings.width /
+                                        (float)cpuSettings.height);
+        TraceStats stats;
+        double start = glfwGetTime();
+        renderImage(holes, cam, cpuSettings, cpuPixels, &stats);
+        if (printStats)
+          std::cout << "cpu frame " << (glfwGetTime() - start) * 1000.0
+                    << " ms, lane utilization "
+                    << stats.utilization() * 100.0 << "%\n";
+
+        glBindTexture(GL_TEXTURE_2D, cpuImage);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, cpuSettings.width,
+                     cpuSettings.height, 0, GL_RGB, GL_FLOAT, cpuPixels.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      }
+      screen.draw(cpuImage);
+    } else if (player.isOpen()) {
+      drawInstances(played);
+    } else {
+      for (BlackHole &bh : holes)
+        bh.draw();
+    }
+
+    if (particleCount) {
+      double start = glfwGetTime();
+      particles.advance(std::min(dt, 0.05f) * particleTimescale, 2);
+      particles.compact();
+      if (float *vertices = particleRenderer.beginFrame(particles.count))
+        particles.writeVertices(vertices);
+      if (printStats)
+        std::cout << "particles " << particles.count << ", "
+                  << (glfwGetTime() - start) * 1000.0 << " ms\n";
+      particleRenderer.draw(projection * view, particles.count);
+    }
+
+    if (!checkpointPath.empty() && now - lastCheckpoint >= checkpointInterval) {
+      checkpoint();
+      lastCheckpoint = now;
+    }
+
+    if (video.isOpen()) {
+      int fbw, fbh;
+      glfwGetFramebufferSize(window, &fbw, &fbh);
+      if (fbw >= video.width() && fbh >= video.height()) {
+        std::vector<uint8_t> frame = video.acquire();
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, video.width(), video.height(), GL_RGB,
+                     GL_UNSIGNED_BYTE, frame.data());
+        video.submit(std::move(frame));
+      }
+    }
 
     glfwSwapBuffers(window);
     glfwPollEvents();
   }
+  video.close();
+  if (!checkpointPath.empty()) {
+    checkpoint();
+    checkpointer.flush();
+  }
 
   glfwTerminate();
   return 0;
@@ -0,0 +1,83 @@
+#include "mergers.hpp"
+#include "objects.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+using glm::dvec3;
+
+void SpatialHash::build(const std::vector<double> (&x)[3], double cellSize) {
+  size_t n = x[0].size();
+  cell = cellSize;
+  size_t want = 16;
+  while (want < 2 * n)
+    want *= 2;
+  if (want != capacity) {
+    capacity = want;
+    heads.reset(new std::atomic<uint32_t>[capacity]);
+  }
+  mask = capacity - 1;
+  for (size_t b = 0; b < capacity; b++)
+    heads[b].store(None, std::memory_order_relaxed);
+  next.resize(n);
+  keys.resize(n);
+
+  parallelFor(n, 1024, [&](size_t i) {
+    uint64_t h = hash(coord(x[0][i]), coord(x[1][i]), coord(x[2][i]));
+    keys[i] = h;
+    next[i] = heads[h & mask].exchange((uint32_t)i, std::memory_order_acq_rel);
+  });
+}
+
+std::vector<std::pair<uint32_t, uint32_t>>
+findContacts(SpatialHash &hash, const std::vector<double> (&x)[3],
+             const std::vector<double> (&v)[3],
+             const std::vector<double> &mass, double interval) {
+  std::vector<std::pair<uint32_t, uint32_t>> contacts;
+  size_t n = mass.size();
+  double maxMass = 0.0, maxSpeed2 = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    maxMass = std::max(maxMass, mass[i]);
+    maxSpeed2 = std::max(maxSpeed2, v[0][i] * v[0][i] + v[1][i] * v[1][i] +
+                                        v[2][i] * v[2][i]);
+  }
+  const double rsPerKg = 2.0 * G / (c * c);
+  double reach = 2.0 * rsPerKg * maxMass +
+                 2.0 * std::sqrt(maxSpeed2) * interval;
+  if (n < 2 || !(reach > 0.0))
+    return contacts;
+  hash.build(x, 2.0 * reach);
+
+  std::mutex found;
+  parallelFor(n, 256, [&](size_t i) {
+    dvec3 xi(x[0][i], x[1][i], x[2][i]), vi(v[0][i], v[1][i], v[2][i]);
+    hash.around(xi, reach, [&](uint32_t j) {
+      if (j <= i)
+        return;
+      dvec3 R = dvec3(x[0][j], x[1][j], x[2][j]) - xi;
+      dvec3 V = dvec3(v[0][j], v[1][j], v[2][j]) - vi;
+      // closest approach over the interval, looking back from its end
+      double vv = glm::dot(V, V);
+      double s = vv > 0.0 ? std::clamp(glm::dot(R, V) / vv, 0.0, interval)
+                          : 0.0;
+      dvec3 d = R - V * s;
+      double touch = rsPerKg * (mass[i] + mass[j]);
+      if (glm::dot(d, d) < touch * touch) {
+        std::lock_guard<std::mutex> lock(found);
+        contacts.push_back({(uint32_t)i, j});
+      }
+    });
+  });
+  std::sort(contacts.begin(), contacts.end());
+  return contacts;
+}
+
+double mergedSpin(double mA, double aA, double mB, double aB) {
+  double m = mA + mB;
+  double nu = mA * mB / (m * m);
+  double orbital = nu * (2.0 * std::sqrt(3.0) + nu * (-3.871 + nu * 4.028));
+  double a = (aA * mA * mA + aB * mB * mB) / (m * m) + orbital;
+  return std::clamp(a, -0.998, 0.998);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// ---------------- Mergers ----------------
+// Two holes merge once their horizons touch, i.e. they come within
+// r_s(A) + r_s(B). Rather than test all pairs, bodies are binned into a
+// uniform grid hashed into a power-of-two table. Cells are twice the
+// reach, the largest contact distance plus the distance two bodies can
+// close between checks, so the partners of a body lie in the at most 8
+// cells its reach overlaps. Bodies are inserted in parallel, each pushed
+// onto its cell's list with one atomic exchange, so the build takes no
+// locks; list order then depends on thread timing, which is why contacts
+// are sorted before use.
+struct SpatialHash {
+  static constexpr uint32_t None = UINT32_MAX;
+
+  double cell = 0.0;
+  size_t mask = 0;
+  std::unique_ptr<std::atomic<uint32_t>[]> heads;
+  std::vector<uint32_t> next; // per body, None ends a list
+  std::vector<uint64_t> keys; // hashed cell of each body
+
+  // Bins points x (one column per axis) into cells of size `cellSize`.
+  void build(const std::vector<double> (&x)[3], double cellSize);
+
+  // Calls fn(j) for every body in the cells overlapping the cube of half
+  // width r around p, at most 8 when r is half a cell; bodies of other
+  // cells that share a bucket come along and must be filtered.
+  template <class Fn>
+  void around(const glm::dvec3 &p, double r, Fn &&fn) const {
+    int64_t x0 = coord(p.x - r), x1 = coord(p.x + r);
+    int64_t y0 = coord(p.y - r), y1 = coord(p.y + r);
+    int64_t z0 = coord(p.z - r), z1 = coord(p.z + r);
+    for (int64_t z = z0; z <= z1; z++)
+      for (int64_t y = y0; y <= y1; y++)
+        for (int64_t x = x0; x <= x1; x++) {
+          uint64_t h = hash(x, y, z);
+          for (uint32_t j = heads[h & mask].load(std::memory_order_relaxed);
+               j != None; j = next[j])
+            if (keys[j] == h)
+              fn(j);
+        }
+  }
+
+  int64_t coord(double x) const { return (int64_t)std::floor(x / cell); }
+  static uint64_t hash(int64_t x, int64_t y, int64_t z) {
+    return (uint64_t)x * 0x9E3779B97F4A7C15ull ^
+           (uint64_t)y * 0xC2B2AE3D27D4EB4Full ^
+           (uint64_t)z * 0x165667B19E3779F9ull;
+  }
+
+private:
+  size_t capacity = 0;
+};
+
+// Pairs of slots (lower first, sorted) whose horizons touched during the
+// last `interval` seconds, given positions and velocities at its end:
+// bodies are taken to move in straight lines over it, so a fast pair that
+// passed through contact between two checks is still caught.
+std::vector<std::pair<uint32_t, uint32_t>>
+findContacts(SpatialHash &hash, const std::vector<double> (&x)[3],
+             const std::vector<double> (&v)[3],
+             const std::vector<double> &mass, double interval);
+
+// Spin a/M of the remnant of two holes with aligned spins: their spin
+// angular momenta plus the orbital part at plunge, from the fit of
+// Rezzolla et al. (2008) for non-spinning holes.
+double mergedSpin(double mA, double aA, double mB, double aB);
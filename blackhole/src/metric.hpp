@@ -0,0 +1,264 @@
+#pragma once
+
+#include "objects.hpp"
+
+#include <cmath>
+
+// Spacetime kernels for the CPU tracer. Every metric exposes the same
+// compile-time interface so Tracer<Metric, Real, Width> can inline it:
+//
+//   Dim                    state size
+//   init(pos, dir, y)      photon at `pos` heading along unit `dir`
+//   rhs(y, dy)             geodesic right-hand side d(y)/d(lambda)
+//   radius(y)              radial coordinate, compared against horizon()
+//   position(y, p)         Cartesian position relative to the hole
+//   direction(y, d)        Cartesian direction of travel (unnormalized)
+//   stepFactor(y)          extra step-size scaling near chart singularities
+//
+// plus horizon(), scale() and massRadius(), the r_s a distant observer
+// would measure, which drives the weak-field tail of escaping rays.
+//
+// Positions are in scene units relative to the hole, with the disk in the
+// y = 0 plane. Metrics generated from metrics/*.metric implement the same
+// interface through CoordinateMetric (chart.hpp).
+
+// ---------------- Flat ----------------
+struct FlatMetric {
+  static constexpr int Dim = 6;
+
+  explicit FlatMetric(const BlackHole &) {}
+
+  double horizon() const { return 0.0; }
+  double scale() const { return 1.0; }
+  double massRadius() const { return 0.0; }
+
+  template <class R> void init(const R pos[3], const R dir[3], R y[]) const {
+    for (int i = 0; i < 3; i++) {
+      y[i] = pos[i];
+      y[3 + i] = dir[i];
+    }
+  }
+
+  template <class R> void rhs(const R y[], R dy[]) const {
+    for (int i = 0; i < 3; i++) {
+      dy[i] = y[3 + i];
+      dy[3 + i] = R(0);
+    }
+  }
+
+  template <class R> R radius(const R y[]) const {
+    using std::sqrt;
+    return sqrt(y[0] * y[0] + y[1] * y[1] + y[2] * y[2]);
+  }
+
+  template <class R> void position(const R y[], R p[3]) const {
+    for (int i = 0; i < 3; i++)
+      p[i] = y[i];
+  }
+
+  template <class R> void direction(const R y[], R d[3]) const {
+    for (int i = 0; i < 3; i++)
+      d[i] = y[3 + i];
+  }
+
+  template <class R> R stepFactor(const R[]) const { return R(1); }
+};
+
+// ---------------- Schwarzschild ----------------
+// Photon orbits written as a Cartesian central force,
+//   x'' = -3/2 r_s h^2 x / r^5,  h = |x cross x'|,
+// which reproduces the Binet equation of the exact metric.
+struct SchwarzschildMetric {
+  static constexpr int Dim = 6;
+  double rs;
+
+  explicit SchwarzschildMetric(const BlackHole &bh) : rs(bh.sceneRadius()) {}
+
+  double horizon() const { return rs; }
+  double scale() const { return rs; }
+  double massRadius() const { return rs; }
+
+  template <class R> void init(const R pos[3], const R dir[3], R y[]) const {
+    for (int i = 0; i < 3; i++) {
+      y[i] = pos[i];
+      y[3 + i] = dir[i];
+    }
+  }
+
+  template <class R> void rhs(const R y[], R dy[]) const {
+    using std::sqrt;
+    R hx = y[1] * y[5] - y[2] * y[4];
+    R hy = y[2] * y[3] - y[0] * y[5];
+    R hz = y[0] * y[4] - y[1] * y[3];
+    R h2 = hx * hx + hy * hy + hz * hz;
+    R r2 = y[0] * y[0] + y[1] * y[1] + y[2] * y[2];
+    R k = R(-1.5 * rs) * h2 / (r2 * r2 * sqrt(r2));
+    for (int i = 0; i < 3; i++) {
+      dy[i] = y[3 + i];
+      dy[3 + i] = k * y[i];
+    }
+  }
+
+  // Massive particle, state (x, dx/dtau): the photon force plus the
+  // Newtonian pull -r_s/2 x / r^3 reproduces the Binet equation of timelike
+  // orbits. The energy argument only exists to match KerrMetric.
+  template <class R> void particleRhs(const R y[], R, R dy[]) const {
+    using std::sqrt;
+    R hx = y[1] * y[5] - y[2] * y[4];
+    R hy = y[2] * y[3] - y[0] * y[5];
+    R hz = y[0] * y[4] - y[1] * y[3];
+    R h2 = hx * hx + hy * hy + hz * hz;
+    R r2 = y[0] * y[0] + y[1] * y[1] + y[2] * y[2];
+    R r3 = r2 * sqrt(r2);
+    R k = R(-0.5 * rs) / r3 - R(1.5 * rs) * h2 / (r2 * r3);
+    for (int i = 0; i < 3; i++) {
+      dy[i] = y[3 + i];
+      dy[3 + i] = k * y[i];
+    }
+  }
+
+  template <class R> R radius(const R y[]) const {
+    using std::sqrt;
+    return sqrt(y[0] * y[0] + y[1] * y[1] + y[2] * y[2]);
+  }
+
+  template <class R> void position(const R y[], R p[3]) const {
+    for (int i = 0; i < 3; i++)
+      p[i] = y[i];
+  }
+
+  template <class R> void direction(const R y[], R d[3]) const {
+    for (int i = 0; i < 3; i++)
+      d[i] = y[3 + i];
+  }
+
+  template <class R> R stepFactor(const R[]) const { return R(1); }
+};
+
+// ---------------- Kerr ----------------
+// Hamiltonian flow in Cartesian Kerr-Schild coordinates,
+//   g^{uv} = eta^{uv} - f l^u l^v,
+// with p_t = -1 fixed and state (x, y, z, p_x, p_y, p_z). The spin axis is
+// the scene y axis, so the chart is the scene rotated by (x,y,z)->(z,x,y).
+// Massive particles follow the same flow with their own energy E = -p_t.
+struct KerrMetric {
+  static constexpr int Dim = 6;
+  double rs;
+  double a;
+
+  explicit KerrMetric(const BlackHole &bh)
+      : rs(bh.sceneRadius()), a(bh.spin * 0.5 * bh.sceneRadius()) {}
+
+  double horizon() const {
+    double m = 0.5 * rs;
+    return m + std::sqrt(std::fmax(m * m - a * a, 0.0));
+  }
+  double scale() const { return rs; }
+  double massRadius() const { return rs; }
+
+  // Boyer-Lindquist r of a Kerr-Schild point
+  template <class R> R blRadius(R x, R y, R z) const {
+    using std::sqrt;
+    R a2 = R(a * a);
+    R w = x * x + y * y + z * z - a2;
+    return sqrt(R(0.5) * (w + sqrt(w * w + R(4) * a2 * z * z)));
+  }
+
+  // f and the spatial part of l for the point (x, y, z)
+  template <class R>
+  void field(R x, R y, R z, R &r, R &f, R &lx, R &ly, R &lz) const {
+    R a_ = R(a);
+    r = blRadius(x, y, z);
+    R r2 = r * r;
+    R s = r2 + a_ * a_;
+    f = R(rs) * r2 * r / (r2 * r2 + a_ * a_ * z * z);
+    lx = (r * x + a_ * y) / s;
+    ly = (r * y - a_ * x) / s;
+    lz = z / r;
+  }
+
+  template <class R> void init(const R pos[3], const R dir[3], R y[]) const {
+    using std::sqrt;
+    R x = pos[2], yy = pos[0], z = pos[1];
+    R dx = dir[2], dyy = dir[0], dz = dir[1];
+    R r, f, lx, ly, lz;
+    field(x, yy, z, r, f, lx, ly, lz);
+
+    // p = lambda * dir with lambda fixed by the null condition H = 0
+    R k = lx * dx + ly * dyy + lz * dz;
+    R qa = R(1) - f * k * k;
+    R qb = f * k;
+    R lambda = (qb + sqrt(qb * qb + qa * (R(1) + f))) / qa;
+
+    y[0] = x;
+    y[1] = yy;
+    y[2] = z;
+    y[3] = lambda * dx;
+    y[4] = lambda * dyy;
+    y[5] = lambda * dz;
+  }
+
+  template <class R> void rhs(const R y[], R dy[]) const {
+    particleRhs(y, R(1), dy);
+  }
+
+  template <class R> void particleRhs(const R y[], R energy, R dy[]) const {
+    R x = y[0], yy = y[1], z = y[2];
+    R px = y[3], py = y[4], pz = y[5];
+    R a_ = R(a), a2 = a_ * a_;
+
+    R r, f, lx, ly, lz;
+    field(x, yy, z, r, f, lx, ly, lz);
+    R r2 = r * r;
+    R s = r2 + a2;
+    R q = r2 * r2 + a2 * z * z;
+    R L = energy + lx * px + ly * py + lz * pz;
+
+    dy[0] = px - f * L * lx;
+    dy[1] = py - f * L * ly;
+    dy[2] = pz - f * L * lz;
+
+    // gradient of r from r^4 - (rho^2 - a^2) r^2 - a^2 z^2 = 0
+    R D = R(2) * r2 - (x * x + yy * yy + z * z) + a2;
+    R rx = x * r / D;
+    R ry = yy * r / D;
+    R rz = z * s / (r * D);
+
+    R fr = R(rs) * r2 * (R(3) * q - R(4) * r2 * r2) / (q * q);
+    R fz = R(-2.0 * rs) * r2 * r * a2 * z / (q * q);
+
+    // dL/dx_k = C dr/dx_k + explicit terms
+    R C = (px * x + py * yy) / s - R(2) * r / s * (px * lx + py * ly) -
+          pz * lz / r;
+    R Lx = C * rx + (px * r - py * a_) / s;
+    R Ly = C * ry + (px * a_ + py * r) / s;
+    R Lz = C * rz + pz / r;
+
+    R half = R(0.5) * L * L;
+    R fl = f * L;
+    dy[3] = half * fr * rx + fl * Lx;
+    dy[4] = half * fr * ry + fl * Ly;
+    dy[5] = half * (fr * rz + fz) + fl * Lz;
+  }
+
+  template <class R> R radius(const R y[]) const {
+    return blRadius(y[0], y[1], y[2]);
+  }
+
+  template <class R> void position(const R y[], R p[3]) const {
+    p[0] = y[1];
+    p[1] = y[2];
+    p[2] = y[0];
+  }
+
+  template <class R> void direction(const R y[], R d[3]) const {
+    R r, f, lx, ly, lz;
+    field(y[0], y[1], y[2], r, f, lx, ly, lz);
+    R L = R(1) + lx * y[3] + ly * y[4] + lz * y[5];
+    d[0] = y[4] - f * L * ly;
+    d[1] = y[5] - f * L * lz;
+    d[2] = y[3] - f * L * lx;
+  }
+
+  template <class R> R stepFactor(const R[]) const { return R(1); }
+};
@@ -1,15 +1,39 @@
+#pragma once
+
+#include "metric_types_gen.hpp"
+
 #include <glm/glm.hpp>
 
 constexpr double G = 6.6743e-11;
 constexpr double c = 299792458.0;
 
+// Spacetime used to trace light around a hole. Auto picks flat, Schwarzschild
+// or Kerr from mass and spin; the rest are generated from metrics/*.metric.
+enum class MetricType {
+  Auto,
+  Flat,
+  Schwarzschild,
+  Kerr,
+#define BLACKHOLE_METRIC_TYPE(N, name) N,
+  BLACKHOLE_GENERATED_METRIC_TYPES(BLACKHOLE_METRIC_TYPE)
+#undef BLACKHOLE_METRIC_TYPE
+};
+
+// scene units per meter; everything drawn or traced lives in scene units
+constexpr double metersToScene = 1e-4;
+
 struct BlackHole {
   glm::vec3 position;
   double mass;
   double r_s;
+  double spin;         // dimensionless a/M, 0 for Schwarzschild
+  double charge = 0.0; // dimensionless Q/M
+  MetricType metric = MetricType::Auto;
+
+  BlackHole(glm::vec3 pos, double m, double a = 0.0)
+      : position(pos), mass(m), r_s((2.0 * G * m) / (c * c)), spin(a) {}
 
-  BlackHole(glm::vec3 pos, double m)
-      : position(pos), mass(m), r_s((2.0 * G * m) / (c * c)) {}
+  float sceneRadius() const { return (float)(r_s * metersToScene); }
 
   void draw();
 };
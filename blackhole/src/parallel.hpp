@@ -0,0 +1,36 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+inline int workerCount() {
+  unsigned n = std::thread::hardware_concurrency();
+  return n ? (int)n : 4;
+}
+
+// Calls fn(i) for every i in [0, n) across all cores. Indices are handed
+// out `chunk` at a time from a shared counter, so uneven work balances out.
+template <class Fn> void parallelFor(size_t n, size_t chunk, Fn &&fn) {
+  std::atomic<size_t> next{0};
+  auto worker = [&] {
+    for (;;) {
+      size_t begin = next.fetch_add(chunk);
+      if (begin >= n)
+        return;
+      size_t end = std::min(n, begin + chunk);
+      for (size_t i = begin; i < end; i++)
+        fn(i);
+    }
+  };
+
+  size_t threads = std::min<size_t>(workerCount(), (n + chunk - 1) / chunk);
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads; t++)
+    pool.emplace_back(worker);
+  worker();
+  for (std::thread &t : pool)
+    t.join();
+}
@@ -0,0 +1,119 @@
+#include "particle_renderer.hpp"
+#include "shader.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+
+void ParticleRenderer::init(size_t maxParticles) {
+  const char *vs = R"(
+    #version 330 core
+    layout (location = 0) in vec4 aParticle; // xyz, r / r_s
+
+    uniform mat4 uMVP;
+    uniform float uPointSize;
+
+    out float vRadius;
+
+    void main() {
+      vRadius = aParticle.w;
+      gl_Position = uMVP * vec4(aParticle.xyz, 1.0);
+      gl_PointSize = max(uPointSize / gl_Position.w, 1.0);
+    }
+  )";
+
+  const char *fs = R"(
+    #version 330 core
+    in float vRadius;
+    out vec4 FragColor;
+
+    void main() {
+      vec2 p = gl_PointCoord * 2.0 - 1.0;
+      float fade = max(1.0 - dot(p, p), 0.0);
+      // hot and blue near the ISCO, cooling to red further out
+      float t = clamp((vRadius - 3.0) / 12.0, 0.0, 1.0);
+      vec3 color = mix(vec3(0.8, 0.9, 1.0), vec3(1.0, 0.35, 0.1), t);
+      FragColor = vec4(color * fade * 0.6, 1.0);
+    }
+  )";
+
+  program = makeProgram(vs, fs);
+  capacity = maxParticles;
+  persistent = GLAD_GL_VERSION_4_4;
+
+  glGenVertexArrays(1, &vao);
+  glGenBuffers(1, &vbo);
+  glBindVertexArray(vao);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+  GLsizeiptr bytes = (GLsizeiptr)(capacity * 4 * sizeof(float));
+  if (persistent) {
+    GLbitfield flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_ARRAY_BUFFER, Regions * bytes, nullptr, flags);
+    mapped = (float *)glMapBufferRange(GL_ARRAY_BUFFER, 0, Regions * bytes,
+                                       flags);
+  } else {
+    glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    staging.resize(capacity * 4);
+  }
+
+  glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float),
+                        (void *)0);
+  glEnableVertexAttribArray(0);
+  glBindVertexArray(0);
+}
+
+float *ParticleRenderer::beginFrame(size_t count) {
+  if (count > capacity)
+    return nullptr;
+  if (!persistent)
+    return staging.data();
+
+  region = (region + 1) % Regions;
+  if (fences[region]) {
+    // normally signalled long ago; only a GPU two frames behind stalls here
+    glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT,
+                     1000000000);
+    glDeleteSync(fences[region]);
+    fences[region] = nullptr;
+  }
+  return mapped + (size_t)region * capacity * 4;
+}
+
+void ParticleRenderer::draw(const glm::mat4 &mvp, size_t count,
+                            float pointSize) {
+  count = std::min(count, capacity);
+  if (count == 0)
+    return;
+
+  GLint first = 0;
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  if (persistent)
+    first = (GLint)((size_t)region * capacity);
+  else
+    glBufferSubData(GL_ARRAY_BUFFER, 0,
+                    (GLsizeiptr)(count * 4 * sizeof(float)), staging.data());
+
+  glUseProgram(program);
+  glUniformMatrix4fv(glGetUniformLocation(program, "uMVP"), 1, GL_FALSE,
+                     glm::value_ptr(mvp));
+  glUniform1f(glGetUniformLocation(program, "uPointSize"), pointSize * 5.0f);
+
+  // additive, unsorted: the sprites glow over the scene without depth writes
+  glEnable(GL_PROGRAM_POINT_SIZE);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE);
+  glDepthMask(GL_FALSE);
+
+  glBindVertexArray(vao);
+  glDrawArrays(GL_POINTS, first, (GLsizei)count);
+  glBindVertexArray(0);
+
+  glDepthMask(GL_TRUE);
+  glDisable(GL_BLEND);
+  glDisable(GL_PROGRAM_POINT_SIZE);
+
+  if (persistent)
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
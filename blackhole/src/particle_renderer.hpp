@@ -0,0 +1,37 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+// Draws test particles as round point sprites, coloured by r / r_s. On GL
+// 4.4 contexts the vertices stream through a persistently mapped buffer cut
+// into three regions, so the CPU fills one while the GPU still reads the
+// others and a fence per region replaces the implicit sync of
+// glBufferSubData; older contexts upload from a staging copy instead.
+struct ParticleRenderer {
+  static constexpr int Regions = 3;
+
+  GLuint program = 0;
+  GLuint vao = 0;
+  GLuint vbo = 0;
+  size_t capacity = 0; // particles per region
+  bool persistent = false;
+
+  void init(size_t maxParticles);
+
+  // Space for `count` particles (4 floats each: xyz, r / r_s) to fill
+  // before draw(); waits for the GPU only if it still reads this region.
+  // Null when count exceeds the capacity given to init().
+  float *beginFrame(size_t count);
+  void draw(const glm::mat4 &mvp, size_t count, float pointSize = 2.0f);
+
+private:
+  float *mapped = nullptr;
+  std::vector<float> staging;
+  GLsync fences[Regions] = {};
+  int region = 0;
+};
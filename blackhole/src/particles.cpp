@@ -0,0 +1,229 @@
+#include "particles.hpp"
+#include "metric.hpp"
+#include "parallel.hpp"
+#include "random.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+// particles per task; one chunk's RK4 scratch stays in L1
+static constexpr size_t Chunk = 256;
+
+ParticleSystem::ParticleSystem(const BlackHole &bh)
+    : hole(bh), kerr(bh.metric == MetricType::Kerr ||
+                     (bh.metric == MetricType::Auto && bh.spin != 0.0)) {}
+
+// ---------------- Seeding ----------------
+void ParticleSystem::seedDisk(size_t n, float inner, float outer,
+                              uint32_t seed) {
+  const float rs = hole.sceneRadius();
+  KerrMetric metric(hole);
+  CounterRng rng(seed, RandomStream::Disk);
+
+  for (int k = 0; k < 6; k++)
+    state[k].resize(count + n);
+  energy.resize(count + n);
+
+  // each particle's numbers are keyed by its index, so the disk does not
+  // depend on how the chunks fall on threads
+  const size_t first = count;
+  parallelFor((n + Chunk - 1) / Chunk, 1, [&](size_t c) {
+    size_t begin = first + c * Chunk, m = std::min(Chunk, first + n - begin);
+    uint32_t bits[2][4 * Chunk];
+    for (uint32_t draw = 0; draw < 2; draw++)
+      rng.fill((uint32_t)begin, m, 0, 0, draw, bits[draw]);
+
+    for (size_t j = 0; j < m; j++) {
+      size_t i = begin + j;
+      const uint32_t *a = &bits[0][4 * j], *b = &bits[1][4 * j];
+      float jitter[4];
+      philox::normal(philox::unit(a[2]), philox::unit(a[3]), jitter[0],
+                     jitter[1]);
+      philox::normal(philox::unit(b[0]), philox::unit(b[1]), jitter[2],
+                     jitter[3]);
+
+      // uniform in area, rotating from scene z towards scene x
+      float r = rs * std::sqrt(inner * inner + philox::unit(a[0]) *
+                                                   (outer * outer -
+                                                    inner * inner));
+      float phi = 6.2831853f * philox::unit(a[1]);
+      float p[3] = {r * std::sin(phi), 0.01f * r * jitter[0],
+                    r * std::cos(phi)};
+      float t[3] = {std::cos(phi), 0.0f, -std::sin(phi)};
+      float spread = 1.0f + 0.03f * jitter[1];
+      float tilt = 0.02f * jitter[2];
+
+      if (!kerr) {
+        // circular speed against proper time: h^2 = M r / (1 - 3 M / r)
+        float v = spread * std::sqrt(0.5f * rs / (r - 1.5f * rs));
+        float vel[3] = {v * t[0], v * tilt, v * t[2]};
+        for (int k = 0; k < 3; k++) {
+          state[k][i] = p[k];
+          state[3 + k][i] = vel[k];
+        }
+        energy[i] = 1.0f;
+        continue;
+      }
+
+      // Kepler speed against coordinate time, lifted to a unit 4-velocity
+      // u = u^t (1, v) and lowered with g = eta + f k k, k = (1, l)
+      float v = spread * std::sqrt(0.5f * rs / r);
+      double x[3] = {p[2], p[0], p[1]};
+      double w[3] = {v * t[2], v * t[0], v * tilt};
+      double rb, f, l[3];
+      metric.field(x[0], x[1], x[2], rb, f, l[0], l[1], l[2]);
+      double lv = l[0] * w[0] + l[1] * w[1] + l[2] * w[2];
+      double w2 = w[0] * w[0] + w[1] * w[1] + w[2] * w[2];
+      double ut = 1.0 / std::sqrt(1.0 - w2 - f * (1.0 + lv) * (1.0 + lv));
+      for (int k = 0; k < 3; k++) {
+        state[k][i] = (float)x[k];
+        state[3 + k][i] = (float)(ut * (w[k] + f * l[k] * (1.0 + lv)));
+      }
+      energy[i] = (float)(ut * (1.0 - f * (1.0 + lv)));
+    }
+  });
+  count += n;
+}
+
+// ---------------- Integration ----------------
+// Right-hand side for n particles of a chunk; the loop body inlines the
+// metric so the compiler can run it across SIMD lanes.
+template <class Metric>
+static void evalChunk(const Metric &metric, const float (&y)[6][Chunk],
+                      const float *energy, size_t n, float (&dy)[6][Chunk]) {
+  for (size_t i = 0; i < n; i++) {
+    float s[6], d[6];
+    for (int k = 0; k < 6; k++)
+      s[k] = y[k][i];
+    metric.particleRhs(s, energy[i], d);
+    for (int k = 0; k < 6; k++)
+      dy[k][i] = d[k];
+  }
+}
+
+template <class Metric>
+static void advanceChunk(const Metric &metric, ParticleSystem &ps,
+                         size_t begin, size_t n, float h, int substeps) {
+  float y[6][Chunk], t[6][Chunk], k[6][Chunk], sum[6][Chunk];
+  const float *e = ps.energy.data() + begin;
+  for (int c = 0; c < 6; c++)
+    for (size_t i = 0; i < n; i++)
+      y[c][i] = ps.state[c][begin + i];
+
+  for (int step = 0; step < substeps; step++) {
+    evalChunk(metric, y, e, n, k);
+    for (int c = 0; c < 6; c++)
+      for (size_t i = 0; i < n; i++) {
+        sum[c][i] = k[c][i];
+        t[c][i] = y[c][i] + 0.5f * h * k[c][i];
+      }
+    evalChunk(metric, t, e, n, k);
+    for (int c = 0; c < 6; c++)
+      for (size_t i = 0; i < n; i++) {
+        sum[c][i] += 2.0f * k[c][i];
+        t[c][i] = y[c][i] + 0.5f * h * k[c][i];
+      }
+    evalChunk(metric, t, e, n, k);
+    for (int c = 0; c < 6; c++)
+      for (size_t i = 0; i < n; i++) {
+        sum[c][i] += 2.0f * k[c][i];
+        t[c][i] = y[c][i] + h * k[c][i];
+      }
+    evalChunk(metric, t, e, n, k);
+    for (int c = 0; c < 6; c++)
+      for (size_t i = 0; i < n; i++)
+        y[c][i] += h / 6.0f * (sum[c][i] + k[c][i]);
+  }
+
+  for (int c = 0; c < 6; c++)
+    for (size_t i = 0; i < n; i++)
+      ps.state[c][begin + i] = y[c][i];
+}
+
+void ParticleSystem::advance(float dt, int substeps) {
+  float h = dt / (float)substeps;
+  size_t chunks = (count + Chunk - 1) / Chunk;
+  auto run = [&](const auto &metric) {
+    parallelFor(chunks, 4, [&](size_t c) {
+      size_t begin = c * Chunk;
+      size_t n = std::min(Chunk, count - begin);
+      advanceChunk(metric, *this, begin, n, h, substeps);
+    });
+  };
+  if (kerr)
+    run(KerrMetric(hole));
+  else
+    run(SchwarzschildMetric(hole));
+}
+
+// ---------------- Compaction ----------------
+size_t ParticleSystem::compact() {
+  KerrMetric metric(hole);
+  const float rs = hole.sceneRadius();
+  const float inner = 1.05f * (float)metric.horizon();
+  const float outer = escapeRadius * rs;
+
+  size_t kept = 0;
+  for (size_t i = 0; i < count; i++) {
+    float x = state[0][i], y = state[1][i], z = state[2][i];
+    float r = kerr ? metric.blRadius(x, y, z)
+                   : std::sqrt(x * x + y * y + z * z);
+    if (!(r > inner && r < outer))
+      continue;
+    if (kept != i) {
+      for (int k = 0; k < 6; k++)
+        state[k][kept] = state[k][i];
+      energy[kept] = energy[i];
+    }
+    kept++;
+  }
+
+  size_t removed = count - kept;
+  count = kept;
+  for (int k = 0; k < 6; k++)
+    state[k].resize(count);
+  energy.resize(count);
+  return removed;
+}
+
+void ParticleSystem::writeVertices(float *out) const {
+  const float rs = hole.sceneRadius();
+  const glm::vec3 c = hole.position;
+  // Kerr-Schild axes are the scene's rotated by (x,y,z)->(z,x,y)
+  const int ix = kerr ? 1 : 0, iy = kerr ? 2 : 1, iz = kerr ? 0 : 2;
+  parallelFor((count + Chunk - 1) / Chunk, 16, [&](size_t chunk) {
+    size_t end = std::min(count, (chunk + 1) * Chunk);
+    for (size_t i = chunk * Chunk; i < end; i++) {
+      float x = state[ix][i], y = state[iy][i], z = state[iz][i];
+      out[4 * i + 0] = c.x + x;
+      out[4 * i + 1] = c.y + y;
+      out[4 * i + 2] = c.z + z;
+      out[4 * i + 3] = std::sqrt(x * x + y * y + z * z) / rs;
+    }
+  });
+}
+
+// ---------------- Checkpoints ----------------
+void ParticleSystem::save(Checkpoint &out) const {
+  for (int k = 0; k < 6; k++)
+    out.put("particles.state." + std::to_string(k), state[k]);
+  out.put("particles.energy", energy);
+  out.putValue("particles.count", (uint64_t)count);
+}
+
+bool ParticleSystem::restore(const Checkpoint &in, size_t capacity) {
+  uint64_t n = 0;
+  long size = in.count<float>("particles.energy");
+  bool ok = in.getValue("particles.count", n) && size >= (long)n &&
+            n <= capacity;
+  for (int k = 0; k < 6; k++)
+    ok = ok && in.count<float>("particles.state." + std::to_string(k)) == size;
+  if (!ok)
+    return false;
+  for (int k = 0; k < 6; k++)
+    in.get("particles.state." + std::to_string(k), state[k]);
+  in.get("particles.energy", energy);
+  count = (size_t)n;
+  return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "checkpoint.hpp"
+#include "objects.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// ---------------- Test particles ----------------
+// Massive test particles on timelike geodesics around one hole, kept as
+// structure-of-arrays so the integrator's inner loops run across particles
+// in SIMD lanes while chunks of particles go to worker threads. The state
+// follows the hole's metric (see metric.hpp): Schwarzschild particles carry
+// (x, dx/dtau) in scene axes, Kerr particles Kerr-Schild (x, p_i) and their
+// energy -p_t. Positions are relative to the hole, in scene units.
+struct ParticleSystem {
+  BlackHole hole;
+  bool kerr = false;
+  float escapeRadius = 100.0f; // r_s; particles beyond it are dropped
+
+  std::vector<float> state[6];
+  std::vector<float> energy;
+  size_t count = 0;
+
+  explicit ParticleSystem(const BlackHole &bh);
+
+  // Appends n particles on near-circular prograde orbits between inner and
+  // outer (in r_s) in a thin disk around the hole's y = 0 plane.
+  void seedDisk(size_t n, float inner, float outer, uint32_t seed);
+
+  // Advances every particle by proper time dt in `substeps` RK4 steps.
+  void advance(float dt, int substeps);
+
+  // Drops particles that plunged through the horizon or escaped, moving the
+  // survivors down in place; returns how many were removed.
+  size_t compact();
+
+  // Scene-space position and r / r_s of every particle, 4 floats each.
+  void writeVertices(float *out) const;
+
+  // State as "particles.*" sections, for a system around the same hole.
+  // restore() refuses more than `capacity` particles, the most the caller
+  // has room to draw.
+  void save(Checkpoint &out) const;
+  bool restore(const Checkpoint &in, size_t capacity);
+};
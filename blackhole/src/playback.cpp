@@ -0,0 +1,261 @@
+#include "playback.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+static const double Lookahead = 1.0;         // wall-clock seconds paged in
+static const uint64_t Budget = 256ull << 20; // most bytes kept paged in
+
+SnapshotPlayer::~SnapshotPlayer() { close(); }
+
+bool SnapshotPlayer::open(const std::string &path) {
+  close();
+  if (TrajectoryReader::recognizes(path)) {
+    if (!track.open(path))
+      return false;
+    if (!track.frames()) {
+      std::cerr << "Trajectory '" << path << "' has no frames\n";
+      track.close();
+      return false;
+    }
+    decoded = false;
+    return true;
+  }
+  if (!reader.open(path))
+    return false;
+  if (!reader.frames()) {
+    std::cerr << "Snapshot run '" << path << "' has no frames\n";
+    reader.close();
+    return false;
+  }
+  pairFrom = SIZE_MAX;
+  wantFirst = 1;
+  wantLast = 0;
+  changed = stopping = false;
+  thread = std::thread([this] { run(); });
+  return true;
+}
+
+void SnapshotPlayer::close() {
+  if (thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    thread.join();
+  }
+  reader.close();
+  track.close();
+}
+
+double SnapshotPlayer::startTime() const {
+  return track.frames() ? track.time(0) : reader.time(0);
+}
+
+double SnapshotPlayer::endTime() const {
+  return track.frames() ? track.time(track.frames() - 1)
+                        : reader.time(reader.frames() - 1);
+}
+
+// ---------------- Prefetch ----------------
+// Frames from the current one to where `rate` takes playback within the
+// lookahead, always including the next frame the interpolation reads.
+void SnapshotPlayer::aim(size_t a, double t, double rate) {
+  size_t n = reader.frames();
+  size_t first = a, last = std::min(a + 1, n - 1);
+  uint64_t bytes = reader.bytes(first);
+  if (last > first)
+    bytes += reader.bytes(last);
+  double horizon = t + rate * Lookahead;
+  if (rate >= 0.0)
+    while (last + 1 < n && reader.time(last) < horizon &&
+           bytes + reader.bytes(last + 1) <= Budget)
+      bytes += reader.bytes(++last);
+  else
+    while (first > 0 && reader.time(first) > horizon &&
+           bytes + reader.bytes(first - 1) <= Budget)
+      bytes += reader.bytes(--first);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (first == wantFirst && last == wantLast)
+    return;
+  wantFirst = first;
+  wantLast = last;
+  changed = true;
+  wake.notify_all();
+}
+
+void SnapshotPlayer::run() {
+  size_t heldFirst = 1, heldLast = 0; // empty
+  for (;;) {
+    std::unique_lock<std::mutex> lock(mutex);
+    wake.wait(lock, [&] { return changed || stopping; });
+    if (stopping)
+      return;
+    size_t first = wantFirst, last = wantLast;
+    changed = false;
+    lock.unlock();
+
+    for (size_t k = heldFirst; k <= heldLast; k++)
+      if (k < first || k > last)
+        reader.release(k);
+    for (size_t k = first; k <= last; k++)
+      if (k < heldFirst || k > heldLast)
+        reader.prefetch(k);
+    heldFirst = first;
+    heldLast = last;
+  }
+}
+
+// ---------------- Interpolation ----------------
+// Bodies keep their ids but not their slots from one frame to the next, so
+// pair them up by id unless the two frames list the same ids in the same
+// order, as they do between mergers.
+void SnapshotPlayer::matchFrames(size_t a) {
+  if (pairFrom == a)
+    return;
+  pairFrom = a;
+  SnapshotFrame fa = reader.frame(a), fb = reader.frame(a + 1);
+  match.resize(fa.count);
+  if (fa.count == fb.count &&
+      std::memcmp(fa.ids, fb.ids, fa.count * sizeof(uint32_t)) == 0) {
+    for (size_t i = 0; i < fa.count; i++)
+      match[i] = (uint32_t)i;
+    return;
+  }
+  uint32_t top = 0;
+  for (size_t j = 0; j < fb.count; j++)
+    top = std::max(top, fb.ids[j] + 1);
+  slotOf.assign(top, BodySystem::None);
+  for (size_t j = 0; j < fb.count; j++)
+    slotOf[fb.ids[j]] = (uint32_t)j;
+  for (size_t i = 0; i < fa.count; i++)
+    match[i] = fa.ids[i] < top ? slotOf[fa.ids[i]] : BodySystem::None;
+}
+
+void SnapshotPlayer::sample(double t, double rate, BodySystem &out) {
+  t = std::min(std::max(t, startTime()), endTime());
+  if (track.frames()) {
+    sampleTrack(t, out);
+    return;
+  }
+  size_t a = reader.find(t);
+  aim(a, t, rate);
+
+  SnapshotFrame fa = reader.frame(a);
+  size_t n = fa.count;
+  out.ids.assign(fa.ids, fa.ids + n);
+  out.mass.assign(fa.mass, fa.mass + n);
+  out.spin.assign(fa.spin, fa.spin + n);
+  uint32_t top = 0;
+  for (size_t i = 0; i < n; i++)
+    top = std::max(top, fa.ids[i] + 1);
+  out.index.assign(top, BodySystem::None);
+  for (size_t i = 0; i < n; i++)
+    out.index[fa.ids[i]] = (uint32_t)i;
+
+  if (a + 1 == reader.frames() || t <= fa.time) {
+    for (int k = 0; k < 3; k++) {
+      out.pos[k].assign(fa.pos[k], fa.pos[k] + n);
+      out.vel[k].assign(fa.vel[k], fa.vel[k] + n);
+    }
+    return;
+  }
+
+  SnapshotFrame fb = reader.frame(a + 1);
+  matchFrames(a);
+  for (int k = 0; k < 3; k++) {
+    out.pos[k].resize(n);
+    out.vel[k].resize(n);
+  }
+  // cubic Hermite basis on s in [0, 1] and its derivative
+  double h = fb.time - fa.time, s = (t - fa.time) / h, u = 1.0 - s;
+  double p0 = (1.0 + 2.0 * s) * u * u, m0 = s * u * u * h;
+  double p1 = s * s * (3.0 - 2.0 * s), m1 = -s * s * u * h;
+  double dp = 6.0 * s * u / h, dm0 = u * (1.0 - 3.0 * s);
+  double dm1 = s * (3.0 * s - 2.0);
+  double dt = t - fa.time;
+  parallelFor(n, 4096, [&](size_t i) {
+    uint32_t j = match[i];
+    for (int k = 0; k < 3; k++) {
+      double xa = fa.pos[k][i], va = fa.vel[k][i];
+      if (j == BodySystem::None) {
+        // merges before the next frame: coast until it does
+        out.pos[k][i] = xa + va * dt;
+        out.vel[k][i] = va;
+        continue;
+      }
+      double xb = fb.pos[k][j], vb = fb.vel[k][j];
+      out.pos[k][i] = p0 * xa + m0 * va + p1 * xb + m1 * vb;
+      out.vel[k][i] = dp * (xb - xa) + dm0 * va + dm1 * vb;
+    }
+  });
+}
+
+// ---------------- Trajectories ----------------
+// Brings `early` and `late` around t: the frames at and after it, or the
+// last frame twice at the end of the file.
+bool SnapshotPlayer::decode(double t) {
+  if (!decoded || t < early.time || track.keyTime(t) > late.time) {
+    decoded = track.seek(t) && track.next(early);
+    if (!decoded)
+      return false;
+    ended = !track.next(late);
+    if (ended)
+      late = early;
+  }
+  while (!ended && t >= late.time) {
+    std::swap(early, late);
+    ended = !track.next(late);
+    if (ended)
+      late = early;
+  }
+  return true;
+}
+
+void SnapshotPlayer::sampleTrack(double t, BodySystem &out) {
+  if (!decode(t))
+    return; // keep the last bodies sampled
+  size_t n = early.ids.size();
+  out.ids = early.ids;
+  out.mass = early.mass;
+  out.spin = early.spin;
+  uint32_t top = n ? early.ids.back() + 1 : 0; // frames are in id order
+  out.index.assign(top, BodySystem::None);
+  for (size_t i = 0; i < n; i++)
+    out.index[early.ids[i]] = (uint32_t)i;
+
+  // both frames are in id order, so survivors pair up in one pass
+  match.assign(n, BodySystem::None);
+  for (size_t i = 0, j = 0; i < n; i++) {
+    while (j < late.ids.size() && late.ids[j] < early.ids[i])
+      j++;
+    if (j < late.ids.size() && late.ids[j] == early.ids[i])
+      match[i] = (uint32_t)j;
+  }
+  double h = late.time - early.time;
+  double s = h > 0.0 ? std::min(std::max((t - early.time) / h, 0.0), 1.0)
+                     : 0.0;
+  for (int k = 0; k < 3; k++) {
+    out.pos[k].resize(n);
+    out.vel[k].resize(n);
+  }
+  parallelFor(n, 4096, [&](size_t i) {
+    uint32_t j = match[i];
+    for (int k = 0; k < 3; k++) {
+      double xa = early.pos[k][i];
+      if (j == BodySystem::None || h <= 0.0) {
+        // merges before the next frame, or the end of the run: hold still
+        out.pos[k][i] = xa;
+        out.vel[k][i] = 0.0;
+        continue;
+      }
+      double xb = late.pos[k][j];
+      out.pos[k][i] = xa + s * (xb - xa);
+      out.vel[k][i] = (xb - xa) / h;
+    }
+  });
+}
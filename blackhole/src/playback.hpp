@@ -0,0 +1,70 @@
+#pragma once
+
+#include "bodies.hpp"
+#include "snapshot.hpp"
+#include "trajectory.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ---------------- Playback ----------------
+// Plays a recorded run back at any speed, forwards or backwards, from any
+// point. The run stays mapped: a jump costs a binary search of the index
+// and touches only the two frames around the new time, however large the
+// run. Between frames each body follows the cubic through its stored
+// positions and velocities at both ends, so playback stays smooth when the
+// frames are far apart or the rate is slow. A prefetch thread pages in the
+// frames the next second of playback will reach and lets frames left
+// behind go, so the working set stays bounded on runs larger than memory.
+//
+// A compressed trajectory (see trajectory.hpp), told apart by its magic,
+// plays too. It holds positions only and is decoded in order: the player
+// keeps the two frames around the current time, steps forward through the
+// file and seeks back to a keyframe only when playback jumps backwards or
+// past the next keyframe. Bodies move in straight lines between frames,
+// with velocities from the difference, which is as smooth as the file's
+// frame rate allows.
+struct SnapshotPlayer {
+  ~SnapshotPlayer();
+
+  bool open(const std::string &path);
+  void close();
+  bool isOpen() const { return reader.frames() > 0 || track.frames() > 0; }
+
+  double startTime() const;
+  double endTime() const;
+
+  // The bodies at time t, clamped to the run. `rate` is simulated seconds
+  // per wall-clock second, negative when playing backwards; it only aims
+  // the prefetch.
+  void sample(double t, double rate, BodySystem &out);
+
+private:
+  SnapshotReader reader;
+
+  TrajectoryReader track;
+  TrajectoryFrame early, late; // around the last time sampled
+  bool decoded = false, ended = false;
+
+  // slot in frame pairFrom + 1 of each slot in frame pairFrom, None for
+  // bodies that merged in between
+  size_t pairFrom = SIZE_MAX;
+  std::vector<uint32_t> match, slotOf;
+
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable wake;
+  size_t wantFirst = 0, wantLast = 0; // frames to keep paged in
+  bool changed = false, stopping = false;
+
+  void matchFrames(size_t a);
+  void aim(size_t a, double t, double rate);
+  void run();
+  bool decode(double t);
+  void sampleTrack(double t, BodySystem &out);
+};
@@ -0,0 +1,258 @@
+#include "poster.hpp"
+#include "image_writer.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using glm::vec3;
+
+static const char Magic[8] = {'B', 'H', 'T', 'I', 'L', 'E', 'S', 0};
+static const uint32_t Version = 1;
+
+// followed by one byte per tile, 1 once it is on disk, then the tiles from
+// the first page boundary on: tile (tx, ty), ty counted from the top, is
+// tile * tile RGB floats, top row first, at index ty * tilesX + tx
+struct TileFileHeader {
+  char magic[8];
+  uint32_t version;
+  int32_t width, height, tile;
+  uint64_t scene; // fingerprint of what is rendered
+  uint8_t reserved[32];
+};
+static_assert(sizeof(TileFileHeader) == 64, "header is one cache line");
+
+// FNV-1a over everything that shapes the image, so tiles left by a
+// different scene are not resumed.
+static uint64_t fingerprint(const std::vector<BlackHole> &holes,
+                            const Camera &cam,
+                            const RenderSettings &settings) {
+  uint64_t h = 14695981039346656037ull;
+  auto mix = [&](const void *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      h ^= ((const uint8_t *)p)[i];
+      h *= 1099511628211ull;
+    }
+  };
+  for (const BlackHole &bh : holes) {
+    mix(&bh.position, sizeof bh.position);
+    mix(&bh.mass, sizeof bh.mass);
+    mix(&bh.spin, sizeof bh.spin);
+    mix(&bh.charge, sizeof bh.charge);
+    mix(&bh.metric, sizeof bh.metric);
+  }
+  mix(&cam, sizeof cam);
+  mix(&settings.precision, sizeof settings.precision);
+  // field by field: the struct's padding is not ours to hash
+  const TraceConfig &trace = settings.trace;
+  mix(&trace.maxSteps, sizeof trace.maxSteps);
+  mix(&trace.stepScale, sizeof trace.stepScale);
+  mix(&trace.escapeRadius, sizeof trace.escapeRadius);
+  mix(&trace.farField, sizeof trace.farField);
+  mix(&trace.diskInner, sizeof trace.diskInner);
+  mix(&trace.diskOuter, sizeof trace.diskOuter);
+  mix(&trace.influence, sizeof trace.influence);
+  mix(&trace.opening, sizeof trace.opening);
+  bool scene = trace.scene != nullptr;
+  mix(&scene, sizeof scene);
+  if (scene) {
+    for (const Material &m : trace.scene->materials) {
+      mix(&m.color, sizeof m.color);
+      mix(&m.emissive, sizeof m.emissive);
+    }
+    mix(trace.scene->spheres.data(),
+        trace.scene->spheres.size() * sizeof(SceneBVH::Sphere));
+    mix(trace.scene->triangles.data(),
+        trace.scene->triangles.size() * sizeof(SceneBVH::Triangle));
+  }
+  if (settings.sampler) {
+    SamplerType type = settings.sampler->type();
+    int samples = settings.sampler->samples();
+    mix(&type, sizeof type);
+    mix(&samples, sizeof samples);
+  }
+  return h;
+}
+
+bool renderPoster(const std::string &path,
+                  const std::vector<BlackHole> &holes, const Camera &cam,
+                  const RenderSettings &settings,
+                  const PosterConfig &config) {
+  const int W = settings.width, H = settings.height, T = config.tile;
+  const int tilesX = (W + T - 1) / T, tilesY = (H + T - 1) / T;
+  const size_t tiles = (size_t)tilesX * tilesY;
+  const size_t tileBytes = (size_t)T * T * sizeof(vec3);
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  const size_t dataAt =
+      (sizeof(TileFileHeader) + tiles + page - 1) / page * page;
+  const size_t fileBytes = dataAt + tiles * tileBytes;
+
+  TileFileHeader header{};
+  std::memcpy(header.magic, Magic, 8);
+  header.version = Version;
+  header.width = W;
+  header.height = H;
+  header.tile = T;
+  header.scene = fingerprint(holes, cam, settings);
+
+  // ---------------- Tile file ----------------
+  std::string tilesPath = path + ".tiles";
+  int fd = ::open(tilesPath.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    std::cerr << "Cannot open '" << tilesPath << "': " << std::strerror(errno)
+              << "\n";
+    return false;
+  }
+  TileFileHeader found{};
+  struct stat st;
+  bool reuse = config.resume && fstat(fd, &st) == 0 &&
+               (size_t)st.st_size == fileBytes &&
+               pread(fd, &found, sizeof found, 0) == (ssize_t)sizeof found &&
+               std::memcmp(&found, &header, sizeof header) == 0;
+  if (config.resume && !reuse)
+    std::cerr << "No matching tiles in '" << tilesPath
+              << "', starting the poster over\n";
+  // sparse: blocks only get allocated as tiles are written
+  if (!reuse && (ftruncate(fd, 0) != 0 ||
+                 ftruncate(fd, (off_t)fileBytes) != 0 ||
+                 pwrite(fd, &header, sizeof header, 0) !=
+                     (ssize_t)sizeof header)) {
+    std::cerr << "Cannot size '" << tilesPath << "': " << std::strerror(errno)
+              << "\n";
+    ::close(fd);
+    return false;
+  }
+  void *mapping =
+      mmap(nullptr, fileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    std::cerr << "Cannot map '" << tilesPath << "': " << std::strerror(errno)
+              << "\n";
+    return false;
+  }
+  uint8_t *base = (uint8_t *)mapping;
+  uint8_t *done = base + sizeof(TileFileHeader);
+  auto tileData = [&](size_t t) {
+    return (vec3 *)(base + dataAt + t * tileBytes);
+  };
+
+  // ---------------- Schedule ----------------
+  double rsTotal = 0.0;
+  glm::dvec3 centre(0.0);
+  for (const BlackHole &bh : holes) {
+    centre += glm::dvec3(bh.position) * bh.r_s;
+    rsTotal += bh.r_s;
+  }
+  vec3 toCentre = glm::normalize(vec3(centre / rsTotal) - cam.position);
+  std::vector<std::pair<float, uint32_t>> pending;
+  for (size_t t = 0; t < tiles; t++) {
+    if (done[t])
+      continue;
+    float u = ((float)((t % tilesX) * T) + 0.5f * T) / W * 2.0f - 1.0f;
+    float v = 1.0f - ((float)((t / tilesX) * T) + 0.5f * T) / H * 2.0f;
+    pending.push_back({1.0f - glm::dot(cam.rayDir(u, v), toCentre),
+                       (uint32_t)t});
+  }
+  std::sort(pending.begin(), pending.end());
+  if (pending.size() < tiles)
+    std::cout << "resuming with " << tiles - pending.size() << " of "
+              << tiles << " tiles done\n";
+
+  // the tiles' pages count too until they are dropped
+  size_t perTile =
+      (size_t)T * T * (renderBytesPerPixel(settings) + sizeof(vec3));
+  size_t perBlock = std::max<size_t>(1, config.memoryBudget / perTile);
+  auto start = std::chrono::steady_clock::now();
+  std::vector<PixelRect> rects;
+  std::vector<vec3> pixels;
+  size_t reported = 0;
+  for (size_t first = 0; first < pending.size(); first += perBlock) {
+    size_t count = std::min(perBlock, pending.size() - first);
+    rects.clear();
+    for (size_t k = first; k < first + count; k++) {
+      int tx = (int)(pending[k].second % tilesX);
+      int ty = (int)(pending[k].second / tilesX);
+      int tw = std::min(T, W - tx * T), th = std::min(T, H - ty * T);
+      rects.push_back({tx * T, H - ty * T - th, tw, th});
+    }
+    renderRects(holes, cam, settings, rects, pixels);
+
+    size_t at = 0;
+    for (size_t k = 0; k < count; k++) {
+      const PixelRect &r = rects[k];
+      vec3 *dst = tileData(pending[first + k].second);
+      for (int row = 0; row < r.h; row++) // bottom row first in `pixels`
+        std::memcpy(dst + (size_t)(r.h - 1 - row) * T,
+                    &pixels[at + (size_t)row * r.w], r.w * sizeof(vec3));
+      at += (size_t)r.w * r.h;
+    }
+    // on disk before the bitmap says so, then out of memory
+    parallelFor(count, 16, [&](size_t k) {
+      uint8_t *p = (uint8_t *)tileData(pending[first + k].second);
+      msync(p, tileBytes, MS_SYNC);
+      madvise(p, tileBytes, MADV_DONTNEED);
+    });
+    for (size_t k = first; k < first + count; k++)
+      done[pending[k].second] = 1;
+    msync(base, dataAt, MS_ASYNC);
+
+    size_t finished = first + count;
+    if (finished * 10 / pending.size() > reported) {
+      reported = finished * 10 / pending.size();
+      std::cout << "poster " << reported * 10 << "%, "
+                << std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count()
+                << " s\n";
+    }
+  }
+
+  // ---------------- Encode ----------------
+  ImageWriter image;
+  bool ok = image.open(path, W, H, !config.fullFloat);
+  std::vector<vec3> band;
+  int released = 0; // tile rows read for the last time
+  for (int top = 0; ok && top < H; top += image.bandRows()) {
+    int rows = std::min(image.bandRows(), H - top);
+    band.resize((size_t)rows * W);
+    for (int r = 0; r < rows; r++) {
+      int y = top + r;
+      vec3 *dst = &band[(size_t)(rows - 1 - r) * W];
+      for (int tx = 0; tx < tilesX; tx++) {
+        int tw = std::min(T, W - tx * T);
+        const vec3 *src = tileData((size_t)(y / T) * tilesX + tx);
+        std::memcpy(dst + tx * T, src + (size_t)(y % T) * T,
+                    tw * sizeof(vec3));
+      }
+    }
+    ok = image.writeBand(band, rows);
+    int passed = top + rows == H ? tilesY : (top + rows) / T;
+    if (passed > released) {
+      madvise(tileData((size_t)released * tilesX),
+              (size_t)(passed - released) * tilesX * tileBytes,
+              MADV_DONTNEED);
+      released = passed;
+    }
+  }
+  ok = image.close() && ok;
+  munmap(mapping, fileBytes);
+  if (!ok)
+    return false;
+  std::remove(tilesPath.c_str());
+  std::cout << "wrote " << path << " (" << W << "x" << H << ") in "
+            << std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << " s\n";
+  return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "camera.hpp"
+#include "objects.hpp"
+#include "render.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// ---------------- Posters ----------------
+// Renders images of any size in bounded memory. The image is cut into
+// tiles, rendered into `path`.tiles: raw float tiles in a file mapped into
+// memory, behind a bitmap of the tiles already done. Each pass renders as
+// many tiles as the memory budget allows the renderer's working set, flushes
+// them to disk, drops their pages and marks them done, so a killed render
+// resumes where it stopped. Tiles are scheduled by how far their view
+// direction is from the holes' centre: a block holds tiles whose rays pass
+// the holes at similar distances, which take similar orbits through the
+// same few BVH nodes and fill the tracer's packets evenly. Once every tile
+// is done the tiles are encoded into `path` (ImageWriter) a band at a time
+// and the tile file is removed.
+struct PosterConfig {
+  size_t memoryBudget = size_t(1) << 30; // renderer working set, bytes
+  int tile = 64;                         // pixels on a side
+  bool fullFloat = false;                // 32-bit EXR channels
+  bool resume = false; // keep the done tiles of an earlier attempt
+};
+
+// Prints the reason and returns false on failure.
+bool renderPoster(const std::string &path,
+                  const std::vector<BlackHole> &holes, const Camera &cam,
+                  const RenderSettings &settings, const PosterConfig &config);
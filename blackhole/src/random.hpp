@@ -0,0 +1,122 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// ---------------- Philox 4x32-10 ----------------
+// Counter-based random numbers (Salmon et al., "Parallel random numbers:
+// as easy as 1, 2, 3"): four 32-bit words are a pure function of a 128-bit
+// counter and a 64-bit key. Nothing is carried from one draw to the next,
+// so a sample keyed by where it is used (pixel, sample, frame) comes out
+// the same whichever thread draws it and in whatever order, and can be
+// drawn again later instead of stored.
+namespace philox {
+
+using Block = std::array<uint32_t, 4>;
+
+inline void round(uint32_t (&c)[4], uint32_t k0, uint32_t k1) {
+  uint64_t a = (uint64_t)0xD2511F53u * c[0];
+  uint64_t b = (uint64_t)0xCD9E8D57u * c[2];
+  uint32_t r0 = (uint32_t)(b >> 32) ^ c[1] ^ k0;
+  uint32_t r2 = (uint32_t)(a >> 32) ^ c[3] ^ k1;
+  c[1] = (uint32_t)b;
+  c[3] = (uint32_t)a;
+  c[0] = r0;
+  c[2] = r2;
+}
+
+inline Block generate(Block counter, uint32_t k0, uint32_t k1) {
+  uint32_t c[4] = {counter[0], counter[1], counter[2], counter[3]};
+  for (int r = 0; r < 10; r++, k0 += 0x9E3779B9u, k1 += 0xBB67AE85u)
+    round(c, k0, k1);
+  return {c[0], c[1], c[2], c[3]};
+}
+
+// 24 bits to a float in (0, 1): never 0, so logs are safe, never 1.
+inline float unit(uint32_t x) {
+  return ((float)(x >> 8) + 0.5f) * (1.0f / 16777216.0f);
+}
+
+// 53 bits from two words to a double in (0, 1).
+inline double unit(uint32_t hi, uint32_t lo) {
+  uint64_t x = ((uint64_t)hi << 21) ^ (lo >> 11);
+  return ((double)x + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+// Box-Muller: two uniforms in (0, 1) to two standard normals.
+template <class T> void normal(T u1, T u2, T &a, T &b) {
+  T r = std::sqrt(T(-2) * std::log(u1));
+  T phi = T(6.283185307179586) * u2;
+  a = r * std::cos(phi);
+  b = r * std::sin(phi);
+}
+
+} // namespace philox
+
+// What the numbers are for; part of the key, so two uses with the same seed
+// never see the same numbers.
+enum class RandomStream : uint32_t { Holes, Orbits, Bodies, Disk, Pixels };
+
+// Random words at (index, sample, frame, draw) for one seed and stream.
+// `draw` numbers further blocks when a caller needs more than four words
+// at the same coordinate.
+struct CounterRng {
+  CounterRng(uint32_t seed, RandomStream stream)
+      : k0(seed), k1((uint32_t)stream) {}
+
+  philox::Block bits(uint32_t index, uint32_t sample = 0, uint32_t frame = 0,
+                     uint32_t draw = 0) const {
+    return philox::generate({index, sample, frame, draw}, k0, k1);
+  }
+
+  // Four uniforms in (0, 1) at one coordinate.
+  std::array<float, 4> uniform(uint32_t index, uint32_t sample = 0,
+                               uint32_t frame = 0, uint32_t draw = 0) const {
+    philox::Block b = bits(index, sample, frame, draw);
+    return {philox::unit(b[0]), philox::unit(b[1]), philox::unit(b[2]),
+            philox::unit(b[3])};
+  }
+
+  // Blocks for indices [first, first + n) at one (sample, frame, draw),
+  // block i in out[4i..4i+3], equal to bits(first + i, ...). Each round is
+  // a loop over Lanes counters held word by word, which the compiler runs
+  // across SIMD lanes.
+  void fill(uint32_t first, size_t n, uint32_t sample, uint32_t frame,
+            uint32_t draw, uint32_t *out) const {
+    constexpr size_t Lanes = 16;
+    for (size_t base = 0; base < n; base += Lanes) {
+      uint32_t c0[Lanes], c1[Lanes], c2[Lanes], c3[Lanes];
+      for (size_t l = 0; l < Lanes; l++) {
+        c0[l] = first + (uint32_t)(base + l);
+        c1[l] = sample;
+        c2[l] = frame;
+        c3[l] = draw;
+      }
+      uint32_t a = k0, b = k1;
+      for (int r = 0; r < 10; r++, a += 0x9E3779B9u, b += 0xBB67AE85u)
+        for (size_t l = 0; l < Lanes; l++) {
+          uint64_t p = (uint64_t)0xD2511F53u * c0[l];
+          uint64_t q = (uint64_t)0xCD9E8D57u * c2[l];
+          uint32_t r0 = (uint32_t)(q >> 32) ^ c1[l] ^ a;
+          uint32_t r2 = (uint32_t)(p >> 32) ^ c3[l] ^ b;
+          c1[l] = (uint32_t)q;
+          c3[l] = (uint32_t)p;
+          c0[l] = r0;
+          c2[l] = r2;
+        }
+      size_t lanes = n - base < Lanes ? n - base : Lanes;
+      for (size_t l = 0; l < lanes; l++) {
+        uint32_t *o = out + 4 * (base + l);
+        o[0] = c0[l];
+        o[1] = c1[l];
+        o[2] = c2[l];
+        o[3] = c3[l];
+      }
+    }
+  }
+
+private:
+  uint32_t k0, k1;
+};
@@ -0,0 +1,158 @@
+#include "render.hpp"
+#include "lensing.hpp"
+#include "parallel.hpp"
+#include "shading.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+using namespace glm;
+
+static vec3 shade(const RayHit &hit, const TraceConfig &cfg,
+                  bool differential, vec3 light) {
+  switch (hit.status) {
+  case RayStatus::Captured:
+    return vec3(0.0f);
+  case RayStatus::Surface: {
+    const Material &m = cfg.scene->materials[hit.material];
+    return surfaceColor(m.color, m.emissive, hit.normal,
+                        normalize(light - hit.point));
+  }
+  case RayStatus::Disk:
+    return diskColor(hit.diskRadius, cfg.diskInner, cfg.diskOuter);
+  default:
+    return skyColor(hit.dir, differential ? sqrtf(skyFootprint(hit)) : 0.0f);
+  }
+}
+
+// Shared by every entry point: builds the sample rays of `rects`, bins
+// them about `bh`, hands batches to trace(rays, hits, count, stats) and
+// averages each pixel's samples.
+template <class TraceBatch>
+static void renderRays(const BlackHole &bh, const Camera &cam,
+                       const RenderSettings &settings,
+                       const std::vector<PixelRect> &rects,
+                       std::vector<vec3> &pixels, TraceStats *stats,
+                       TraceBatch &&trace) {
+  const int w = settings.width, h = settings.height;
+  const PixelSampler *sampler = settings.sampler;
+  const int spp = sampler ? sampler->samples() : 1;
+  size_t n = 0;
+  for (const PixelRect &r : rects)
+    n += (size_t)r.w * r.h;
+  pixels.resize(n);
+  const size_t m = n * spp;
+
+  const bool differential = settings.precision == Precision::Differential;
+  // each sample's footprint is its share of the pixel
+  const float footprint = 1.0f / std::sqrt((float)spp);
+  std::vector<Ray> sampleRays(m);
+  Ray *ray = sampleRays.data();
+  for (const PixelRect &r : rects)
+    for (int y = r.y; y < r.y + r.h; y++)
+      for (int x = r.x; x < r.x + r.w; x++)
+        for (int s = 0; s < spp; s++, ray++) {
+          vec2 at = sampler ? sampler->offset(x, y, s) : vec2(0.5f);
+          float u = ((float)x + at.x) / w * 2.0f - 1.0f;
+          float v = ((float)y + at.y) / h * 2.0f - 1.0f;
+          ray->origin = cam.position;
+          ray->dir = cam.rayDir(u, v);
+          if (differential) {
+            // per pixel rather than per unit of u and v
+            cam.rayDirDerivatives(u, v, ray->dDir[0], ray->dDir[1]);
+            ray->dDir[0] *= 2.0f * footprint / w;
+            ray->dDir[1] *= 2.0f * footprint / h;
+          }
+        }
+
+  // trace in impact-parameter order so each packet holds similar orbits
+  std::vector<uint32_t> order;
+  binRays(bh, sampleRays.data(), m, order);
+  std::vector<Ray> rays(m);
+  for (size_t i = 0; i < m; i++)
+    rays[i] = sampleRays[order[i]];
+
+  std::vector<RayHit> hits(m);
+  std::vector<vec3> colors(m);
+  const size_t batch = settings.batchSize;
+  std::mutex statsLock;
+  parallelFor((m + batch - 1) / batch, 1, [&](size_t b) {
+    size_t begin = b * batch, count = std::min(batch, m - begin);
+    TraceStats local;
+    trace(rays.data() + begin, hits.data() + begin, count,
+          stats ? &local : nullptr);
+    for (size_t i = begin; i < begin + count; i++)
+      colors[order[i]] =
+          shade(hits[i], settings.trace, differential, bh.position);
+    if (stats) {
+      std::lock_guard<std::mutex> lock(statsLock);
+      stats->laneSteps += local.laneSteps;
+      stats->slotSteps += local.slotSteps;
+    }
+  });
+
+  // in sample order, so the sums do not depend on the batches
+  const float weight = 1.0f / (float)spp;
+  parallelFor(n, 4096, [&](size_t p) {
+    vec3 sum(0.0f);
+    for (int s = 0; s < spp; s++)
+      sum += colors[p * spp + s];
+    pixels[p] = sum * weight;
+  });
+}
+
+static void renderHole(const BlackHole &bh, const Camera &cam,
+                       const RenderSettings &settings,
+                       const std::vector<PixelRect> &rects,
+                       std::vector<vec3> &pixels, TraceStats *stats) {
+  TraceFn trace = selectTracer(bh, settings.precision, settings.simdWidth);
+  renderRays(bh, cam, settings, rects, pixels, stats,
+             [&](const Ray *rays, RayHit *hits, size_t count, TraceStats *st) {
+               trace(bh, settings.trace, rays, hits, count, st);
+             });
+}
+
+void renderRects(const std::vector<BlackHole> &holes, const Camera &cam,
+                 const RenderSettings &settings,
+                 const std::vector<PixelRect> &rects,
+                 std::vector<vec3> &pixels, TraceStats *stats) {
+  if (holes.size() == 1) {
+    renderHole(holes[0], cam, settings, rects, pixels, stats);
+    return;
+  }
+
+  HoleBVH bvh;
+  bvh.build(holes, settings.trace);
+  double mass = 0.0;
+  for (const BlackHole &bh : holes)
+    mass += bh.mass;
+  BlackHole total(vec3(bvh.centroid()), mass);
+  renderRays(total, cam, settings, rects, pixels, stats,
+             [&](const Ray *rays, RayHit *hits, size_t count, TraceStats *st) {
+               traceHoles(bvh, settings.trace, rays, hits, count, st);
+             });
+}
+
+void renderImage(const BlackHole &bh, const Camera &cam,
+                 const RenderSettings &settings, std::vector<vec3> &pixels,
+                 TraceStats *stats) {
+  renderHole(bh, cam, settings, {{0, 0, settings.width, settings.height}},
+             pixels, stats);
+}
+
+void renderImage(const std::vector<BlackHole> &holes, const Camera &cam,
+                 const RenderSettings &settings, std::vector<vec3> &pixels,
+                 TraceStats *stats) {
+  renderRects(holes, cam, settings,
+              {{0, 0, settings.width, settings.height}}, pixels, stats);
+}
+
+size_t renderBytesPerPixel(const RenderSettings &settings) {
+  // sample rays and their binned copy, hits, bin order and colours per
+  // sample, then the pixel
+  size_t spp = settings.sampler ? (size_t)settings.sampler->samples() : 1;
+  return spp * (2 * sizeof(Ray) + sizeof(RayHit) + sizeof(uint32_t) +
+                sizeof(vec3)) +
+         sizeof(vec3);
+}
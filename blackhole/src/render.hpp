@@ -0,0 +1,57 @@
+#pragma once
+
+#include "camera.hpp"
+#include "objects.hpp"
+#include "sampling.hpp"
+#include "tracer.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+struct RenderSettings {
+  int width = 400;
+  int height = 300;
+  Precision precision = Precision::Float;
+  int simdWidth = 8;
+  size_t batchSize = 1024; // rays per worker task, in binned order
+  TraceConfig trace;
+  // samples per pixel and where they go; one ray through each pixel's
+  // centre when null
+  const PixelSampler *sampler = nullptr;
+};
+
+// Traces every pixel's samples around `bh` on every core and averages
+// them. Pixels are row-major with the bottom row first, matching
+// glTexImage2D. Lane occupancy is added to `stats` when given.
+void renderImage(const BlackHole &bh, const Camera &cam,
+                 const RenderSettings &settings,
+                 std::vector<glm::vec3> &pixels,
+                 TraceStats *stats = nullptr);
+
+// Same for a group of holes; one hole goes through the single-hole tracer,
+// more through traceHoles() and a HoleBVH.
+void renderImage(const std::vector<BlackHole> &holes, const Camera &cam,
+                 const RenderSettings &settings,
+                 std::vector<glm::vec3> &pixels,
+                 TraceStats *stats = nullptr);
+
+// A rectangle [x, x + w) x [y, y + h) of the settings.width by
+// settings.height image, rows counted from the bottom.
+struct PixelRect {
+  int x, y, w, h;
+};
+
+// Traces pieces of the image as one job, so a large image can be rendered a
+// piece at a time while rays from all of the pieces are binned and batched
+// together. The pixels come out rect after rect, each row-major with its
+// bottom row first.
+void renderRects(const std::vector<BlackHole> &holes, const Camera &cam,
+                 const RenderSettings &settings,
+                 const std::vector<PixelRect> &rects,
+                 std::vector<glm::vec3> &pixels,
+                 TraceStats *stats = nullptr);
+
+// Working memory renderRects() needs per pixel traced.
+size_t renderBytesPerPixel(const RenderSettings &settings);
@@ -0,0 +1,211 @@
+#include "sampling.hpp"
+#include "random.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+using glm::vec2;
+
+// ---------------- Sobol ----------------
+// Direction numbers of the first two dimensions: bit reversal (van der
+// Corput), and the Pascal matrix of the primitive polynomial x + 1.
+static uint32_t sobolPoint(uint32_t index, int dim) {
+  uint32_t x = 0, v = 1u << 31;
+  for (; index; index >>= 1) {
+    if (index & 1)
+      x ^= v;
+    v = dim == 0 ? v >> 1 : v ^ (v >> 1);
+  }
+  return x;
+}
+
+static uint32_t reverseBits(uint32_t x) {
+  x = (x << 16) | (x >> 16);
+  x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+  x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+  x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+  return ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+}
+
+// Hash-based Owen scrambling (Burley, "Practical Hash-based Owen
+// Scrambling", 2020): every bit is flipped by a hash of the bits above it,
+// which keeps the points' stratification while decorrelating pixels.
+static uint32_t owenScramble(uint32_t x, uint32_t seed) {
+  x = reverseBits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return reverseBits(x);
+}
+
+static float toUnit(uint32_t x) {
+  return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+static float wrap(float x) { return x - std::floor(x); }
+
+// ---------------- Blue noise ----------------
+// Void and cluster (Ulichney 1993) on a torus: ranks go to the tightest
+// cluster of ones while thinning the initial pattern, then to the largest
+// void while filling the rest. Energies are kept up to date incrementally
+// with a Gaussian of sigma 1.5 over the whole tile.
+void PixelSampler::buildMask() {
+  const int N = MaskSize, cells = N * N;
+  std::vector<float> kernel(cells);
+  for (int y = 0; y < N; y++)
+    for (int x = 0; x < N; x++) {
+      int dx = std::min(x, N - x), dy = std::min(y, N - y);
+      kernel[y * N + x] = std::exp(-(float)(dx * dx + dy * dy) / 4.5f);
+    }
+  std::vector<uint8_t> on(cells, 0);
+  std::vector<float> energy(cells, 0.0f);
+  auto toggle = [&](int p, float sign) {
+    on[p] ^= 1;
+    int px = p % N, py = p / N;
+    for (int y = 0; y < N; y++) {
+      const float *k = &kernel[((y - py + N) % N) * N];
+      float *e = &energy[y * N];
+      for (int x = 0; x < N; x++)
+        e[x] += sign * k[(x - px + N) % N];
+    }
+  };
+  auto tightest = [&] {
+    int best = -1;
+    for (int p = 0; p < cells; p++)
+      if (on[p] && (best < 0 || energy[p] > energy[best]))
+        best = p;
+    return best;
+  };
+  auto largestVoid = [&] {
+    int best = -1;
+    for (int p = 0; p < cells; p++)
+      if (!on[p] && (best < 0 || energy[p] < energy[best]))
+        best = p;
+    return best;
+  };
+
+  // a tenth of the cells at random, then relaxed until moving the tightest
+  // cluster into the largest void changes nothing
+  CounterRng rng(seed, RandomStream::Pixels);
+  const int initial = cells / 10;
+  for (uint32_t i = 0, placed = 0; placed < (uint32_t)initial; i++) {
+    int p = (int)(rng.bits(i, 0, 0, 1)[0] % (uint32_t)cells);
+    if (!on[p]) {
+      toggle(p, 1.0f);
+      placed++;
+    }
+  }
+  for (int moves = 0; moves < cells; moves++) {
+    int cluster = tightest();
+    toggle(cluster, -1.0f);
+    int hole = largestVoid();
+    toggle(hole, 1.0f);
+    if (hole == cluster)
+      break;
+  }
+  std::vector<uint8_t> start = on;
+  std::vector<float> startEnergy = energy;
+
+  std::vector<int> rank(cells);
+  for (int r = initial - 1; r >= 0; r--) {
+    int p = tightest();
+    toggle(p, -1.0f);
+    rank[p] = r;
+  }
+  on.swap(start);
+  energy.swap(startEnergy);
+  // past half full the minority are the zeros, and their tightest cluster
+  // is the cell with the least energy from the ones: the same pick
+  for (int r = initial; r < cells; r++) {
+    int p = largestVoid();
+    toggle(p, 1.0f);
+    rank[p] = r;
+  }
+
+  mask.resize(cells);
+  for (int p = 0; p < cells; p++)
+    mask[p] = ((float)rank[p] + 0.5f) / (float)cells;
+}
+
+// ---------------- Tables ----------------
+void PixelSampler::build(SamplerType type, int samples, uint32_t seedValue) {
+  kind = type;
+  count = std::max(1, samples);
+  seed = seedValue;
+  sobol.clear();
+  r2.clear();
+  mask.clear();
+  if (kind == SamplerType::Sobol) {
+    sobol.resize(2 * (size_t)count);
+    for (int s = 0; s < count; s++) {
+      sobol[2 * s] = sobolPoint((uint32_t)s, 0);
+      sobol[2 * s + 1] = sobolPoint((uint32_t)s, 1);
+    }
+  }
+  if (kind == SamplerType::R2 || kind == SamplerType::BlueNoise) {
+    // the plastic number g, the root of g^3 = g + 1
+    const double g = 1.32471795724474602596;
+    for (int s = 0; s < count; s++)
+      r2.push_back(vec2((float)std::fmod(0.5 + s / g, 1.0),
+                        (float)std::fmod(0.5 + s / (g * g), 1.0)));
+  }
+  if (kind == SamplerType::BlueNoise)
+    buildMask();
+}
+
+vec2 PixelSampler::offset(int x, int y, int s) const {
+  // pixels are keyed by position in the image, never by position in a
+  // rect, with x and y in counter words of their own so no two pixels of
+  // any image size share a key
+  const uint32_t px = (uint32_t)x, py = (uint32_t)y;
+  CounterRng rng(seed, RandomStream::Pixels);
+  switch (kind) {
+  case SamplerType::Random: {
+    philox::Block b = rng.bits(px, py, 0, (uint32_t)s);
+    return vec2(toUnit(b[0]), toUnit(b[1]));
+  }
+  case SamplerType::Sobol: {
+    philox::Block b = rng.bits(px, py);
+    return vec2(toUnit(owenScramble(sobol[2 * s], b[0])),
+                toUnit(owenScramble(sobol[2 * s + 1], b[1])));
+  }
+  case SamplerType::R2: {
+    philox::Block b = rng.bits(px, py);
+    return vec2(wrap(r2[s].x + toUnit(b[0])), wrap(r2[s].y + toUnit(b[1])));
+  }
+  case SamplerType::BlueNoise:
+  default: {
+    // the y shift is the same mask moved half a tile, which is
+    // uncorrelated with it at short range
+    const int N = MaskSize;
+    float mx = mask[(y % N) * N + x % N];
+    float my = mask[((y + N / 2) % N) * N + (x + N / 2) % N];
+    return vec2(wrap(r2[s].x + mx), wrap(r2[s].y + my));
+  }
+  }
+}
+
+bool parseSamplerType(const char *name, SamplerType &type) {
+  static const struct {
+    const char *name;
+    SamplerType type;
+  } names[] = {
+      {"random", SamplerType::Random},
+      {"sobol", SamplerType::Sobol},
+      {"r2", SamplerType::R2},
+      {"blue", SamplerType::BlueNoise},
+  };
+  for (const auto &n : names) {
+    if (std::strcmp(n.name, name) == 0) {
+      type = n.type;
+      return true;
+    }
+  }
+  std::cerr << "Unknown sampler '" << name
+            << "'; use random, sobol, r2 or blue\n";
+  return false;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// ---------------- Pixel samplers ----------------
+// Where in each pixel the renderer's samples go. Every pattern comes from
+// a small table built once by build(), then decorrelated between pixels:
+//   Random    - independent Philox uniforms, the baseline
+//   Sobol     - the first two Sobol dimensions, Owen-scrambled per pixel
+//               with a hash keyed by the pixel
+//   R2        - Roberts' R2 sequence, shifted by a random offset per pixel
+//   BlueNoise - R2 shifted by a tiled blue-noise mask (void and cluster),
+//               so what error is left is high-frequency across pixels
+// Offsets depend only on (x, y, sample), never on which thread asks or in
+// what order, so tiles and threads can render any part of the image.
+enum class SamplerType { Random, Sobol, R2, BlueNoise };
+
+struct PixelSampler {
+  static constexpr int MaskSize = 64; // blue-noise tile, pixels on a side
+
+  void build(SamplerType type, int samples, uint32_t seed = 1);
+
+  SamplerType type() const { return kind; }
+  int samples() const { return count; }
+
+  // Offset in [0, 1)^2 of sample s in pixel (x, y), rows from the bottom.
+  glm::vec2 offset(int x, int y, int s) const;
+
+private:
+  SamplerType kind = SamplerType::Sobol;
+  int count = 1;
+  uint32_t seed = 1;
+  std::vector<uint32_t> sobol; // x and y bits per sample
+  std::vector<glm::vec2> r2;   // per sample
+  std::vector<float> mask;     // MaskSize^2 ranks in [0, 1)
+
+  void buildMask();
+};
+
+// Parses random, sobol, r2 or blue; prints and returns false otherwise.
+bool parseSamplerType(const char *name, SamplerType &type);
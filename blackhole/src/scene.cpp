@@ -0,0 +1,185 @@
+#include "scene.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace glm;
+
+int SceneBVH::addMaterial(const Material &m) {
+  materials.push_back(m);
+  return (int)materials.size() - 1;
+}
+
+void SceneBVH::addSphere(vec3 center, float radius, int material) {
+  spheres.push_back({center, radius, material});
+}
+
+void SceneBVH::addMesh(const std::vector<vec3> &vertices,
+                       const std::vector<uint32_t> &indices, int material) {
+  for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    triangles.push_back({vertices[indices[i]], vertices[indices[i + 1]],
+                         vertices[indices[i + 2]], material});
+}
+
+// ---------------- Build ----------------
+void SceneBVH::bounds(const Prim &p, vec3 &lo, vec3 &hi) const {
+  if (p.sphere) {
+    const Sphere &s = spheres[p.index];
+    lo = s.center - vec3(s.radius);
+    hi = s.center + vec3(s.radius);
+  } else {
+    const Triangle &t = triangles[p.index];
+    lo = min(t.a, min(t.b, t.c));
+    hi = max(t.a, max(t.b, t.c));
+  }
+}
+
+void SceneBVH::build() {
+  prims.clear();
+  for (uint32_t i = 0; i < spheres.size(); i++)
+    prims.push_back({i, true});
+  for (uint32_t i = 0; i < triangles.size(); i++)
+    prims.push_back({i, false});
+  nodes.clear();
+  nodes.reserve(prims.size());
+  if (!prims.empty())
+    buildNode(0, (int)prims.size());
+}
+
+// Median split of the box centres along the widest axis, as in HoleBVH.
+int SceneBVH::buildNode(int first, int count) {
+  int index = (int)nodes.size();
+  nodes.emplace_back();
+
+  vec3 lo(INFINITY), hi(-INFINITY), clo(INFINITY), chi(-INFINITY);
+  for (int i = first; i < first + count; i++) {
+    vec3 plo, phi;
+    bounds(prims[i], plo, phi);
+    lo = min(lo, plo);
+    hi = max(hi, phi);
+    clo = min(clo, (plo + phi) * 0.5f);
+    chi = max(chi, (plo + phi) * 0.5f);
+  }
+
+  Node node{lo, hi, first, 0, -1};
+  if (count <= 4) {
+    node.count = count;
+  } else {
+    vec3 size = chi - clo;
+    int axis = size.x > size.y ? (size.x > size.z ? 0 : 2)
+                               : (size.y > size.z ? 1 : 2);
+    int mid = first + count / 2;
+    std::nth_element(prims.begin() + first, prims.begin() + mid,
+                     prims.begin() + first + count,
+                     [&](const Prim &a, const Prim &b) {
+                       vec3 alo, ahi, blo, bhi;
+                       bounds(a, alo, ahi);
+                       bounds(b, blo, bhi);
+                       return alo[axis] + ahi[axis] < blo[axis] + bhi[axis];
+                     });
+    buildNode(first, mid - first);
+    node.right = buildNode(mid, first + count - mid);
+  }
+  nodes[index] = node;
+  return index;
+}
+
+// ---------------- Queries ----------------
+// Slab test of the segment a + t d, t in [0, tmax], against a box.
+static bool segmentHitsBox(vec3 a, vec3 invD, float tmax, vec3 lo, vec3 hi) {
+  float t0 = 0.0f, t1 = tmax;
+  for (int k = 0; k < 3; k++) {
+    float n = (lo[k] - a[k]) * invD[k];
+    float f = (hi[k] - a[k]) * invD[k];
+    if (n > f)
+      std::swap(n, f);
+    t0 = n > t0 ? n : t0;
+    t1 = f < t1 ? f : t1;
+    if (t0 > t1)
+      return false;
+  }
+  return true;
+}
+
+bool SceneBVH::intersect(vec3 a, vec3 b, SurfaceHit &hit) const {
+  if (nodes.empty())
+    return false;
+  vec3 d = b - a;
+  vec3 invD(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+  float best = 1.0f;
+  int found = -1;
+  Prim prim{};
+
+  int stack[64];
+  int top = 0;
+  stack[top++] = 0;
+  while (top) {
+    const Node &node = nodes[stack[--top]];
+    if (!segmentHitsBox(a, invD, best, node.lo, node.hi))
+      continue;
+    if (node.count == 0) {
+      stack[top++] = node.right;
+      stack[top++] = (int)(&node - nodes.data()) + 1;
+      continue;
+    }
+    for (int i = node.first; i < node.first + node.count; i++) {
+      const Prim &p = prims[i];
+      float t = INFINITY;
+      if (p.sphere) {
+        const Sphere &s = spheres[p.index];
+        vec3 o = a - s.center;
+        float qa = dot(d, d), qb = dot(o, d);
+        float qc = dot(o, o) - s.radius * s.radius;
+        float disc = qb * qb - qa * qc;
+        if (disc >= 0.0f)
+          t = (-qb - std::sqrt(disc)) / qa;
+      } else {
+        // Moller-Trumbore
+        const Triangle &tri = triangles[p.index];
+        vec3 e1 = tri.b - tri.a, e2 = tri.c - tri.a;
+        vec3 q = cross(d, e2);
+        float det = dot(e1, q);
+        if (std::fabs(det) > 1e-12f) {
+          vec3 s = a - tri.a;
+          float u = dot(s, q) / det;
+          vec3 r = cross(s, e1);
+          float v = dot(d, r) / det;
+          if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f)
+            t = dot(e2, r) / det;
+        }
+      }
+      if (t >= 0.0f && t < best) {
+        best = t;
+        found = i;
+        prim = p;
+      }
+    }
+  }
+  if (found < 0)
+    return false;
+
+  hit.t = best;
+  hit.point = a + d * best;
+  if (prim.sphere) {
+    const Sphere &s = spheres[prim.index];
+    hit.normal = (hit.point - s.center) / s.radius;
+    hit.material = s.material;
+  } else {
+    const Triangle &tri = triangles[prim.index];
+    hit.normal = normalize(cross(tri.b - tri.a, tri.c - tri.a));
+    hit.material = tri.material;
+  }
+  if (dot(hit.normal, d) > 0.0f)
+    hit.normal = -hit.normal;
+  return true;
+}
+
+bool SceneBVH::intersectRay(vec3 origin, vec3 dir, SurfaceHit &hit) const {
+  if (nodes.empty())
+    return false;
+  // long enough to leave the root box from anywhere the ray starts
+  const Node &root = nodes[0];
+  float reach = length(root.hi - root.lo) +
+                length((root.lo + root.hi) * 0.5f - origin);
+  return intersect(origin, origin + dir * reach, hit);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// ---------------- Scene geometry ----------------
+// Ordinary objects the lensed rays can hit: spheres (companion stars) and
+// triangle meshes (probes). A curved ray is tested one integration step at
+// a time, as the straight chord between the step's ends, against a BVH
+// whose boxes cull most chords with a slab test. Tracing stops at the
+// escape sphere, and past it light runs straight: an escaped ray is tested
+// once more, as the ray from its exit point along its final direction
+// (far-field bending included), so objects beyond the sphere still show,
+// lensed by everything the ray passed.
+struct Material {
+  glm::vec3 color;
+  bool emissive = false; // stars shine by themselves, probes are lit
+};
+
+struct SurfaceHit {
+  float t;          // along the chord, 0 at its start and 1 at its end
+  glm::vec3 point;  // scene space
+  glm::vec3 normal; // unit, facing the ray
+  int material;
+};
+
+struct SceneBVH {
+  struct Sphere {
+    glm::vec3 center;
+    float radius;
+    int material;
+  };
+  struct Triangle {
+    glm::vec3 a, b, c;
+    int material;
+  };
+  // spheres first, then triangles; leaves index into `prims`
+  struct Prim {
+    uint32_t index;
+    bool sphere;
+  };
+  struct Node {
+    glm::vec3 lo, hi;
+    int first, count; // prim range for leaves, count = 0 for inner nodes
+    int right;        // inner nodes: left child is the next node
+  };
+
+  std::vector<Material> materials;
+  std::vector<Sphere> spheres;
+  std::vector<Triangle> triangles;
+  std::vector<Prim> prims;
+  std::vector<Node> nodes;
+
+  int addMaterial(const Material &m);
+  void addSphere(glm::vec3 center, float radius, int material);
+  void addMesh(const std::vector<glm::vec3> &vertices,
+               const std::vector<uint32_t> &indices, int material);
+
+  // Builds the hierarchy; call after adding geometry.
+  void build();
+  bool empty() const { return prims.empty(); }
+
+  // Closest hit on the segment a -> b.
+  bool intersect(glm::vec3 a, glm::vec3 b, SurfaceHit &hit) const;
+
+  // Closest hit on the ray from origin along dir (unit length); hit.t is
+  // along a segment that reaches past the whole scene.
+  bool intersectRay(glm::vec3 origin, glm::vec3 dir, SurfaceHit &hit) const;
+
+private:
+  void bounds(const Prim &p, glm::vec3 &lo, glm::vec3 &hi) const;
+  int buildNode(int first, int count);
+};
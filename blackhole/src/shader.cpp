@@ -0,0 +1,92 @@
+#include "shader.hpp"
+
+#include <iostream>
+
+// ---------------- Shader helpers ----------------
+GLuint compileShader(GLenum type, const char *src) {
+  GLuint s = glCreateShader(type);
+  glShaderSource(s, 1, &src, nullptr);
+  glCompileShader(s);
+  GLint ok;
+  glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
+  if (!ok) {
+    char log[1024];
+    glGetShaderInfoLog(s, 1024, nullptr, log);
+    std::cerr << "Shader error:\n" << log << "\n";
+  }
+  return s;
+}
+
+GLuint makeProgram(const char *vs, const char *fs) {
+  GLuint v = compileShader(GL_VERTEX_SHADER, vs);
+  GLuint f = compileShader(GL_FRAGMENT_SHADER, fs);
+  GLuint p = glCreateProgram();
+  glAttachShader(p, v);
+  glAttachShader(p, f);
+  glLinkProgram(p);
+  glDeleteShader(v);
+  glDeleteShader(f);
+  return p;
+}
+
+GLuint makeComputeProgram(const char *cs) {
+  GLuint s = compileShader(GL_COMPUTE_SHADER, cs);
+  GLuint p = glCreateProgram();
+  glAttachShader(p, s);
+  glLinkProgram(p);
+  glDeleteShader(s);
+
+  GLint ok;
+  glGetProgramiv(p, GL_LINK_STATUS, &ok);
+  if (!ok) {
+    char log[1024];
+    glGetProgramInfoLog(p, 1024, nullptr, log);
+    std::cerr << "Compute link error:\n" << log << "\n";
+    glDeleteProgram(p);
+    return 0;
+  }
+  return p;
+}
+
+// ---------------- ScreenQuad ----------------
+void ScreenQuad::init() {
+  const char *vs = R"(
+    #version 330 core
+    out vec2 vUV;
+
+    void main() {
+      vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+      vUV = p;
+      gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+    }
+  )";
+
+  const char *fs = R"(
+    #version 330 core
+    in vec2 vUV;
+    out vec4 FragColor;
+
+    uniform sampler2D uImage;
+
+    void main() {
+      FragColor = texture(uImage, vUV);
+    }
+  )";
+
+  program = makeProgram(vs, fs);
+  // core profile refuses draws without a bound VAO, even attribute-less ones
+  glGenVertexArrays(1, &vao);
+}
+
+void ScreenQuad::draw(GLuint texture) {
+  glDisable(GL_DEPTH_TEST);
+  glUseProgram(program);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glUniform1i(glGetUniformLocation(program, "uImage"), 0);
+
+  glBindVertexArray(vao);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(0);
+  glEnable(GL_DEPTH_TEST);
+}
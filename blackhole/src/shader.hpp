@@ -0,0 +1,19 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// ---------------- Shader helpers ----------------
+GLuint compileShader(GLenum type, const char *src);
+GLuint makeProgram(const char *vs, const char *fs);
+
+// Returns 0 if the compute stage fails to compile or link.
+GLuint makeComputeProgram(const char *cs);
+
+// Draws a texture over the whole viewport with one oversized triangle.
+struct ScreenQuad {
+  GLuint program = 0;
+  GLuint vao = 0;
+
+  void init();
+  void draw(GLuint texture);
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+// CPU twins of the sky() and disk() functions in the compute shader, so
+// both tracers produce the same picture.
+
+inline float hash(glm::vec3 q) {
+  float s = sinf(q.x * 12.9898f + q.y * 78.233f + q.z * 37.719f) * 43758.5453f;
+  return s - floorf(s);
+}
+
+// `footprint` is the pixel's angular width on the sky in radians. Grid lines
+// and stars finer than it are blurred and dimmed instead of aliasing; 0
+// gives the shader's unfiltered sky.
+inline glm::vec3 skyColor(glm::vec3 d, float footprint = 0.0f) {
+  float theta = acosf(glm::clamp(d.y, -1.0f, 1.0f));
+  float phi = atan2f(d.z, d.x);
+  float gx = phi * 3.8197186f, gy = theta * 3.8197186f;
+  gx = fabsf(gx - floorf(gx) - 0.5f);
+  gy = fabsf(gy - floorf(gy) - 0.5f);
+  float edge = fmaxf(0.04f, footprint * 3.8197186f);
+  float t = glm::clamp((fmaxf(gx, gy) - (0.5f - edge)) / edge, 0.0f, 1.0f);
+  float line = t * t * (3.0f - 2.0f * t) * (0.04f / edge);
+  glm::vec3 col = glm::mix(glm::vec3(0.02f, 0.02f, 0.05f),
+                           glm::vec3(0.25f, 0.25f, 0.35f), line);
+  glm::vec3 cell(floorf(d.x * 200.0f), floorf(d.y * 200.0f),
+                 floorf(d.z * 200.0f));
+  if (hash(cell) > 0.998f) {
+    float cover = fminf(1.0f, 0.005f / fmaxf(footprint, 1e-6f));
+    col = glm::mix(col, glm::vec3(1.0f), cover * cover);
+  }
+  return col;
+}
+
+// r in units of r_s, between the disk's inner and outer edge
+inline glm::vec3 diskColor(float r, float inner, float outer) {
+  float t = (r - inner) / (outer - inner);
+  glm::vec3 col = glm::mix(glm::vec3(1.0f, 0.85f, 0.6f),
+                           glm::vec3(0.8f, 0.25f, 0.05f), t);
+  return col * (1.0f - 0.6f * t);
+}
+
+// Scene objects: stars glow with their own colour, everything else is lit
+// diffusely from `light`, the direction towards the disk.
+inline glm::vec3 surfaceColor(glm::vec3 color, bool emissive, glm::vec3 normal,
+                              glm::vec3 light) {
+  if (emissive)
+    return color;
+  return color * (0.1f + 0.9f * fmaxf(glm::dot(normal, light), 0.0f));
+}
@@ -0,0 +1,263 @@
+#include "snapshot.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "snapshots are stored little-endian as in memory; this host is not"
+#endif
+
+using namespace snapshot;
+
+static const char DataMagic[8] = {'B', 'H', 'S', 'N', 'A', 'P', 0, 0};
+static const char IndexMagic[8] = {'B', 'H', 'I', 'N', 'D', 'E', 'X', 0};
+
+static bool writeAll(int fd, const void *buf, size_t n, uint64_t offset) {
+  const char *p = (const char *)buf;
+  while (n) {
+    ssize_t done = pwrite(fd, p, n, (off_t)offset);
+    if (done < 0 && errno == EINTR)
+      continue;
+    if (done <= 0)
+      return false;
+    p += done;
+    n -= (size_t)done;
+    offset += (uint64_t)done;
+  }
+  return true;
+}
+
+// Writes a fresh header into an empty file or checks an existing one.
+static bool prepare(int fd, const char (&magic)[8], uint64_t size) {
+  FileHeader header{};
+  if (size == 0) {
+    std::memcpy(header.magic, magic, 8);
+    header.version = Version;
+    header.headerSize = sizeof(FileHeader);
+    return writeAll(fd, &header, sizeof header, 0);
+  }
+  return size >= sizeof header &&
+         pread(fd, &header, sizeof header, 0) == (ssize_t)sizeof header &&
+         std::memcmp(header.magic, magic, 8) == 0 &&
+         header.version == Version;
+}
+
+static uint64_t fileSize(int fd) {
+  struct stat st;
+  return fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+// ---------------- Writer ----------------
+SnapshotWriter::~SnapshotWriter() { close(); }
+
+bool SnapshotWriter::open(const std::string &path, double until) {
+  close();
+  data = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  index = ::open((path + ".idx").c_str(), O_RDWR | O_CREAT, 0644);
+  bool ok = data >= 0 && index >= 0 &&
+            prepare(data, DataMagic, fileSize(data)) &&
+            prepare(index, IndexMagic, fileSize(index));
+  if (!ok) {
+    std::cerr << "Cannot open snapshot run '" << path
+              << "': " << std::strerror(errno) << "\n";
+    if (data >= 0)
+      ::close(data);
+    if (index >= 0)
+      ::close(index);
+    data = index = -1;
+    return false;
+  }
+
+  // continue after the last frame kept, dropping any torn tail
+  size_t frames = (fileSize(index) - sizeof(FileHeader)) / sizeof(IndexEntry);
+  end = sizeof(FileHeader);
+  for (; frames; frames--) {
+    IndexEntry last;
+    if (pread(index, &last, sizeof last,
+              (off_t)(sizeof(FileHeader) +
+                      (frames - 1) * sizeof(IndexEntry))) !=
+        (ssize_t)sizeof last)
+      continue;
+    if (last.time <= until) {
+      end = last.offset + last.bytes;
+      break;
+    }
+  }
+  written = frames;
+  if (ftruncate(index, (off_t)(sizeof(FileHeader) +
+                               written * sizeof(IndexEntry))) != 0 ||
+      ftruncate(data, (off_t)end) != 0)
+    std::cerr << "Cannot trim snapshot run '" << path << "'\n";
+
+  writer.start([this](Frame &frame) { write(frame); });
+  return true;
+}
+
+void SnapshotWriter::capture(const BodySystem &bodies, double time) {
+  if (!isOpen())
+    return;
+  writer.capture([&](Frame &frame) {
+    size_t n = bodies.size();
+    size_t doubles = columnBytes(n, sizeof(double));
+    size_t bytes = sizeof(FrameHeader) + 8 * doubles +
+                   columnBytes(n, sizeof(uint32_t));
+    frame.bytes.assign(bytes, 0);
+    FrameHeader header{};
+    header.time = time;
+    header.count = n;
+    header.bytes = bytes;
+    std::memcpy(frame.bytes.data(), &header, sizeof header);
+    char *column = frame.bytes.data() + sizeof header;
+    const std::vector<double> *columns[8] = {
+        &bodies.pos[0], &bodies.pos[1], &bodies.pos[2], &bodies.vel[0],
+        &bodies.vel[1], &bodies.vel[2], &bodies.mass,   &bodies.spin};
+    for (const std::vector<double> *c : columns) {
+      std::memcpy(column, c->data(), n * sizeof(double));
+      column += doubles;
+    }
+    std::memcpy(column, bodies.ids.data(), n * sizeof(uint32_t));
+    frame.time = time;
+    frame.count = n;
+  });
+}
+
+// On the writer thread: frame first and index entry second.
+void SnapshotWriter::write(Frame &frame) {
+  IndexEntry entry{end, frame.time, frame.count, frame.bytes.size()};
+  bool ok = writeAll(data, frame.bytes.data(), frame.bytes.size(), end) &&
+            writeAll(index, &entry, sizeof entry,
+                     sizeof(FileHeader) + written * sizeof(IndexEntry));
+  if (!ok) {
+    std::cerr << "Snapshot write failed: " << std::strerror(errno) << "\n";
+    return;
+  }
+  end += frame.bytes.size();
+  written++;
+}
+
+void SnapshotWriter::flush() { writer.flush(); }
+
+void SnapshotWriter::close() {
+  writer.stop();
+  if (data >= 0)
+    ::close(data);
+  if (index >= 0)
+    ::close(index);
+  data = index = -1;
+}
+
+// ---------------- Reader ----------------
+SnapshotReader::~SnapshotReader() { close(); }
+
+bool SnapshotReader::open(const std::string &p) {
+  close();
+  path = p;
+  if (map())
+    return true;
+  std::cerr << "Cannot read snapshot run '" << path << "'\n";
+  return false;
+}
+
+bool SnapshotReader::refresh() {
+  unmap();
+  return map();
+}
+
+void SnapshotReader::close() {
+  unmap();
+  path.clear();
+}
+
+static const char *mapFile(const std::string &path, size_t &size) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+  size = (size_t)fileSize(fd);
+  void *p = size ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0)
+                 : MAP_FAILED;
+  ::close(fd);
+  return p == MAP_FAILED ? nullptr : (const char *)p;
+}
+
+bool SnapshotReader::map() {
+  dataMap = mapFile(path, dataSize);
+  indexMap = mapFile(path + ".idx", indexSize);
+  if (!dataMap || !indexMap || dataSize < sizeof(FileHeader) ||
+      indexSize < sizeof(FileHeader) ||
+      std::memcmp(dataMap, DataMagic, 8) != 0 ||
+      std::memcmp(indexMap, IndexMagic, 8) != 0 ||
+      ((const FileHeader *)dataMap)->version != Version) {
+    unmap();
+    return false;
+  }
+  entries = (const IndexEntry *)(indexMap + sizeof(FileHeader));
+  count = (indexSize - sizeof(FileHeader)) / sizeof(IndexEntry);
+  // the data file may lag the mapping of a run still being written
+  while (count && entries[count - 1].offset + entries[count - 1].bytes >
+                      dataSize)
+    count--;
+  return true;
+}
+
+void SnapshotReader::unmap() {
+  if (dataMap)
+    munmap((void *)dataMap, dataSize);
+  if (indexMap)
+    munmap((void *)indexMap, indexSize);
+  dataMap = indexMap = nullptr;
+  dataSize = indexSize = count = 0;
+  entries = nullptr;
+}
+
+SnapshotFrame SnapshotReader::frame(size_t k) const {
+  const char *base = dataMap + entries[k].offset;
+  const FrameHeader *header = (const FrameHeader *)base;
+  SnapshotFrame f;
+  f.time = header->time;
+  f.count = header->count;
+  size_t doubles = columnBytes(f.count, sizeof(double));
+  const char *column = base + sizeof(FrameHeader);
+  auto next = [&] {
+    const double *p = (const double *)column;
+    column += doubles;
+    return p;
+  };
+  for (int axis = 0; axis < 3; axis++)
+    f.pos[axis] = next();
+  for (int axis = 0; axis < 3; axis++)
+    f.vel[axis] = next();
+  f.mass = next();
+  f.spin = next();
+  f.ids = (const uint32_t *)column;
+  return f;
+}
+
+size_t SnapshotReader::find(double t) const {
+  const IndexEntry *hit = std::upper_bound(
+      entries, entries + count, t,
+      [](double t, const IndexEntry &e) { return t < e.time; });
+  return hit == entries ? 0 : (size_t)(hit - entries) - 1;
+}
+
+// madvise wants page-aligned starts; widen the frame to whole pages.
+static void advise(const char *map, const IndexEntry &entry, int advice) {
+  static const uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+  uint64_t begin = entry.offset / page * page;
+  uint64_t end = entry.offset + entry.bytes;
+  madvise((void *)(map + begin), (size_t)(end - begin), advice);
+}
+
+void SnapshotReader::prefetch(size_t k) const {
+  advise(dataMap, entries[k], MADV_WILLNEED);
+}
+
+void SnapshotReader::release(size_t k) const {
+  advise(dataMap, entries[k], MADV_DONTNEED);
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "background.hpp"
+#include "bodies.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ---------------- Snapshots ----------------
+// A run on disk is two append-only files. `path` holds the frames: a
+// 64-byte file header, then per frame a 64-byte frame header followed by
+// the columns pos x, y, z, vel x, y, z, mass, spin (doubles) and ids
+// (uint32), each starting on a 64-byte boundary. `path`.idx holds a
+// 64-byte header and one fixed-size entry per frame, so frame k is found
+// at a known offset without reading anything before it. All numbers are
+// little-endian and laid out exactly as in memory: a reader maps the
+// files and hands out pointers into them, paging in only the frames it
+// touches.
+namespace snapshot {
+
+constexpr size_t Align = 64;
+constexpr uint32_t Version = 1;
+
+struct FileHeader {
+  char magic[8]; // "BHSNAP\0\0" or "BHINDEX\0"
+  uint32_t version;
+  uint32_t headerSize;
+  uint8_t reserved[48];
+};
+
+struct FrameHeader {
+  double time;    // seconds
+  uint64_t count; // bodies
+  uint64_t bytes; // whole frame, header included
+  uint8_t reserved[40];
+};
+
+struct IndexEntry {
+  uint64_t offset; // of the frame header in the data file
+  double time;
+  uint64_t count;
+  uint64_t bytes;
+};
+
+static_assert(sizeof(FileHeader) == Align && sizeof(FrameHeader) == Align,
+              "headers keep the columns aligned");
+
+// Bytes of one column of `count` elements of `size` bytes, padded.
+inline size_t columnBytes(size_t count, size_t size) {
+  return (count * size + Align - 1) / Align * Align;
+}
+
+} // namespace snapshot
+
+// One frame as pointers into a mapped file, valid while its reader lives.
+struct SnapshotFrame {
+  double time = 0.0;
+  size_t count = 0;
+  const double *pos[3] = {}, *vel[3] = {};
+  const double *mass = nullptr, *spin = nullptr;
+  const uint32_t *ids = nullptr;
+};
+
+// Appends frames from a background thread. capture() lays the frame out
+// in the back buffer and returns; the writer thread swaps it to the front
+// and writes it, frame first and index entry second, so a run cut short
+// never indexes a partial frame. capture() only blocks when the writer
+// is a whole frame behind.
+struct SnapshotWriter {
+  ~SnapshotWriter();
+
+  // Opens `path` and `path`.idx, continuing an existing run after its last
+  // indexed frame, or after its last frame at or before `until` when a
+  // resumed run takes over from an earlier time. Prints the reason and
+  // returns false on failure.
+  bool open(const std::string &path, double until = INFINITY);
+  bool isOpen() const { return data >= 0; }
+
+  void capture(const BodySystem &bodies, double time);
+
+  // Waits until every captured frame is on disk.
+  void flush();
+  void close();
+
+  size_t frames() const { return written; }
+
+private:
+  int data = -1, index = -1;
+  uint64_t end = 0; // data file offset of the next frame
+
+  std::atomic<size_t> written{0};
+
+  // a frame laid out as on disk, header included
+  struct Frame {
+    std::vector<char> bytes;
+    double time = 0.0;
+    uint64_t count = 0;
+  };
+  // last, so its thread is gone before the files it writes
+  BackgroundWriter<Frame> writer;
+
+  void write(Frame &frame);
+};
+
+// Maps a run for reading. Frames appended since open() show up after
+// refresh().
+struct SnapshotReader {
+  ~SnapshotReader();
+
+  bool open(const std::string &path);
+  bool refresh();
+  void close();
+
+  size_t frames() const { return count; }
+  double time(size_t k) const { return entries[k].time; }
+  uint64_t bytes(size_t k) const { return entries[k].bytes; }
+  SnapshotFrame frame(size_t k) const;
+
+  // Last frame at or before t (the first if t precedes them all).
+  size_t find(double t) const;
+
+  // Paging hints for frame k: start reading it in the background, or let
+  // its pages go. Either is safe while the frame is in use; a released
+  // page is read back from the page cache on the next touch.
+  void prefetch(size_t k) const;
+  void release(size_t k) const;
+
+private:
+  std::string path;
+  const char *dataMap = nullptr, *indexMap = nullptr;
+  size_t dataSize = 0, indexSize = 0;
+  const snapshot::IndexEntry *entries = nullptr;
+  size_t count = 0;
+
+  bool map();
+  void unmap();
+};
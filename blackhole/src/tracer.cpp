@@ -0,0 +1,82 @@
+#include "tracer.hpp"
+
+#include <algorithm>
+
+#define BLACKHOLE_INSTANTIATE_TRACERS(N)                                       \
+  template struct Tracer<N##Metric, float, 1>;                                 \
+  template struct Tracer<N##Metric, float, 4>;                                 \
+  template struct Tracer<N##Metric, float, 8>;                                 \
+  template struct Tracer<N##Metric, double, 1>;                                \
+  template struct Tracer<N##Metric, double, 4>;                                \
+  template struct Tracer<N##Metric, double, 8>;                                \
+  template struct Tracer<N##Metric, DualReal, 4>;
+BLACKHOLE_TRACER_METRICS(BLACKHOLE_INSTANTIATE_TRACERS)
+#undef BLACKHOLE_INSTANTIATE_TRACERS
+
+template <class Metric, class Real, int Width>
+static void traceRays(const BlackHole &bh, const TraceConfig &cfg,
+                      const Ray *rays, RayHit *out, size_t count,
+                      TraceStats *stats) {
+  Tracer<Metric, Real, Width>(bh, cfg).traceStream(rays, count, out, stats);
+}
+
+template <class Metric> struct TraceTable {
+  // duals are three doubles wide already, so they always run 4 lanes
+  static constexpr TraceFn fns[3][3] = {
+      {traceRays<Metric, float, 1>, traceRays<Metric, float, 4>,
+       traceRays<Metric, float, 8>},
+      {traceRays<Metric, double, 1>, traceRays<Metric, double, 4>,
+       traceRays<Metric, double, 8>},
+      {traceRays<Metric, DualReal, 4>, traceRays<Metric, DualReal, 4>,
+       traceRays<Metric, DualReal, 4>},
+  };
+};
+
+void binRays(const BlackHole &bh, const Ray *rays, size_t count,
+             std::vector<uint32_t> &order) {
+  // bin 0 holds outward rays, the last bin everything beyond 64 r_s
+  constexpr int bins = 2 + 64 * 8;
+  double rs = bh.sceneRadius() > 0.0f ? bh.sceneRadius() : 1.0;
+  std::vector<uint16_t> key(count);
+  std::vector<uint32_t> start(bins + 1, 0);
+  for (size_t i = 0; i < count; i++) {
+    glm::vec3 o = rays[i].origin - bh.position;
+    glm::vec3 d = rays[i].dir;
+    int k = 0;
+    if (glm::dot(o, d) < 0.0f) {
+      double b = glm::length(glm::cross(o, d)) / rs;
+      k = 1 + (int)std::min(b * 8.0, (double)(bins - 2));
+    }
+    key[i] = (uint16_t)k;
+    start[k + 1]++;
+  }
+  for (int k = 0; k < bins; k++)
+    start[k + 1] += start[k];
+  order.resize(count);
+  for (size_t i = 0; i < count; i++)
+    order[start[key[i]]++] = (uint32_t)i;
+}
+
+TraceFn selectTracer(const BlackHole &bh, Precision precision, int width) {
+  int p = precision == Precision::Differential ? 2
+          : precision == Precision::Double     ? 1
+                                               : 0;
+  int w = width >= 8 ? 2 : width >= 4 ? 1 : 0;
+
+  MetricType type = bh.metric;
+  if (type == MetricType::Auto) {
+    type = bh.mass <= 0.0    ? MetricType::Flat
+           : bh.spin == 0.0 ? MetricType::Schwarzschild
+                            : MetricType::Kerr;
+  }
+
+  switch (type) {
+#define BLACKHOLE_TRACE_CASE(N)                                                \
+  case MetricType::N:                                                          \
+    return TraceTable<N##Metric>::fns[p][w];
+    BLACKHOLE_TRACER_METRICS(BLACKHOLE_TRACE_CASE)
+#undef BLACKHOLE_TRACE_CASE
+  default:
+    return TraceTable<SchwarzschildMetric>::fns[p][w];
+  }
+}
@@ -0,0 +1,444 @@
+#pragma once
+
+#include "dual.hpp"
+#include "metric.hpp"
+#include "metrics_gen.hpp"
+#include "objects.hpp"
+#include "scene.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// ---------------- Rays ----------------
+struct Ray {
+  glm::vec3 origin;        // scene space
+  glm::vec3 dir;           // unit length
+  glm::vec3 dDir[2] = {};  // d(dir) per pixel in x and y, for differentials
+};
+
+enum class RayStatus : uint8_t {
+  Escaped,
+  Captured,
+  Disk,
+  Surface, // hit an object of TraceConfig::scene
+  Unfinished,
+};
+
+struct RayHit {
+  glm::vec3 dir;     // direction at escape, scene space
+  glm::vec3 dDir[2]; // d(dir) per pixel, zero unless Precision::Differential
+  glm::vec3 point;   // RayStatus::Surface: where, the normal and material
+  glm::vec3 normal;
+  int material;
+  float diskRadius;  // in r_s, valid for RayStatus::Disk
+  int steps;
+  RayStatus status;
+};
+
+// Solid angle one pixel covers on the sky, from the exit-direction
+// derivatives.
+inline float skyFootprint(const RayHit &hit) {
+  return glm::length(glm::cross(hit.dDir[0], hit.dDir[1]));
+}
+
+// How much the lens magnifies the sky behind this pixel: the pixel's solid
+// angle at the camera over its footprint on the sky.
+inline float magnification(const Ray &ray, const RayHit &hit) {
+  return glm::length(glm::cross(ray.dDir[0], ray.dDir[1])) /
+         skyFootprint(hit);
+}
+
+struct TraceConfig {
+  int maxSteps = 2000;
+  float stepScale = 0.06f;    // step length as a fraction of (r + r_s)
+  float escapeRadius = 50.0f; // in r_s (scene units for flat space)
+  float farField = 20.0f;     // r_s; outward rays past it finish analytically
+  float diskInner = 3.0f;     // r_s
+  float diskOuter = 8.0f;
+  float influence = 20.0f; // r_s; several holes: exact force inside, weak out
+  float opening = 0.5f;    // several holes: BVH node extent / distance limit
+  const SceneBVH *scene = nullptr; // objects rays can hit, if any
+};
+
+// Differential traces in double with dual numbers carrying the exit
+// direction's derivatives with respect to the pixel position.
+enum class Precision { Float, Double, Differential };
+using DualReal = Dual<double, 2>;
+
+// Lane occupancy of the packet loop: every packet step costs Width slots,
+// of which laneSteps carried a live ray.
+struct TraceStats {
+  uint64_t laneSteps = 0;
+  uint64_t slotSteps = 0;
+
+  double utilization() const {
+    return slotSteps ? (double)laneSteps / (double)slotSteps : 1.0;
+  }
+};
+
+// ---------------- Tracer ----------------
+// Integrates packets of Width rays in lockstep with classic RK4. Metric,
+// scalar type and packet width are all template parameters, so the step
+// loop has no virtual calls; finished lanes are masked with a zero step.
+template <class Metric, class Real, int Width> struct Tracer {
+  static constexpr int Dim = Metric::Dim;
+  using State = Real[Dim][Width];
+
+  Metric metric;
+  TraceConfig cfg;
+  glm::vec3 center;
+
+  Tracer(const BlackHole &bh, const TraceConfig &config)
+      : metric(bh), cfg(config), center(bh.position) {}
+
+  void eval(const State &y, State &dy) const {
+    for (int l = 0; l < Width; l++) {
+      Real s[Dim], d[Dim];
+      for (int k = 0; k < Dim; k++)
+        s[k] = y[k][l];
+      metric.rhs(s, d);
+      for (int k = 0; k < Dim; k++)
+        dy[k][l] = d[k];
+    }
+  }
+
+  // One RK4 step per lane; lanes with h = 0 are left untouched. f holds
+  // rhs(y) on entry and rhs of the new y on exit, which is both the next
+  // step's first stage and the end slope of the dense-output interpolant.
+  void step(State &y, State &f, const Real (&h)[Width]) const {
+    State k2, k3, k4, t;
+    for (int k = 0; k < Dim; k++)
+      for (int l = 0; l < Width; l++)
+        t[k][l] = y[k][l] + Real(0.5) * h[l] * f[k][l];
+    eval(t, k2);
+    for (int k = 0; k < Dim; k++)
+      for (int l = 0; l < Width; l++)
+        t[k][l] = y[k][l] + Real(0.5) * h[l] * k2[k][l];
+    eval(t, k3);
+    for (int k = 0; k < Dim; k++)
+      for (int l = 0; l < Width; l++)
+        t[k][l] = y[k][l] + h[l] * k3[k][l];
+    eval(t, k4);
+    for (int k = 0; k < Dim; k++)
+      for (int l = 0; l < Width; l++)
+        y[k][l] += h[l] / Real(6) *
+                   (f[k][l] + Real(2) * (k2[k][l] + k3[k][l]) + k4[k][l]);
+    eval(y, f);
+  }
+
+  void lane(const State &y, int l, Real s[Dim]) const {
+    for (int k = 0; k < Dim; k++)
+      s[k] = y[k][l];
+  }
+
+  // ---------------- Dense output ----------------
+  // Cubic Hermite interpolant through both ends of a step and their slopes,
+  // theta in [0, 1]. Costs no extra rhs evaluations.
+  struct Segment {
+    Real y0[Dim], f0[Dim], y1[Dim], f1[Dim];
+    Real h;
+
+    void at(Real theta, Real out[Dim]) const {
+      Real t2 = theta * theta, t3 = t2 * theta;
+      Real a0 = Real(2) * t3 - Real(3) * t2 + Real(1);
+      Real b0 = (t3 - Real(2) * t2 + theta) * h;
+      Real a1 = Real(3) * t2 - Real(2) * t3;
+      Real b1 = (t3 - t2) * h;
+      for (int k = 0; k < Dim; k++)
+        out[k] = a0 * y0[k] + b0 * f0[k] + a1 * y1[k] + b1 * f1[k];
+    }
+  };
+
+  // Root of g along the segment by Illinois false position, given the
+  // bracketing end values g0 and g1.
+  template <class Event>
+  Real locate(const Segment &seg, Event g, Real g0, Real g1) const {
+    Real a = Real(0), b = Real(1), ga = g0, gb = g1;
+    for (int it = 0; it < 16; it++) {
+      Real c = (a * gb - b * ga) / (gb - ga);
+      Real s[Dim];
+      seg.at(c, s);
+      Real gc = g(s);
+      if (gc * gb < Real(0)) {
+        a = b;
+        ga = gb;
+      } else {
+        ga = ga * Real(0.5);
+      }
+      b = c;
+      gb = gc;
+      Real w = b - a;
+      if (gc == Real(0) || (w < Real(0) ? -w : w) < Real(1e-5))
+        break;
+    }
+    return b;
+  }
+
+  // Weak-field bending still ahead of a ray at p heading along d, added to
+  // d in place. Integrating the transverse part of the Schwarzschild force
+  // along the straight line from p to infinity gives
+  //   da = (r_s / b) [1 - s0 (2 s0^2 + 3 b^2) / (2 r0^3)],
+  // with b the impact parameter and s0 the distance past closest approach;
+  // d turns towards the hole by da.
+  void farFieldTail(const Real p[3], Real d[3]) const {
+    using std::cos;
+    using std::sin;
+    using std::sqrt;
+    Real dn = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    Real u[3] = {d[0] / dn, d[1] / dn, d[2] / dn};
+    Real s0 = p[0] * u[0] + p[1] * u[1] + p[2] * u[2];
+    Real q[3] = {p[0] - s0 * u[0], p[1] - s0 * u[1], p[2] - s0 * u[2]};
+    Real b2 = q[0] * q[0] + q[1] * q[1] + q[2] * q[2];
+    Real r2 = s0 * s0 + b2;
+    Real b = sqrt(b2);
+    if (!(b > Real(0)))
+      return;
+    Real da = Real(metric.massRadius()) / b *
+              (Real(1) - s0 * (Real(2) * s0 * s0 + Real(3) * b2) /
+                             (Real(2) * r2 * sqrt(r2)));
+    Real c = cos(da), sn = sin(da) / b;
+    for (int i = 0; i < 3; i++)
+      d[i] = c * u[i] - sn * q[i];
+  }
+
+  // Loads ray into lane l of y and f.
+  void load(const Ray &ray, State &y, State &f, int l) const {
+    glm::vec3 o = ray.origin - center;
+    Real pos[3] = {Real(o.x), Real(o.y), Real(o.z)};
+    Real dir[3];
+    for (int i = 0; i < 3; i++) {
+      double dd[2] = {ray.dDir[0][i], ray.dDir[1][i]};
+      dir[i] = Tangents<Real>::seed(ray.dir[i], dd);
+    }
+    Real s[Dim], d[Dim];
+    metric.init(pos, dir, s);
+    metric.rhs(s, d);
+    for (int k = 0; k < Dim; k++) {
+      y[k][l] = s[k];
+      f[k][l] = d[k];
+    }
+  }
+
+  // Traces count rays through Width lanes. A lane that finishes writes its
+  // hit and immediately takes the next ray, so lanes only idle once the
+  // input runs dry; feeding rays sorted by binRays() keeps packets of
+  // similar orbits together. Disk, horizon and escape-sphere crossings are
+  // found by root-finding on each step's interpolant, so step length only
+  // has to resolve the orbit; scene objects are hit by each step's chord.
+  // Outward rays stop at cfg.farField and take the rest of their bending
+  // from farFieldTail(), then look for scene objects further out along
+  // that final direction.
+  void traceStream(const Ray *rays, size_t count, RayHit *out,
+                   TraceStats *stats = nullptr) const {
+    using std::sqrt;
+    if (!count)
+      return;
+    const Real horizon = Real(metric.horizon() * 1.01);
+    const Real scale = Real(metric.scale());
+    const bool tail = cfg.farField > 0.0f;
+    const Real escape =
+        Real((tail && cfg.farField < cfg.escapeRadius ? cfg.farField
+                                                       : cfg.escapeRadius) *
+             metric.scale());
+    const Real diskIn = Real(cfg.diskInner * metric.scale());
+    const Real diskOut = Real(cfg.diskOuter * metric.scale());
+
+    auto height = [&](const Real s[]) {
+      Real p[3];
+      metric.position(s, p);
+      return p[1];
+    };
+    auto toHorizon = [&](const Real s[]) { return metric.radius(s) - horizon; };
+    auto toEscape = [&](const Real s[]) { return metric.radius(s) - escape; };
+
+    State y, f;
+    size_t ray[Width];
+    bool alive[Width];
+    int steps[Width];
+    Real h[Width];
+    size_t next = 0;
+    for (int l = 0; l < Width; l++) {
+      alive[l] = next < count;
+      ray[l] = next;
+      steps[l] = 0;
+      load(rays[alive[l] ? next++ : 0], y, f, l);
+    }
+
+    auto finish = [&](int l, RayStatus status, Real diskR,
+                      SurfaceHit surface) {
+      Real s[Dim], d[3], p[3];
+      lane(y, l, s);
+      metric.direction(s, d);
+      metric.position(s, p);
+      if (tail && status == RayStatus::Escaped)
+        farFieldTail(p, d);
+      RayHit &hit = out[ray[l]];
+      Real n = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+      for (int i = 0; i < 3; i++) {
+        Real u = d[i] / n;
+        hit.dir[i] = (float)u;
+        hit.dDir[0][i] = (float)Tangents<Real>::get(u, 0);
+        hit.dDir[1][i] = (float)Tangents<Real>::get(u, 1);
+      }
+      glm::vec3 exit((float)p[0], (float)p[1], (float)p[2]);
+      if (status == RayStatus::Escaped && cfg.scene &&
+          cfg.scene->intersectRay(center + exit, hit.dir, surface))
+        status = RayStatus::Surface;
+      hit.diskRadius = (float)diskR;
+      if (status == RayStatus::Surface) {
+        hit.point = surface.point;
+        hit.normal = surface.normal;
+        hit.material = surface.material;
+      }
+      hit.steps = steps[l];
+      hit.status = status;
+
+      alive[l] = next < count;
+      if (alive[l]) {
+        ray[l] = next;
+        steps[l] = 0;
+        load(rays[next++], y, f, l);
+      }
+    };
+
+    uint64_t laneSteps = 0, slotSteps = 0;
+    for (;;) {
+      int live = 0;
+      for (int l = 0; l < Width; l++) {
+        Real s[Dim];
+        lane(y, l, s);
+        h[l] = alive[l] ? Real(cfg.stepScale) * (metric.radius(s) + scale) *
+                              metric.stepFactor(s)
+                        : Real(0);
+        live += alive[l];
+      }
+      if (!live)
+        break;
+      laneSteps += live;
+      slotSteps += Width;
+
+      State y0, f0;
+      for (int k = 0; k < Dim; k++)
+        for (int l = 0; l < Width; l++) {
+          y0[k][l] = y[k][l];
+          f0[k][l] = f[k][l];
+        }
+      step(y, f, h);
+
+      for (int l = 0; l < Width; l++) {
+        if (!alive[l])
+          continue;
+        steps[l]++;
+
+        Segment seg;
+        lane(y0, l, seg.y0);
+        lane(f0, l, seg.f0);
+        lane(y, l, seg.y1);
+        lane(f, l, seg.f1);
+        seg.h = h[l];
+
+        // earliest event in this step wins
+        Real theta = Real(2);
+        Real diskR = Real(0);
+        RayStatus event = RayStatus::Unfinished;
+
+        Real r1 = metric.radius(seg.y1);
+        if (!(r1 >= horizon)) {
+          Real g0 = toHorizon(seg.y0), g1 = r1 - horizon;
+          theta = g1 == g1 ? locate(seg, toHorizon, g0, g1) : Real(1);
+          event = RayStatus::Captured;
+        }
+
+        Real z0 = height(seg.y0), z1 = height(seg.y1);
+        if (z0 * z1 < Real(0)) {
+          Real t = locate(seg, height, z0, z1);
+          Real s[Dim], p[3];
+          seg.at(t, s);
+          metric.position(s, p);
+          Real rq = sqrt(p[0] * p[0] + p[2] * p[2]);
+          if (t < theta && rq > diskIn && rq < diskOut) {
+            theta = t;
+            event = RayStatus::Disk;
+            diskR = rq / scale;
+          }
+        }
+
+        SurfaceHit surface;
+        if (cfg.scene) {
+          Real p0[3], p1[3];
+          metric.position(seg.y0, p0);
+          metric.position(seg.y1, p1);
+          glm::vec3 a((float)p0[0], (float)p0[1], (float)p0[2]);
+          glm::vec3 b((float)p1[0], (float)p1[1], (float)p1[2]);
+          if (cfg.scene->intersect(center + a, center + b, surface) &&
+              Real(surface.t) < theta) {
+            theta = Real(surface.t);
+            event = RayStatus::Surface;
+          }
+        }
+
+        Real e0 = toEscape(seg.y0), e1 = r1 - escape;
+        if (event == RayStatus::Unfinished && e1 > Real(0)) {
+          Real p[3], d[3];
+          metric.position(seg.y1, p);
+          metric.direction(seg.y1, d);
+          if (p[0] * d[0] + p[1] * d[1] + p[2] * d[2] > Real(0)) {
+            theta = e0 < Real(0) ? locate(seg, toEscape, e0, e1) : Real(1);
+            event = RayStatus::Escaped;
+          }
+        }
+
+        if (event == RayStatus::Unfinished && steps[l] >= cfg.maxSteps)
+          theta = Real(1);
+        else if (event == RayStatus::Unfinished)
+          continue;
+        if (theta < Real(1)) {
+          Real s[Dim];
+          seg.at(theta, s);
+          for (int k = 0; k < Dim; k++)
+            y[k][l] = s[k];
+        }
+        finish(l, event, diskR, surface);
+      }
+    }
+
+    if (stats) {
+      stats->laneSteps += laneSteps;
+      stats->slotSteps += slotSteps;
+    }
+  }
+};
+
+// ---------------- Dispatch ----------------
+using TraceFn = void (*)(const BlackHole &bh, const TraceConfig &cfg,
+                         const Ray *rays, RayHit *out, size_t count,
+                         TraceStats *stats);
+
+// Picks the instantiation for bh.metric (for Auto: flat when massless, Kerr
+// when spinning), the requested precision and a packet width of 1, 4 or 8.
+TraceFn selectTracer(const BlackHole &bh, Precision precision, int width);
+
+// Orders rays so that packets see similar orbits: outward rays first, which
+// finish at once, then inward rays by impact parameter about the hole in
+// bins of r_s / 8. The sort is stable, so each bin keeps image order.
+void binRays(const BlackHole &bh, const Ray *rays, size_t count,
+             std::vector<uint32_t> &order);
+
+// Every metric the tracer is instantiated for; X(Name) names both
+// NameMetric and MetricType::Name.
+#define BLACKHOLE_TRACER_METRICS(X)                                            \
+  X(Flat) X(Schwarzschild) X(Kerr) BLACKHOLE_GENERATED_METRICS(X)
+
+#define BLACKHOLE_EXTERN_TRACERS(N)                                            \
+  extern template struct Tracer<N##Metric, float, 1>;                          \
+  extern template struct Tracer<N##Metric, float, 4>;                          \
+  extern template struct Tracer<N##Metric, float, 8>;                          \
+  extern template struct Tracer<N##Metric, double, 1>;                         \
+  extern template struct Tracer<N##Metric, double, 4>;                         \
+  extern template struct Tracer<N##Metric, double, 8>;                         \
+  extern template struct Tracer<N##Metric, DualReal, 4>;
+BLACKHOLE_TRACER_METRICS(BLACKHOLE_EXTERN_TRACERS)
+#undef BLACKHOLE_EXTERN_TRACERS
@@ -0,0 +1,523 @@
+#include "trajectory.hpp"
+#include "parallel.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include <unistd.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "trajectories are stored little-endian as in memory; this host is not"
+#endif
+
+namespace {
+
+const char Magic[8] = {'B', 'H', 'T', 'R', 'A', 'J', 0, 0};
+const uint32_t Version = 1;
+const uint32_t FrameTag = 0x46544842; // "BHTF"
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t chunk;
+  double quantum; // grid step, meters
+};
+
+// followed by `chunks` ChunkSizes, the meta block of a keyframe (ids,
+// masses, spins) and the chunk blocks
+struct FrameHeader {
+  uint32_t tag;
+  uint32_t key;
+  double time;
+  uint64_t count;
+  uint32_t chunks;
+  uint32_t metaRaw, metaCoded;
+  uint32_t reserved;
+};
+
+struct ChunkSizes {
+  uint32_t raw, coded;
+};
+
+// Prediction weights in fixed point: the encoder and decoder must agree to
+// the last bit, which floating-point sums do not promise across inlining
+// and contraction.
+constexpr int Shift = 20;
+
+// Lagrange weights extrapolating the `known` latest samples (newest first)
+// to t, falling back to fewer samples when their times are not distinct.
+void weights(const double times[3], int known, double t, int64_t w[3]) {
+  double l[3] = {0.0, 0.0, 0.0};
+  if (known >= 3 && times[0] > times[1] && times[1] > times[2]) {
+    for (int i = 0; i < 3; i++) {
+      l[i] = 1.0;
+      for (int j = 0; j < 3; j++)
+        if (j != i)
+          l[i] *= (t - times[j]) / (times[i] - times[j]);
+    }
+  } else if (known >= 2 && times[0] > times[1]) {
+    l[0] = (t - times[1]) / (times[0] - times[1]);
+    l[1] = 1.0 - l[0];
+  } else if (known >= 1) {
+    l[0] = 1.0;
+  }
+  for (int i = 0; i < 3; i++)
+    w[i] = std::llround(std::clamp(l[i], -1.0e4, 1.0e4) * (1 << Shift));
+}
+
+// Prediction for body i on one axis from the `known` latest frames.
+int64_t predict(const int64_t w[3], const std::vector<int64_t> (&history)[3],
+                int known, size_t i) {
+  int64_t sum = 1 << (Shift - 1);
+  for (int age = 0; age < known; age++)
+    sum += w[age] * history[age][i];
+  return sum >> Shift;
+}
+
+// Carries the prediction history over from one set of ids to another,
+// both ascending. Bodies without a past are marked fresh and coded whole.
+void remap(std::vector<int64_t> (&history)[3][3], int known,
+           const std::vector<uint32_t> &from, const std::vector<uint32_t> &to,
+           std::vector<char> &fresh) {
+  std::vector<size_t> source(to.size(), 0);
+  fresh.assign(to.size(), 1);
+  for (size_t i = 0, j = 0; i < to.size(); i++) {
+    while (j < from.size() && from[j] < to[i])
+      j++;
+    if (j < from.size() && from[j] == to[i]) {
+      source[i] = j;
+      fresh[i] = 0;
+    }
+  }
+  for (int k = 0; k < 3; k++)
+    for (int age = 0; age < known; age++) {
+      std::vector<int64_t> moved(to.size(), 0);
+      for (size_t i = 0; i < to.size(); i++)
+        if (!fresh[i])
+          moved[i] = history[k][age][source[i]];
+      history[k][age].swap(moved);
+    }
+}
+
+void putVarint(std::vector<unsigned char> &out, int64_t v) {
+  uint64_t z = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+  while (z >= 0x80) {
+    out.push_back((unsigned char)(z | 0x80));
+    z >>= 7;
+  }
+  out.push_back((unsigned char)z);
+}
+
+int64_t getVarint(const unsigned char *&p) {
+  uint64_t z = 0;
+  for (int shift = 0;; shift += 7) {
+    unsigned char b = *p++;
+    z |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      break;
+  }
+  return (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+}
+
+bool deflateBlock(const std::vector<unsigned char> &raw, int level,
+                  std::vector<unsigned char> &coded) {
+  uLongf size = compressBound((uLong)raw.size());
+  coded.resize(size);
+  if (compress2(coded.data(), &size, raw.data(), (uLong)raw.size(), level) !=
+      Z_OK)
+    return false;
+  coded.resize(size);
+  return true;
+}
+
+bool inflateBlock(const unsigned char *coded, size_t codedSize,
+                  std::vector<unsigned char> &raw) {
+  uLongf size = (uLongf)raw.size();
+  return uncompress(raw.data(), &size, coded, (uLong)codedSize) == Z_OK &&
+         size == raw.size();
+}
+
+long fileSize(FILE *file) {
+  std::fseek(file, 0, SEEK_END);
+  return std::ftell(file);
+}
+
+// Reads the frame header at the file position and moves past the frame.
+// False at the end of the file or on a frame cut short; sizes are checked
+// against the file before anything is allocated for them.
+bool skipFrame(FILE *file, long size, FrameHeader &header) {
+  long at = std::ftell(file);
+  if (std::fread(&header, sizeof header, 1, file) != 1 ||
+      header.tag != FrameTag ||
+      header.chunks > (uint64_t)(size - at) / sizeof(ChunkSizes))
+    return false;
+  std::vector<ChunkSizes> sizes(header.chunks);
+  if (std::fread(sizes.data(), sizeof(ChunkSizes), sizes.size(), file) !=
+      sizes.size())
+    return false;
+  long end = std::ftell(file) + (long)header.metaCoded;
+  for (const ChunkSizes &s : sizes)
+    end += s.coded;
+  return end <= size && std::fseek(file, end, SEEK_SET) == 0;
+}
+
+} // namespace
+
+// ---------------- Writer ----------------
+TrajectoryWriter::~TrajectoryWriter() { close(); }
+
+bool TrajectoryWriter::open(const std::string &path,
+                            const TrajectoryConfig &config, double until) {
+  close();
+  cfg = config;
+  FileHeader header{};
+  size_t kept = 0;
+  file = std::fopen(path.c_str(), "r+b");
+  if (file) {
+    if (std::fread(&header, sizeof header, 1, file) != 1 ||
+        std::memcmp(header.magic, Magic, 8) != 0 ||
+        header.version != Version || !(header.quantum > 0.0)) {
+      std::cerr << "'" << path << "' is not a trajectory; not overwriting\n";
+      close();
+      return false;
+    }
+    cfg.tolerance = 0.5 * header.quantum;
+    cfg.chunk = std::max<uint32_t>(header.chunk, 1);
+
+    // keep the whole frames up to `until`; the rest, and a frame cut
+    // short by a crash, are trimmed off
+    long size = fileSize(file), end = sizeof header;
+    std::fseek(file, end, SEEK_SET);
+    FrameHeader frame;
+    while (skipFrame(file, size, frame) && frame.time <= until) {
+      end = std::ftell(file);
+      kept++;
+    }
+    if (std::fflush(file) != 0 || ftruncate(fileno(file), end) != 0 ||
+        std::fseek(file, end, SEEK_SET) != 0) {
+      std::cerr << "Cannot trim trajectory '" << path << "'\n";
+      close();
+      return false;
+    }
+  } else {
+    file = std::fopen(path.c_str(), "wb");
+    std::memcpy(header.magic, Magic, 8);
+    header.version = Version;
+    header.chunk = (uint32_t)cfg.chunk;
+    header.quantum = 2.0 * cfg.tolerance;
+    if (!file || std::fwrite(&header, sizeof header, 1, file) != 1) {
+      std::cerr << "Cannot write trajectory '" << path << "'\n";
+      close();
+      return false;
+    }
+  }
+  // the history of the frames kept is gone, so start with a keyframe
+  known = 0;
+  frames = kept;
+  rawBytes = codedBytes = 0;
+  writer.start([this](TrajectoryFrame &frame) { encode(frame); });
+  return true;
+}
+
+void TrajectoryWriter::capture(const BodySystem &bodies, double time) {
+  if (!isOpen())
+    return;
+  writer.capture([&](TrajectoryFrame &frame) {
+    frame.time = time;
+    frame.ids = bodies.ids;
+    for (int k = 0; k < 3; k++)
+      frame.pos[k] = bodies.pos[k];
+    frame.mass = bodies.mass;
+    frame.spin = bodies.spin;
+  });
+}
+
+void TrajectoryWriter::encode(TrajectoryFrame &frame) {
+  const size_t n = frame.ids.size();
+  const double quantum = 2.0 * cfg.tolerance;
+
+  // id order keeps each body in place while the integrator reorders slots
+  std::vector<uint32_t> order(n);
+  for (uint32_t i = 0; i < n; i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return frame.ids[a] < frame.ids[b];
+  });
+  BodySystem::permute(frame.ids, order);
+  for (int k = 0; k < 3; k++)
+    BodySystem::permute(frame.pos[k], order);
+  BodySystem::permute(frame.mass, order);
+  BodySystem::permute(frame.spin, order);
+
+  // bodies that merged or appeared cost a new meta block, not a keyframe
+  bool changed = frame.ids != lastIds || frame.mass != lastMass ||
+                 frame.spin != lastSpin;
+  frame.key = known == 0 || frames % cfg.keyInterval == 0;
+  std::vector<char> fresh(n, 0);
+  if (frame.key)
+    known = 0;
+  else if (changed)
+    remap(history, known, lastIds, frame.ids, fresh);
+
+  std::vector<int64_t> q[3];
+  for (int k = 0; k < 3; k++) {
+    q[k].resize(n);
+    for (size_t i = 0; i < n; i++)
+      q[k][i] = std::llround(frame.pos[k][i] / quantum);
+  }
+  int64_t w[3];
+  weights(historyTime, known, frame.time, w);
+
+  // residuals against the prediction, or against the previous body of the
+  // chunk in a keyframe, planar per axis
+  size_t chunks = (n + cfg.chunk - 1) / cfg.chunk;
+  std::vector<std::vector<unsigned char>> coded(chunks);
+  std::vector<ChunkSizes> sizes(chunks);
+  parallelFor(chunks, 1, [&](size_t c) {
+    size_t begin = c * cfg.chunk, end = std::min(n, begin + cfg.chunk);
+    std::vector<unsigned char> raw;
+    raw.reserve((end - begin) * 6);
+    for (int k = 0; k < 3; k++)
+      for (size_t i = begin; i < end; i++) {
+        int64_t guess = frame.key  ? (i > begin ? q[k][i - 1] : 0)
+                        : fresh[i] ? 0
+                                   : predict(w, history[k], known, i);
+        putVarint(raw, q[k][i] - guess);
+      }
+    deflateBlock(raw, cfg.level, coded[c]);
+    sizes[c] = {(uint32_t)raw.size(), (uint32_t)coded[c].size()};
+  });
+
+  std::vector<unsigned char> meta, metaCoded;
+  if (frame.key || changed) {
+    auto append = [&](const void *p, size_t bytes) {
+      meta.insert(meta.end(), (const unsigned char *)p,
+                  (const unsigned char *)p + bytes);
+    };
+    append(frame.ids.data(), n * sizeof(uint32_t));
+    append(frame.mass.data(), n * sizeof(double));
+    append(frame.spin.data(), n * sizeof(double));
+    deflateBlock(meta, cfg.level, metaCoded);
+    lastIds = frame.ids;
+    lastMass = frame.mass;
+    lastSpin = frame.spin;
+  }
+
+  FrameHeader header{};
+  header.tag = FrameTag;
+  header.key = frame.key;
+  header.time = frame.time;
+  header.count = n;
+  header.chunks = (uint32_t)chunks;
+  header.metaRaw = (uint32_t)meta.size();
+  header.metaCoded = (uint32_t)metaCoded.size();
+  bool ok = std::fwrite(&header, sizeof header, 1, file) == 1 &&
+            std::fwrite(sizes.data(), sizeof(ChunkSizes), chunks, file) ==
+                chunks &&
+            std::fwrite(metaCoded.data(), 1, metaCoded.size(), file) ==
+                metaCoded.size();
+  uint64_t bytes = sizeof header + chunks * sizeof(ChunkSizes) +
+                   metaCoded.size();
+  for (const std::vector<unsigned char> &block : coded) {
+    ok = ok && std::fwrite(block.data(), 1, block.size(), file) ==
+                   block.size();
+    bytes += block.size();
+  }
+  if (!ok)
+    std::cerr << "Trajectory write failed\n";
+
+  for (int k = 0; k < 3; k++) {
+    history[k][2].swap(history[k][1]);
+    history[k][1].swap(history[k][0]);
+    history[k][0].swap(q[k]);
+  }
+  historyTime[2] = historyTime[1];
+  historyTime[1] = historyTime[0];
+  historyTime[0] = frame.time;
+  known = std::min(known + 1, 3);
+  frames++;
+  rawBytes += n * 3 * sizeof(double);
+  codedBytes += bytes;
+}
+
+void TrajectoryWriter::flush() { writer.flush(); }
+
+void TrajectoryWriter::close() {
+  writer.stop();
+  if (file)
+    std::fclose(file);
+  file = nullptr;
+}
+
+// ---------------- Reader ----------------
+TrajectoryReader::~TrajectoryReader() { close(); }
+
+bool TrajectoryReader::recognizes(const std::string &path) {
+  char magic[8];
+  FILE *f = std::fopen(path.c_str(), "rb");
+  bool ok = f && std::fread(magic, 8, 1, f) == 1 &&
+            std::memcmp(magic, Magic, 8) == 0;
+  if (f)
+    std::fclose(f);
+  return ok;
+}
+
+bool TrajectoryReader::open(const std::string &path) {
+  close();
+  file = std::fopen(path.c_str(), "rb");
+  FileHeader header;
+  if (!file || std::fread(&header, sizeof header, 1, file) != 1 ||
+      std::memcmp(header.magic, Magic, 8) != 0 || header.version != Version) {
+    std::cerr << "Cannot read trajectory '" << path << "'\n";
+    close();
+    return false;
+  }
+  quantum = header.quantum;
+  chunk = std::max<uint32_t>(header.chunk, 1);
+  start = std::ftell(file);
+
+  // index the whole frames; a torn tail from a run cut short is left out
+  long size = fileSize(file), offset = start;
+  std::fseek(file, start, SEEK_SET);
+  FrameHeader frame;
+  while (skipFrame(file, size, frame)) {
+    entries.push_back({offset, frame.time, frame.key != 0});
+    offset = std::ftell(file);
+  }
+  std::fseek(file, start, SEEK_SET);
+  known = 0;
+  return true;
+}
+
+double TrajectoryReader::keyTime(double t) const {
+  size_t k = 0;
+  for (size_t i = 0; i < entries.size() && entries[i].time <= t; i++)
+    if (entries[i].key)
+      k = i;
+  return entries.empty() ? 0.0 : entries[k].time;
+}
+
+void TrajectoryReader::close() {
+  if (file)
+    std::fclose(file);
+  file = nullptr;
+  entries.clear();
+  ids.clear();
+}
+
+bool TrajectoryReader::next(TrajectoryFrame &frame) {
+  // only frames open() found whole, so sizes read below are sound
+  if (!file || entries.empty() || std::ftell(file) > entries.back().offset)
+    return false;
+  FrameHeader header;
+  if (std::fread(&header, sizeof header, 1, file) != 1 ||
+      header.tag != FrameTag)
+    return false;
+  size_t n = (size_t)header.count;
+  std::vector<ChunkSizes> sizes(header.chunks);
+  std::vector<unsigned char> metaCoded(header.metaCoded);
+  if (std::fread(sizes.data(), sizeof(ChunkSizes), sizes.size(), file) !=
+          sizes.size() ||
+      std::fread(metaCoded.data(), 1, metaCoded.size(), file) !=
+          metaCoded.size())
+    return false;
+  std::vector<size_t> at(sizes.size() + 1, 0);
+  for (size_t c = 0; c < sizes.size(); c++)
+    at[c + 1] = at[c] + sizes[c].coded;
+  std::vector<unsigned char> blocks(at.back());
+  if (std::fread(blocks.data(), 1, blocks.size(), file) != blocks.size())
+    return false;
+
+  std::vector<char> fresh(n, 0);
+  if (header.metaRaw) {
+    std::vector<unsigned char> meta(header.metaRaw);
+    if (meta.size() != n * (sizeof(uint32_t) + 2 * sizeof(double)) ||
+        !inflateBlock(metaCoded.data(), metaCoded.size(), meta))
+      return false;
+    std::vector<uint32_t> previous(n);
+    previous.swap(ids);
+    mass.resize(n);
+    spin.resize(n);
+    const unsigned char *p = meta.data();
+    std::memcpy(ids.data(), p, n * sizeof(uint32_t));
+    std::memcpy(mass.data(), p + n * sizeof(uint32_t), n * sizeof(double));
+    std::memcpy(spin.data(), p + n * (sizeof(uint32_t) + sizeof(double)),
+                n * sizeof(double));
+    if (header.key)
+      known = 0;
+    else
+      remap(history, known, previous, ids, fresh);
+  }
+  if (!header.key && (ids.size() != n || known == 0))
+    return false; // a delta frame needs the frames before it
+
+  int64_t w[3];
+  weights(historyTime, known, header.time, w);
+  std::vector<int64_t> q[3];
+  for (int k = 0; k < 3; k++)
+    q[k].resize(n);
+  std::vector<char> good(sizes.size(), 0);
+  parallelFor(sizes.size(), 1, [&](size_t c) {
+    size_t begin = c * chunk, end = std::min(n, begin + chunk);
+    std::vector<unsigned char> raw(sizes[c].raw);
+    if (!inflateBlock(blocks.data() + at[c], sizes[c].coded, raw))
+      return;
+    const unsigned char *p = raw.data(), *stop = p + raw.size();
+    for (int k = 0; k < 3; k++)
+      for (size_t i = begin; i < end; i++) {
+        if (p >= stop)
+          return;
+        int64_t guess = header.key ? (i > begin ? q[k][i - 1] : 0)
+                        : fresh[i] ? 0
+                                   : predict(w, history[k], known, i);
+        q[k][i] = guess + getVarint(p);
+      }
+    good[c] = 1;
+  });
+  if (std::count(good.begin(), good.end(), 0))
+    return false;
+
+  frame.time = header.time;
+  frame.key = header.key != 0;
+  frame.ids = ids;
+  frame.mass = mass;
+  frame.spin = spin;
+  for (int k = 0; k < 3; k++) {
+    frame.pos[k].resize(n);
+    for (size_t i = 0; i < n; i++)
+      frame.pos[k][i] = (double)q[k][i] * quantum;
+    history[k][2].swap(history[k][1]);
+    history[k][1].swap(history[k][0]);
+    history[k][0].swap(q[k]);
+  }
+  historyTime[2] = historyTime[1];
+  historyTime[1] = historyTime[0];
+  historyTime[0] = header.time;
+  known = std::min(known + 1, 3);
+  return true;
+}
+
+bool TrajectoryReader::seek(double t) {
+  if (!file)
+    return false;
+  size_t target = 0;
+  while (target + 1 < entries.size() && entries[target + 1].time <= t)
+    target++;
+  size_t key = target;
+  while (key > 0 && !entries[key].key)
+    key--;
+  if (entries.empty() || !entries[key].key)
+    return false;
+
+  std::fseek(file, entries[key].offset, SEEK_SET);
+  known = 0;
+  TrajectoryFrame skipped;
+  for (size_t k = key; k < target; k++)
+    if (!next(skipped))
+      return false;
+  return true;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "background.hpp"
+#include "bodies.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// ---------------- Compressed trajectories ----------------
+// Positions only, quantized to a grid of 2 * tolerance so no coordinate is
+// off by more than the tolerance, then coded as the residual against a
+// prediction both ends can make: the quadratic through the body's last
+// three decoded positions, extrapolated to the new frame's time (linear or
+// constant while fewer are known). Smooth orbits leave residuals of a few
+// grid steps, which zigzag varints store in a byte or two before deflate
+// squeezes them further. Bodies are coded in independent chunks, so both
+// ends run deflate and inflate on every core.
+//
+// Frames hold the bodies in id order. A keyframe, written every
+// keyInterval frames, restarts the prediction so a reader can start there;
+// it and any frame where bodies merged or appeared carry the ids, masses
+// and spins, and surviving bodies keep their prediction across a merger.
+struct TrajectoryConfig {
+  double tolerance = 0.05; // meters; far below a pixel at any sane zoom
+  int keyInterval = 64;    // frames between keyframes
+  size_t chunk = 4096;     // bodies per deflate block
+  int level = 6;           // zlib level
+};
+
+struct TrajectoryFrame {
+  double time = 0.0;
+  bool key = false;
+  std::vector<uint32_t> ids;
+  std::vector<double> pos[3];
+  std::vector<double> mass, spin;
+};
+
+// Codes and writes frames on a background thread: capture() copies the
+// bodies into the back buffer and only blocks while the writer is a whole
+// frame behind.
+struct TrajectoryWriter {
+  ~TrajectoryWriter();
+
+  // Starts a new file, or continues an existing one after its last whole
+  // frame at or before `until` (keeping that file's tolerance and chunk),
+  // so a resumed run takes over where its checkpoint left off. The first
+  // frame written is always a keyframe. Prints the reason and returns
+  // false on failure.
+  bool open(const std::string &path,
+            const TrajectoryConfig &config = TrajectoryConfig(),
+            double until = INFINITY);
+  bool isOpen() const { return file != nullptr; }
+
+  void capture(const BodySystem &bodies, double time);
+  void flush();
+  void close();
+
+  size_t frames = 0;
+  uint64_t rawBytes = 0, codedBytes = 0; // positions as doubles, on disk
+
+private:
+  TrajectoryConfig cfg;
+  FILE *file = nullptr;
+
+  // coder state, owned by the writer thread
+  std::vector<uint32_t> lastIds;
+  std::vector<double> lastMass, lastSpin;
+  std::vector<int64_t> history[3][3]; // [axis][age] quantized positions
+  double historyTime[3] = {};
+  int known = 0;
+
+  // last, so its thread is gone before the state it codes with
+  BackgroundWriter<TrajectoryFrame> writer;
+
+  void encode(TrajectoryFrame &frame);
+};
+
+// Streaming decoder: frames come out one at a time in order, holding only
+// the prediction history in memory. open() indexes the frame headers, so
+// the run's times are known up front.
+struct TrajectoryReader {
+  ~TrajectoryReader();
+
+  // True if `path` starts like a trajectory file.
+  static bool recognizes(const std::string &path);
+
+  bool open(const std::string &path);
+  void close();
+
+  size_t frames() const { return entries.size(); }
+  double time(size_t k) const { return entries[k].time; }
+
+  // Time of the last keyframe at or before t, or of the first frame.
+  double keyTime(double t) const;
+
+  // Decodes the next frame into `frame`; false at the end of the file.
+  bool next(TrajectoryFrame &frame);
+
+  // Positions the reader so next() returns the last frame at or before t,
+  // decoding forward from the keyframe before it.
+  bool seek(double t);
+
+  double tolerance() const { return quantum * 0.5; }
+
+private:
+  FILE *file = nullptr;
+  double quantum = 0.0;
+  size_t chunk = 1; // bodies per block
+  long start = 0;   // offset of the first frame
+
+  struct Entry {
+    long offset;
+    double time;
+    bool key;
+  };
+  std::vector<Entry> entries; // whole frames, in file order
+
+  std::vector<uint32_t> ids;
+  std::vector<double> mass, spin;
+  std::vector<int64_t> history[3][3];
+  double historyTime[3] = {};
+  int known = 0;
+};
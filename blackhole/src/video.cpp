@@ -0,0 +1,163 @@
+#include "video.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+VideoWriter::~VideoWriter() { close(); }
+
+bool VideoWriter::open(const std::string &path, int width, int height,
+                       int fps, size_t queueDepth) {
+  close();
+  std::string size = std::to_string(width) + "x" + std::to_string(height);
+  std::string rate = std::to_string(fps);
+  const char *argv[] = {"ffmpeg", "-loglevel", "error", "-y",
+                        "-f", "rawvideo", "-pix_fmt", "rgb24",
+                        "-s", size.c_str(), "-r", rate.c_str(),
+                        "-i", "-", "-vf", "vflip",
+                        "-c:v", "libx264", "-pix_fmt", "yuv420p",
+                        "-crf", "18", path.c_str(), nullptr};
+
+  // frames go down `data`; `status` stays silent unless exec fails, in
+  // which case the child sends its errno before exiting
+  int data[2], status[2];
+  if (::pipe(data) != 0) {
+    std::cerr << "Cannot start ffmpeg: " << std::strerror(errno) << "\n";
+    return false;
+  }
+  if (::pipe(status) != 0) {
+    std::cerr << "Cannot start ffmpeg: " << std::strerror(errno) << "\n";
+    ::close(data[0]);
+    ::close(data[1]);
+    return false;
+  }
+  fcntl(data[1], F_SETFD, FD_CLOEXEC);
+  fcntl(status[1], F_SETFD, FD_CLOEXEC);
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(data[0], STDIN_FILENO);
+    ::close(data[0]);
+    ::close(status[0]);
+    execvp("ffmpeg", (char *const *)argv);
+    int error = errno;
+    ssize_t sent = write(status[1], &error, sizeof error);
+    (void)sent;
+    _exit(127);
+  }
+  ::close(data[0]);
+  ::close(status[1]);
+  int error = 0;
+  ssize_t got = pid > 0 ? read(status[0], &error, sizeof error) : -1;
+  ::close(status[0]);
+  if (pid < 0 || got != 0) {
+    std::cerr << "Cannot run ffmpeg: "
+              << std::strerror(pid < 0 ? errno : error) << "\n";
+    ::close(data[1]);
+    if (pid > 0)
+      waitpid(pid, nullptr, 0);
+    return false;
+  }
+
+  // a dead encoder shows up as EPIPE from write() instead of killing us
+  std::signal(SIGPIPE, SIG_IGN);
+  child = pid;
+  fd = data[1];
+  w = width;
+  h = height;
+  depth = queueDepth ? queueDepth : 1;
+  queue.clear();
+  spare.clear();
+  submitted = written = 0;
+  stopping = failed = false;
+  thread = std::thread([this] { run(); });
+  return true;
+}
+
+std::vector<uint8_t> VideoWriter::acquire() {
+  std::unique_lock<std::mutex> lock(mutex);
+  wake.wait(lock, [&] { return queue.size() < depth; });
+  std::vector<uint8_t> frame;
+  if (!spare.empty()) {
+    frame.swap(spare.back());
+    spare.pop_back();
+  }
+  frame.resize((size_t)w * h * 3);
+  return frame;
+}
+
+void VideoWriter::submit(std::vector<uint8_t> &&frame) {
+  std::lock_guard<std::mutex> lock(mutex);
+  queue.push_back(std::move(frame));
+  submitted++;
+  wake.notify_all();
+}
+
+size_t VideoWriter::framesWritten() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return written;
+}
+
+static bool writeAll(int fd, const uint8_t *p, size_t n) {
+  while (n) {
+    ssize_t done = write(fd, p, n);
+    if (done < 0 && errno == EINTR)
+      continue;
+    if (done <= 0)
+      return false;
+    p += done;
+    n -= (size_t)done;
+  }
+  return true;
+}
+
+void VideoWriter::run() {
+  for (;;) {
+    std::unique_lock<std::mutex> lock(mutex);
+    wake.wait(lock, [&] { return !queue.empty() || stopping; });
+    if (queue.empty())
+      return;
+    std::vector<uint8_t> frame = std::move(queue.front());
+    queue.pop_front();
+    bool skip = failed; // keep draining so acquire() never waits forever
+    lock.unlock();
+
+    bool ok = skip || writeAll(fd, frame.data(), frame.size());
+
+    lock.lock();
+    if (!ok) {
+      std::cerr << "ffmpeg stopped taking frames at frame " << written
+                << ": " << std::strerror(errno) << "\n";
+      failed = true;
+    } else if (!skip) {
+      written++;
+    }
+    spare.push_back(std::move(frame));
+    wake.notify_all();
+  }
+}
+
+bool VideoWriter::close() {
+  if (child <= 0)
+    return true;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  thread.join();
+  ::close(fd);
+  int status = 0;
+  bool ok = waitpid(child, &status, 0) == child && WIFEXITED(status) &&
+            WEXITSTATUS(status) == 0 && !failed;
+  if (!ok)
+    std::cerr << "ffmpeg did not finish the video (" << written << " of "
+              << submitted << " frames sent)\n";
+  child = -1;
+  fd = -1;
+  return ok;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+// ---------------- Video ----------------
+// Streams frames into an ffmpeg child over a pipe, so a rendered sequence
+// never touches the disk as images. Frames are raw RGB8, bottom row first
+// as glReadPixels leaves them; ffmpeg flips and encodes them. The render
+// loop fills a buffer from acquire(), hands it to submit() and carries on,
+// while a writer thread feeds the pipe. At most `depth` frames wait in the
+// queue: when the encoder falls behind, acquire() blocks rather than
+// letting the queue grow, and the buffers are reused frame after frame.
+struct VideoWriter {
+  ~VideoWriter();
+
+  // Starts `ffmpeg` writing `path`; prints the reason and returns false if
+  // it cannot be run.
+  bool open(const std::string &path, int width, int height, int fps,
+            size_t depth = 4);
+  bool isOpen() const { return child > 0; }
+  int width() const { return w; }
+  int height() const { return h; }
+
+  // A width * height * 3 byte buffer for the next frame, waiting for one
+  // while the queue is full.
+  std::vector<uint8_t> acquire();
+  void submit(std::vector<uint8_t> &&frame);
+
+  // Sends every queued frame, closes the pipe and waits for ffmpeg to
+  // finish the file; false if anything went wrong on the way.
+  bool close();
+
+  size_t framesWritten() const;
+
+private:
+  pid_t child = -1;
+  int fd = -1; // ffmpeg stdin
+  int w = 0, h = 0;
+  size_t depth = 0;
+
+  std::thread thread;
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<std::vector<uint8_t>> queue; // oldest first
+  std::vector<std::vector<uint8_t>> spare;
+  size_t submitted = 0, written = 0; // frame numbers
+  bool stopping = false, failed = false;
+
+  void run();
+};
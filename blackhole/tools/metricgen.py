@@ -0,0 +1,662 @@
+#!/usr/bin/env python3
+"""Generate geodesic kernels from metric descriptions.
+
+Each .metric file lists the covariant components g_ab of a stationary
+metric in (t, r, th, ph) coordinates. The generator differentiates them
+symbolically, inverts the metric block by block, and emits one C++ struct
+per metric with straight-line, common-subexpression-eliminated code for
+
+    metric(x, g)              g_ab at x
+    christoffel(x, gamma)     Gamma^m_ab at x
+    rhs(y, dy)                geodesic equation for y = (x^m, k^m)
+
+File format, one directive per line, '#' starts a comment:
+
+    name    ReissnerNordstrom            -> ReissnerNordstromMetric
+    cli     reissner-nordstrom           --metric name, default from name
+    chart   spherical | oblate <p> | wormhole <p>
+    param   <name> = <C++ expression of `bh`>
+    scale   = <C++ expression of params>   characteristic length
+    horizon = <C++ expression of params>   capture radius, 0 for none
+    mass    = <C++ expression of params>   r_s seen from far away, 0 default
+    g_<a><b> = <expression>                a, b in t, r, th, ph
+
+Expressions use + - * / **, numbers, parameters, coordinates and
+sin, cos, sqrt, exp, log. Only the standard library is needed.
+
+A second header (--types) lists every metric with its --metric name and
+includes nothing, so objects.hpp can build MetricType from it: a new .metric
+file is picked up by the build without touching any source.
+"""
+
+import argparse
+import ast
+import os
+import re
+import sys
+from fractions import Fraction
+
+COORDS = ["t", "r", "th", "ph"]
+BUILTIN = ("Auto", "Flat", "Schwarzschild", "Kerr")  # MetricType by hand
+
+
+# ---------------- Expressions ----------------
+# Nodes are hash-consed: structurally equal expressions are the same
+# object, which gives common-subexpression elimination for free and a
+# cheap canonical order (creation id) for commutative operands.
+class Node:
+    __slots__ = ("op", "args", "value", "id")
+
+    def __repr__(self):
+        return "Node(%s, %r, %d)" % (self.op, self.value, self.id)
+
+
+_table = {}
+
+
+def _node(op, args=(), value=None):
+    key = (op, tuple(a.id for a in args), value)
+    n = _table.get(key)
+    if n is None:
+        n = Node()
+        n.op, n.args, n.value, n.id = op, tuple(args), value, len(_table)
+        _table[key] = n
+    return n
+
+
+def const(v):
+    return _node("c", value=Fraction(v))
+
+
+def sym(name):
+    return _node("s", value=name)
+
+
+ZERO = const(0)
+ONE = const(1)
+
+
+def is_const(n, v=None):
+    return n.op == "c" and (v is None or n.value == v)
+
+
+def _split_coef(n):
+    """term -> (coefficient, core) so 3*x*y -> (3, x*y)"""
+    if n.op == "c":
+        return n.value, ONE
+    if n.op == "*" and n.args[0].op == "c":
+        rest = n.args[1:]
+        return n.args[0].value, rest[0] if len(rest) == 1 else _node("*", rest)
+    return Fraction(1), n
+
+
+def add(*xs):
+    terms = []
+    for x in xs:
+        terms.extend(x.args if x.op == "+" else [x])
+    coefs = {}
+    cores = {}
+    for t in terms:
+        k, core = _split_coef(t)
+        coefs[core.id] = coefs.get(core.id, Fraction(0)) + k
+        cores[core.id] = core
+    out = []
+    for cid in sorted(coefs):
+        k = coefs[cid]
+        if k == 0:
+            continue
+        core = cores[cid]
+        out.append(const(k) if core is ONE else mul(const(k), core))
+    if not out:
+        return ZERO
+    if len(out) == 1:
+        return out[0]
+    return _node("+", sorted(out, key=lambda n: n.id))
+
+
+def _split_pow(n):
+    if n.op == "^":
+        return n.args[0], n.value
+    return n, Fraction(1)
+
+
+def mul(*xs):
+    factors = []
+    for x in xs:
+        factors.extend(x.args if x.op == "*" else [x])
+    k = Fraction(1)
+    exps = {}
+    bases = {}
+    for f in factors:
+        if f.op == "c":
+            k *= f.value
+            continue
+        b, e = _split_pow(f)
+        exps[b.id] = exps.get(b.id, Fraction(0)) + e
+        bases[b.id] = b
+    if k == 0:
+        return ZERO
+    out = []
+    for bid in sorted(exps):
+        p = pw(bases[bid], exps[bid])
+        if p is ONE:
+            continue
+        if p.op == "c":
+            k *= p.value
+        else:
+            out.append(p)
+    if not out:
+        return const(k)
+    out.sort(key=lambda n: n.id)
+    if k != 1:
+        out.insert(0, const(k))
+    if len(out) == 1:
+        return out[0]
+    return _node("*", out)
+
+
+def pw(b, e):
+    e = Fraction(e)
+    if e == 0:
+        return ONE
+    if e == 1:
+        return b
+    if b.op == "c":
+        if e.denominator == 1 and (b.value != 0 or e > 0):
+            return const(b.value ** int(e))
+    if b.op == "^" and e.denominator == 1:
+        return pw(b.args[0], b.value * e)
+    if b.op == "*" and e.denominator == 1:
+        return mul(*[pw(f, e) for f in b.args])
+    return _node("^", (b,), e)
+
+
+def neg(x):
+    return mul(const(-1), x)
+
+
+def sub(a, b):
+    return add(a, neg(b))
+
+
+def div(a, b):
+    return mul(a, pw(b, -1))
+
+
+def func(name, x):
+    if name == "sqrt":
+        return pw(x, Fraction(1, 2))
+    if x.op == "c" and x.value == 0:
+        return {"sin": ZERO, "cos": ONE, "exp": ONE}.get(name) or _node(
+            "f", (x,), name)
+    return _node("f", (x,), name)
+
+
+def diff(n, var, memo=None):
+    if memo is None:
+        memo = {}
+    if n.id in memo:
+        return memo[n.id]
+    if n.op == "c":
+        d = ZERO
+    elif n.op == "s":
+        d = ONE if n.value == var else ZERO
+    elif n.op == "+":
+        d = add(*[diff(a, var, memo) for a in n.args])
+    elif n.op == "*":
+        terms = []
+        for i, a in enumerate(n.args):
+            da = diff(a, var, memo)
+            if da is not ZERO:
+                terms.append(mul(da, *(n.args[:i] + n.args[i + 1:])))
+        d = add(*terms) if terms else ZERO
+    elif n.op == "^":
+        b = n.args[0]
+        db = diff(b, var, memo)
+        d = ZERO if db is ZERO else mul(const(n.value), pw(b, n.value - 1), db)
+    else:
+        u = n.args[0]
+        du = diff(u, var, memo)
+        if du is ZERO:
+            d = ZERO
+        elif n.value == "sin":
+            d = mul(func("cos", u), du)
+        elif n.value == "cos":
+            d = neg(mul(func("sin", u), du))
+        elif n.value == "exp":
+            d = mul(n, du)
+        elif n.value == "log":
+            d = div(du, u)
+        else:
+            raise ValueError("cannot differentiate " + n.value)
+    memo[n.id] = d
+    return d
+
+
+# ---------------- Parsing ----------------
+def parse_expr(text, symbols, where):
+    def walk(e):
+        if isinstance(e, ast.BinOp):
+            a, b = walk(e.left), walk(e.right)
+            if isinstance(e.op, ast.Add):
+                return add(a, b)
+            if isinstance(e.op, ast.Sub):
+                return sub(a, b)
+            if isinstance(e.op, ast.Mult):
+                return mul(a, b)
+            if isinstance(e.op, ast.Div):
+                return div(a, b)
+            if isinstance(e.op, ast.Pow):
+                if b.op != "c":
+                    raise ValueError("%s: exponents must be constant" % where)
+                return pw(a, b.value)
+        elif isinstance(e, ast.UnaryOp):
+            if isinstance(e.op, ast.USub):
+                return neg(walk(e.operand))
+            if isinstance(e.op, ast.UAdd):
+                return walk(e.operand)
+        elif isinstance(e, ast.Constant) and isinstance(e.value, (int, float)):
+            return const(Fraction(str(e.value)))
+        elif isinstance(e, ast.Name):
+            if e.id not in symbols:
+                raise ValueError("%s: unknown symbol '%s'" % (where, e.id))
+            return sym(e.id)
+        elif isinstance(e, ast.Call) and isinstance(e.func, ast.Name):
+            if e.func.id in ("sin", "cos", "sqrt", "exp", "log") and len(e.args) == 1:
+                return func(e.func.id, walk(e.args[0]))
+        raise ValueError("%s: unsupported expression '%s'" % (where, ast.dump(e)))
+
+    return walk(ast.parse(text.strip(), mode="eval").body)
+
+
+class MetricSpec:
+    def __init__(self, path):
+        self.path = path
+        self.name = None
+        self.cli = None
+        self.chart = ("spherical", None)
+        self.params = []  # (name, C++ initializer)
+        self.scale = None
+        self.horizon = "0.0"
+        self.mass = "0.0"
+        self.g = {}  # (i, j) -> source text, i <= j
+
+
+def read_spec(path):
+    spec = MetricSpec(path)
+    with open(path) as f:
+        for lineno, raw in enumerate(f, 1):
+            line = raw.split("#", 1)[0].strip()
+            if not line:
+                continue
+            where = "%s:%d" % (path, lineno)
+            m = re.match(r"(\w+)\s*(.*)$", line)
+            key, rest = m.group(1), m.group(2).strip()
+            if key == "name":
+                spec.name = rest
+            elif key == "cli":
+                spec.cli = rest
+            elif key == "chart":
+                words = rest.split()
+                spec.chart = (words[0], words[1] if len(words) > 1 else None)
+            elif key == "param":
+                pname, init = [s.strip() for s in rest.split("=", 1)]
+                spec.params.append((pname, init))
+            elif key in ("scale", "horizon", "mass"):
+                setattr(spec, key, rest.lstrip("=").strip())
+            elif key.startswith("g_"):
+                idx = key[2:]
+                pair = None
+                for a in COORDS:
+                    for b in COORDS:
+                        if a + b == idx:
+                            pair = (COORDS.index(a), COORDS.index(b))
+                if pair is None:
+                    raise ValueError("%s: bad component %s" % (where, key))
+                i, j = sorted(pair)
+                spec.g[(i, j)] = (rest.lstrip("=").strip(), where)
+            else:
+                raise ValueError("%s: unknown directive '%s'" % (where, key))
+    if not spec.name:
+        raise ValueError("%s: missing name" % path)
+    if spec.name in BUILTIN:
+        raise ValueError("%s: %s is built in" % (path, spec.name))
+    if not spec.cli:
+        spec.cli = re.sub(r"(?<!^)(?=[A-Z])", "-", spec.name).lower()
+    if spec.chart[0] not in ("spherical", "oblate", "wormhole"):
+        raise ValueError("%s: unknown chart %s" % (path, spec.chart[0]))
+    if spec.scale is None:
+        spec.scale = spec.params[0][0]
+    return spec
+
+
+# ---------------- Kernel construction ----------------
+def blocks(nonzero):
+    """Connected components of the metric's sparsity graph."""
+    seen = set()
+    out = []
+    for i in range(4):
+        if i in seen:
+            continue
+        stack, comp = [i], []
+        while stack:
+            k = stack.pop()
+            if k in seen:
+                continue
+            seen.add(k)
+            comp.append(k)
+            stack.extend(j for j in range(4) if nonzero[k][j] and j not in seen)
+        out.append(sorted(comp))
+    return out
+
+
+def det(m):
+    n = len(m)
+    if n == 1:
+        return m[0][0]
+    terms = []
+    for j in range(n):
+        if m[0][j] is ZERO:
+            continue
+        minor = [row[:j] + row[j + 1:] for row in m[1:]]
+        t = mul(m[0][j], det(minor))
+        terms.append(t if j % 2 == 0 else neg(t))
+    return add(*terms) if terms else ZERO
+
+
+def inverse(g):
+    """Symbolic inverse in terms of the g_ab symbols, one block at a time."""
+    nonzero = [[g[i][j] is not ZERO for j in range(4)] for i in range(4)]
+    gi = [[ZERO] * 4 for _ in range(4)]
+    for comp in blocks(nonzero):
+        m = [[g[i][j] for j in comp] for i in comp]
+        inv_d = pw(det(m), -1)
+        n = len(comp)
+        for a in range(n):
+            for b in range(n):
+                minor = [row[:a] + row[a + 1:] for k, row in enumerate(m) if k != b]
+                cof = det(minor) if n > 1 else ONE
+                if (a + b) % 2:
+                    cof = neg(cof)
+                gi[comp[a]][comp[b]] = mul(cof, inv_d)
+    return gi
+
+
+def build(spec):
+    symbols = set(COORDS) | {p for p, _ in spec.params}
+    comps = [[ZERO] * 4 for _ in range(4)]
+    for (i, j), (text, where) in spec.g.items():
+        comps[i][j] = comps[j][i] = parse_expr(text, symbols, where)
+
+    # derivatives of the component expressions, dg[c][a][b] = d_c g_ab
+    dg = [[[diff(comps[a][b], COORDS[cc]) for b in range(4)] for a in range(4)]
+          for cc in range(4)]
+
+    # the inverse is built over g symbols so it stays a few multiplies
+    gs = [[sym("g%d%d" % (min(i, j), max(i, j))) if comps[i][j] is not ZERO
+           else ZERO for j in range(4)] for i in range(4)]
+    gi = inverse(gs)
+
+    gamma = [[[ZERO] * 4 for _ in range(4)] for _ in range(4)]
+    for m in range(4):
+        for a in range(4):
+            for b in range(a, 4):
+                terms = []
+                for n in range(4):
+                    if gi[m][n] is ZERO:
+                        continue
+                    bracket = add(dg[a][n][b], dg[b][n][a], neg(dg[n][a][b]))
+                    if bracket is not ZERO:
+                        terms.append(mul(const(Fraction(1, 2)), gi[m][n], bracket))
+                gamma[m][a][b] = gamma[m][b][a] = add(*terms) if terms else ZERO
+
+    # geodesic acceleration contracted directly against k, which lets CSE
+    # share the bracket terms instead of forming all 40 Christoffels
+    k = [sym("k" + c) for c in COORDS]
+    w = []
+    for n in range(4):
+        terms = []
+        for a in range(4):
+            for b in range(4):
+                t = sub(dg[a][n][b], mul(const(Fraction(1, 2)), dg[n][a][b]))
+                if t is not ZERO:
+                    terms.append(mul(t, k[a], k[b]))
+        w.append(add(*terms) if terms else ZERO)
+    acc = [neg(add(*[mul(gi[m][n], w[n]) for n in range(4)])) for m in range(4)]
+
+    return comps, gamma, acc
+
+
+# ---------------- C++ emission ----------------
+def fmt_const(v):
+    if v.denominator == 1:
+        return "R(%d)" % v.numerator
+    return "R(%r)" % float(v)
+
+
+class Emitter:
+    """Writes each distinct node once, as a const temporary, in dependency
+    order. Reciprocals and integer powers are shared between terms, so a
+    kernel performs one division per distinct denominator base."""
+
+    def __init__(self, indent):
+        self.lines = []
+        self.names = {}
+        self.powers = {}
+        self.used = set()
+        self.indent = indent
+        self.count = 0
+
+    def temp(self, text):
+        name = "t%d" % self.count
+        self.count += 1
+        self.lines.append("%sconst R %s = %s;" % (self.indent, name, text))
+        return name
+
+    def ref(self, n):
+        if n.op == "c":
+            return fmt_const(n.value)
+        if n.op == "s":
+            self.used.add(n.value)
+            return n.value
+        if n.id not in self.names:
+            if n.op == "^":
+                self.names[n.id] = self.power(n.args[0], n.value)
+            else:
+                self.names[n.id] = self.temp(self.expr(n))
+        return self.names[n.id]
+
+    def name_pow(self, base, e):
+        if e == 1:
+            return base
+        key = (base, e)
+        if key not in self.powers:
+            if e % 2 == 0:
+                half = self.name_pow(base, e // 2)
+                text = half + " * " + half
+            else:
+                text = self.name_pow(base, e - 1) + " * " + base
+            self.powers[key] = self.temp(text)
+        return self.powers[key]
+
+    def memo(self, key, text):
+        if key not in self.powers:
+            self.powers[key] = self.temp(text)
+        return self.powers[key]
+
+    def power(self, b, e):
+        if e.denominator == 1:
+            if e > 0:
+                return self.name_pow(self.ref(b), int(e))
+            inv = self.memo(("inv", b.id), "R(1) / " + self.ref(b))
+            return self.name_pow(inv, int(-e))
+        if e < 0:
+            return self.memo(("inv", b.id, e), "R(1) / " + self.power(b, -e))
+        if e.denominator == 2:
+            root = self.memo(("sqrt", b.id), "sqrt(" + self.ref(b) + ")")
+            whole = int(e - Fraction(1, 2))
+            if whole == 0:
+                return root
+            return self.memo(("sqrt", b.id, whole),
+                             root + " * " + self.name_pow(self.ref(b), whole))
+        # a plain scalar exponent, which Dual's pow takes too
+        return self.temp("pow(%s, %r)" % (self.ref(b), float(e)))
+
+    def expr(self, n):
+        if n.op == "+":
+            out = ""
+            for i, a in enumerate(n.args):
+                k, core = _split_coef(a)
+                if k < 0 and i > 0:
+                    out += " - " + self.ref(mul(const(-k), core))
+                else:
+                    out += (" + " if i else "") + self.ref(a)
+            return out
+        if n.op == "*":
+            args = list(n.args)
+            sign = ""
+            if is_const(args[0], -1):
+                sign = "-"
+                args = args[1:]
+            return sign + " * ".join(self.ref(f) for f in args)
+        return "%s(%s)" % (n.value, self.ref(n.args[0]))
+
+
+def emit_function(signature, prologue, outputs):
+    """prologue: [(symbol or None, line)]; lines tied to a symbol are kept
+    only if the body reads that symbol."""
+    indent = "    "
+    em = Emitter(indent)
+    body = [(lhs, em.ref(e)) for lhs, e in outputs]
+    lines = ["  template <class R> %s const {" % signature]
+    for symbol, line in prologue:
+        if symbol is None or symbol in em.used or (
+                symbol == "g" and any(u.startswith("g") for u in em.used)):
+            lines.append(indent + line)
+    lines += em.lines
+    lines += ["%s%s = %s;" % (indent, lhs, rhs) for lhs, rhs in body]
+    lines.append("  }")
+    return lines
+
+
+def emit_metric(spec):
+    comps, gamma, acc = build(spec)
+    cls = spec.name + "Metric"
+    chart_kind, chart_param = spec.chart
+    chart = {"spherical": "OblateChart", "oblate": "OblateChart",
+             "wormhole": "WormholeChart"}[chart_kind]
+    chart_init = chart_param if chart_param else "0.0"
+
+    math = (None, "using std::cos; using std::exp; using std::log; "
+                  "using std::pow; using std::sin; using std::sqrt;")
+    params = [(p, "const R %s = R(this->%s);" % (p, p)) for p, _ in spec.params]
+    coords = [(c, "const R %s = x[%d];" % (c, i)) for i, c in enumerate(COORDS)]
+    gload = [("g", "R g[4][4];"), ("g", "metric(x, g);")]
+    gdefs = [("g%d%d" % (i, j), "const R g%d%d = g[%d][%d];" % (i, j, i, j))
+             for i in range(4) for j in range(i, 4) if comps[i][j] is not ZERO]
+
+    out = []
+    out.append("// generated from %s" % spec.path.replace("\\", "/").split("/")[-1])
+    out.append("struct %s : CoordinateMetric<%s, %s> {" % (cls, cls, chart))
+    for p, _ in spec.params:
+        out.append("  double %s;" % p)
+    out.append("")
+    inits = ", ".join("%s(%s)" % (p, init) for p, init in spec.params)
+    out.append("  explicit %s(const BlackHole &bh) : %s {" % (cls, inits))
+    out.append("    chart = %s(%s);" % (chart, chart_init))
+    out.append("  }")
+    out.append("")
+    out.append("  double horizon() const { return %s; }" % spec.horizon)
+    out.append("  double scale() const { return %s; }" % spec.scale)
+    out.append("  double massRadius() const { return %s; }" % spec.mass)
+    out.append("")
+
+    metric_out = [("g[%d][%d]" % (i, j), comps[i][j]) for i in range(4)
+                  for j in range(4)]
+    out += emit_function("void metric(const R x[4], R g[4][4])",
+                         [math] + params + coords, metric_out)
+    out.append("")
+
+    gamma_out = [("gamma[%d][%d][%d]" % (m, a, b), gamma[m][a][b])
+                 for m in range(4) for a in range(4) for b in range(4)]
+    out += emit_function("void christoffel(const R x[4], R gamma[4][4][4])",
+                         [math] + params + coords + gload + gdefs, gamma_out)
+    out.append("")
+
+    rhs_out = [("dy[%d]" % m, sym("k" + COORDS[m])) for m in range(4)]
+    rhs_out += [("dy[%d]" % (4 + m), acc[m]) for m in range(4)]
+    kdefs = [("k" + c, "const R k%s = y[%d];" % (c, 4 + i))
+             for i, c in enumerate(COORDS)]
+    out += emit_function("void rhs(const R y[], R dy[])",
+                         [math, (None, "const R *x = y;")] + params + coords +
+                         kdefs + gload + gdefs, rhs_out)
+    out.append("};")
+    return cls, out
+
+
+def write_if_changed(path, lines):
+    """Leaves an unchanged file alone so dependents are not rebuilt."""
+    text = "\n".join(lines) + "\n"
+    try:
+        with open(path) as f:
+            if f.read() == text:
+                return
+    except OSError:
+        pass
+    with open(path, "w") as f:
+        f.write(text)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("-o", "--output", required=True)
+    ap.add_argument("--types", required=True)
+    ap.add_argument("metrics", nargs="+")
+    args = ap.parse_args()
+
+    specs = [read_spec(p) for p in sorted(args.metrics)]
+    for attr in ("name", "cli"):
+        seen = {}
+        for spec in specs:
+            key = getattr(spec, attr)
+            if key in seen:
+                raise ValueError("%s and %s both use %s %s" %
+                                 (seen[key], spec.path, attr, key))
+            seen[key] = spec.path
+
+    types = os.path.basename(args.types)
+    write_if_changed(args.types, [
+        "// Generated by tools/metricgen.py. Do not edit.",
+        "#pragma once",
+        "",
+        "// X(Name, \"cli-name\") for every metrics/*.metric file",
+        "#define BLACKHOLE_GENERATED_METRIC_TYPES(X) %s" %
+        " ".join('X(%s, "%s")' % (s.name, s.cli) for s in specs),
+    ])
+
+    lines = [
+        "// Generated by tools/metricgen.py. Do not edit.",
+        "#pragma once",
+        "",
+        '#include "chart.hpp"',
+        '#include "objects.hpp"',
+        '#include "%s"' % types,
+        "",
+        "#include <cmath>",
+        "",
+    ]
+    names = []
+    for spec in specs:
+        cls, body = emit_metric(spec)
+        names.append(spec.name)
+        lines += body
+        lines.append("")
+
+    lines.append("#define BLACKHOLE_GENERATED_METRICS(X) %s" %
+                 " ".join("X(%s)" % n for n in names))
+    write_if_changed(args.output, lines)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())